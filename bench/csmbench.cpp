@@ -0,0 +1,888 @@
+/*! \file csmbench.cpp
+ *  \brief Бенчмарки проекта Cosmic Turtle
+ *
+ *  Запуск: csmbench [scan | matrix | checksum | stuffing | loop [параметры] |
+ * idle [порты] [секунды] | replay файл]. Без параметров выполняются scan, matrix, checksum и
+ * stuffing.
+ *
+ * - scan: исходный полный перебор CSMSpinner::ruleApplier, перебор по
+ *   опорному байту с каждой из реализаций CSMScan и потоковый выделитель
+ *   CSMFramer на синтетическом потоке с правилами из main.cpp.
+ * - matrix: ruleApplier (исходный и текущий) и CSMFramer на синтетических
+ *   потоках с разным числом правил, длиной правил, долей "мусора" и размером
+ *   порции чтения. Ищущие функции работают так, как работал прежний цикл
+ *   опроса: порция дописывается в буфер, буфер просматривается заново.
+ * - checksum: вычисление контрольных сумм CSMChecksum на синтетическом
+ *   потоке. CRC-32C считается аппаратно, если процессор это позволяет.
+ * - stuffing: выделение и декодирование пакетов SLIP, HDLC и COBS из
+ *   закодированного потока порциями по CT_BENCH_CHUNK.
+ * - loop: сквозной замер на паре псевдотерминалов (см. CSMLoopback), в том
+ *   числе задержки доставки пакета сигналом и обработчиком в потоке
+ *   ввода-вывода; loop compare выводит их разность.
+ * - idle: множество открытых портов без обмена на псевдотерминалах. Выводятся
+ *   число потоков процесса, время процессора и переключения контекста в
+ *   секунду простоя.
+ * - replay: CSMFramer на принятых данных из записи сеанса (CSMCapture).
+ *
+ *  Все результаты выводятся в одну строку на замер, чтобы их можно было
+ * сравнивать между версиями обычным diff.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTimer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "csmturtle.hpp"
+#ifdef Q_OS_UNIX
+#include "csmloopback.hpp"
+#endif
+
+/*!
+ *  \brief Размер синтетического потока
+ */
+#define CT_BENCH_STREAM  (1 << 20)
+/*!
+ *  \brief Размер буфера для ruleApplier
+ */
+#define CT_BENCH_WINDOW  4096
+/*!
+ *  \brief Размер порции данных, подаваемой в CSMFramer
+ */
+#define CT_BENCH_CHUNK   64
+/*!
+ *  \brief Минимальное время одного замера, мс
+ */
+#define CT_BENCH_MINTIME 500
+/*!
+ *  \brief Размер потока для матрицы замеров
+ */
+#define CT_BENCH_MATRIXSTREAM (1 << 18)
+/*!
+ *  \brief Минимальное время одного замера матрицы, мс
+ */
+#define CT_BENCH_MATRIXTIME   200
+/*!
+ *  \brief Параметры сквозного замера по умолчанию: число пакетов, глубина
+ * конвейера, длина тела пакета
+ */
+#define CT_BENCH_LOOPCOUNT    20000
+#define CT_BENCH_LOOPDEPTH    1
+#define CT_BENCH_LOOPPAYLOAD  32
+/*!
+ *  \brief Число портов замера простоя по умолчанию
+ */
+#define CT_BENCH_IDLEPORTS    64
+/*!
+ *  \brief Длительность замера простоя по умолчанию, с
+ */
+#define CT_BENCH_IDLETIME     5
+
+/*!
+ *  \brief Функция поиска с сигнатурой ruleApplier
+ */
+typedef qint32 (*CSMApplier)(const PreceptSet *, const QByteArray &,
+                             qint32 *, qint32 *);
+
+/*!
+ *  \brief Исходная реализация ruleApplier, сохраненная для сравнения
+ */
+static qint32 baselineApplier(const PreceptSet * rules, const QByteArray & bytes,
+                              qint32 * pos, qint32 * rule)
+{
+    if (rules->length() == 0)
+    {
+        *pos  = 0;
+        *rule = -1;
+        return *pos;
+    }
+
+    int  counter;
+    for (qint32 i = 0; i < rules->length(); i++)
+    {
+        for (qint32 j = -rules->at(i).length() + 1;
+             j < bytes.length() - rules->at(i).length() + 1;
+             j++)
+        {
+            counter = 0;
+
+            for (qint32 k = 0; k < rules->at(i).length(); k++)
+            {
+                if ((j + k < 0) || (j + k >= bytes.length()))
+                {
+                    if (!rules->at(i)[k].exactly)
+                    {
+                        counter++;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    if (((!rules->at(i)[k].exactly) && (rules->at(i)[k].byte != (bytes.at(j + k) & 0xFF))) ||
+                        (( rules->at(i)[k].exactly) && (rules->at(i)[k].byte == (bytes.at(j + k) & 0xFF))))
+                    {
+                        counter++;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (counter == rules->at(i).length())
+            {
+                if (j < 0) j = 0;
+                *pos  = j;
+                *rule = i;
+
+                return *pos;
+            }
+        }
+    }
+
+    *pos  = -1;
+    *rule = -1;
+    return *pos;
+}
+
+/*!
+ *  \brief Синтетический поток: пакеты AA .. 55 FF с телом от 8 до 64 байт,
+ * разделенные "шумом" без байт правил
+ */
+static QByteArray makeStream()
+{
+    QByteArray stream;
+    quint32    seed = 12345;
+
+    stream.reserve(CT_BENCH_STREAM + 128);
+    while (stream.length() < CT_BENCH_STREAM)
+    {
+        seed = seed * 1103515245 + 12345;
+        qint32 gap  = (seed >> 16) % 256;
+        qint32 body = 8 + (seed >> 8) % 57;
+
+        stream.append(QByteArray(gap, '\x20'));
+        stream.append('\xAA');
+        for (qint32 i = 0; i < body; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            quint8 byte = (seed >> 16) & 0xFF;
+            if ((byte == 0xAA) || (byte == 0x55))
+                byte = 0x00;
+            stream.append((char)byte);
+        }
+        stream.append('\x55');
+        stream.append('\xFF');
+    }
+
+    return stream;
+}
+
+/*!
+ *  \brief Имя реализации CSMScan
+ */
+static const char * engineName(CSMScan::Engine engine)
+{
+    switch (engine)
+    {
+    case CSMScan::AVX2:
+        return "avx2";
+    case CSMScan::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+/*!
+ *  \brief Вывод результата замера
+ */
+static void report(const char * name, qint64 bytes, qint64 nsecs, qint64 found)
+{
+    printf("%-28s %10.1f MB/s  (%lld hits)\n", name,
+           (nsecs > 0) ? (bytes * 1000.0 / nsecs) : 0.0, (long long)found);
+}
+
+/*!
+ *  \brief Замер поиска конца пакета в буфере, где пакет лежит после долгой
+ * паузы (худший случай прежнего цикла опроса)
+ */
+static void benchApplier(const char * name, const PreceptSet & rules,
+                         bool baseline)
+{
+    QByteArray    window(CT_BENCH_WINDOW - 16, '\x20');
+    QElapsedTimer timer;
+    qint64        bytes = 0;
+    qint64        found = 0;
+    qint32        pos;
+    qint32        rule;
+
+    window.append(QByteArray("\xAA\x01\xFE\x00\x00\x00\x00\x00"
+                             "\x04\xFB\x02\x00\xFF\xFD\x55\xFF", 16));
+
+    timer.start();
+    do
+    {
+        if (baseline)
+            baselineApplier(&rules, window, &pos, &rule);
+        else
+            CSMSpinner::ruleApplier(&rules, window, &pos, &rule);
+        if (pos >= 0)
+            found++;
+        bytes += window.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MINTIME);
+
+    report(name, bytes, timer.nsecsElapsed(), found);
+}
+
+/*!
+ *  \brief Замер потокового выделения пакетов порциями CT_BENCH_CHUNK
+ *
+ *  Данные копируются прямо в приемный буфер, как это делает CSMSpinner.
+ */
+static void benchFramer(const char * name, const CSMMatcher & matcher,
+                        const QByteArray & stream)
+{
+    QElapsedTimer timer;
+    CSMFramer     framer;
+    QByteArray    frame;
+    qint64        bytes = 0;
+    qint64        found = 0;
+
+    framer.setMatcher(&matcher);
+    timer.start();
+    do
+    {
+        for (qint32 at = 0; at < stream.length(); )
+        {
+            qint32 space;
+            char * target = framer.reserve(&space);
+            qint32 length = qMin(qMin(space, CT_BENCH_CHUNK),
+                                 stream.length() - at);
+
+            memcpy(target, stream.constData() + at, length);
+            framer.commit(length);
+            at += length;
+            while (framer.next(&frame))
+                found++;
+        }
+        bytes += stream.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MINTIME);
+
+    report(name, bytes, timer.nsecsElapsed(), found);
+}
+
+/*!
+ *  \brief Генератор псевдослучайных чисел замеров (воспроизводимый)
+ */
+static quint32 nextRandom(quint32 * seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+
+    return (*seed >> 16) & 0x7FFF;
+}
+
+/*!
+ *  \brief Набор правил конца пакета для матрицы
+ *
+ *  Все байты правил точные и лежат в диапазоне 0x80..0xFF; у правил разные
+ * первые байты, поэтому ни одно правило не является префиксом другого.
+ *  \param count Число правил
+ *  \param length Длина каждого правила
+ */
+static PreceptSet makeRules(qint32 count, qint32 length)
+{
+    PreceptSet rules;
+
+    for (qint32 r = 0; r < count; r++)
+    {
+        PreceptArray rule;
+
+        rule.append(PreceptByte(true, 0x80 + r));
+        for (qint32 k = 1; k < length; k++)
+            rule.append(PreceptByte(true, 0xC0 + ((r * 7 + k * 13) % 0x40)));
+        rules.append(rule);
+    }
+
+    return rules;
+}
+
+/*!
+ *  \brief Синтетический поток для матрицы
+ *
+ *  Пакет - тело от 8 до 64 байт из диапазона 0x00..0x7F и одно из правил.
+ * Между пакетами лежит "мусор" из того же диапазона такой длины, чтобы его
+ * доля в потоке в среднем составляла garbage процентов.
+ *  \param rules Правила конца пакета
+ *  \param garbage Доля мусора, %
+ */
+static QByteArray makeMatrixStream(const PreceptSet & rules, qint32 garbage)
+{
+    QByteArray stream;
+    quint32    seed = 54321;
+
+    stream.reserve(CT_BENCH_MATRIXSTREAM + 4096);
+    while (stream.length() < CT_BENCH_MATRIXSTREAM)
+    {
+        qint32 body  = 8 + nextRandom(&seed) % 57;
+        qint32 frame = body + rules.at(0).length();
+        qint32 gap   = (garbage >= 100) ? CT_BENCH_MATRIXSTREAM :
+                       (frame * garbage / (100 - garbage));
+
+        /* Spread the gap +-50% so buffer lengths vary */
+        if (gap > 0)
+            gap = gap / 2 + nextRandom(&seed) % (gap + 1);
+        for (qint32 i = 0; i < gap; i++)
+            stream.append((char)(nextRandom(&seed) & 0x7F));
+        for (qint32 i = 0; i < body; i++)
+            stream.append((char)(nextRandom(&seed) & 0x7F));
+
+        const PreceptArray & rule = rules.at(nextRandom(&seed) % rules.length());
+        for (qint32 k = 0; k < rule.length(); k++)
+            stream.append((char)rule.at(k).byte);
+    }
+
+    return stream;
+}
+
+/*!
+ *  \brief Прогон ищущей функции по потоку так, как это делал прежний цикл
+ * опроса: порция дописывается в буфер, буфер просматривается целиком
+ *  \return Скорость, МБ/с
+ */
+static double runApplier(CSMApplier applier, const PreceptSet & rules,
+                         const QByteArray & stream, qint32 chunk,
+                         qint64 * found)
+{
+    QElapsedTimer timer;
+    QByteArray    buffer;
+    qint64        bytes = 0;
+    qint32        pos;
+    qint32        rule;
+
+    *found = 0;
+    timer.start();
+    do
+    {
+        qint64 frames = 0;
+
+        buffer.clear();
+        for (qint32 at = 0; at < stream.length(); at += chunk)
+        {
+            buffer.append(stream.constData() + at,
+                          qMin(chunk, stream.length() - at));
+            while (applier(&rules, buffer, &pos, &rule) >= 0)
+            {
+                buffer.remove(0, pos + rules.at(rule).length());
+                frames++;
+            }
+        }
+        *found = frames;
+        bytes += stream.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MATRIXTIME);
+
+    return (timer.nsecsElapsed() > 0) ?
+           (bytes * 1000.0 / timer.nsecsElapsed()) : 0.0;
+}
+
+/*!
+ *  \brief Прогон CSMFramer по потоку порциями chunk
+ *  \return Скорость, МБ/с
+ */
+static double runFramer(const CSMMatcher & matcher, const QByteArray & stream,
+                        qint32 chunk, qint64 * found)
+{
+    QElapsedTimer timer;
+    CSMFramer     framer;
+    QByteArray    frame;
+    qint64        bytes = 0;
+
+    *found = 0;
+    framer.setMatcher(&matcher);
+    timer.start();
+    do
+    {
+        qint64 frames = 0;
+
+        for (qint32 at = 0; at < stream.length(); )
+        {
+            qint32 space;
+            char * target = framer.reserve(&space);
+            qint32 length = qMin(qMin(space, chunk), stream.length() - at);
+
+            memcpy(target, stream.constData() + at, length);
+            framer.commit(length);
+            at += length;
+            while (framer.next(&frame))
+                frames++;
+        }
+        *found = frames;
+        bytes += stream.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MATRIXTIME);
+
+    return (timer.nsecsElapsed() > 0) ?
+           (bytes * 1000.0 / timer.nsecsElapsed()) : 0.0;
+}
+
+/*!
+ *  \brief Матрица замеров: число правил x длина правила x доля мусора x
+ * размер порции
+ *
+ *  Выводится число пакетов за один проход потока. ruleApplier при
+ * нескольких правилах отдает совпадение первого по порядку правила, а не
+ * ближайшее, поэтому его счет может отличаться от CSMFramer; расхождение
+ * исходной и текущей ruleApplier означает ошибку.
+ */
+static void benchMatrix()
+{
+    const qint32 counts[]   = {1, 4, 16};
+    const qint32 lengths[]  = {2, 8};
+    const qint32 garbages[] = {10, 50, 90};
+    const qint32 chunks[]   = {16, 256, 4096};
+
+    printf("%5s %4s %4s %6s %12s %12s %12s %8s %8s\n", "rules", "len",
+           "junk", "chunk", "baseline", "applier", "framer", "applied",
+           "framed");
+    for (qint32 c = 0; c < 3; c++)
+    {
+        for (qint32 l = 0; l < 2; l++)
+        {
+            PreceptSet rules = makeRules(counts[c], lengths[l]);
+            CSMMatcher matcher(PreceptSet(), rules);
+
+            for (qint32 g = 0; g < 3; g++)
+            {
+                QByteArray stream = makeMatrixStream(rules, garbages[g]);
+
+                for (qint32 k = 0; k < 3; k++)
+                {
+                    qint64 basefound;
+                    qint64 applierfound;
+                    qint64 framerfound;
+                    double base    = runApplier(baselineApplier, rules, stream,
+                                                chunks[k], &basefound);
+                    double applier = runApplier(CSMSpinner::ruleApplier, rules,
+                                                stream, chunks[k], &applierfound);
+                    double framer  = runFramer(matcher, stream, chunks[k],
+                                               &framerfound);
+
+                    printf("%5d %4d %3d%% %6d %7.1f MB/s %7.1f MB/s %7.1f MB/s "
+                           "%8lld %8lld%s\n",
+                           counts[c], lengths[l], garbages[g], chunks[k],
+                           base, applier, framer, (long long)applierfound,
+                           (long long)framerfound,
+                           (basefound == applierfound) ? "" : "  MISMATCH");
+                }
+            }
+        }
+    }
+}
+
+/*!
+ *  \brief Правила начала и конца пакета из main.cpp
+ */
+static void makeMainRules(PreceptSet * beginseq, PreceptSet * endseq)
+{
+    PreceptArray correctbegin1;
+    correctbegin1.append(PreceptByte(false, 0xAA));
+    correctbegin1.append(PreceptByte(true,  0xAA));
+    correctbegin1.append(PreceptByte(false, 0xAA));
+    beginseq->append(correctbegin1);
+
+    PreceptArray correctend1;
+    correctend1.append(PreceptByte(false, 0x55));
+    correctend1.append(PreceptByte(true,  0x55));
+    correctend1.append(PreceptByte(true,  0xFF));
+    PreceptArray correctend2;
+    correctend2.append(PreceptByte(false, 0x55));
+    correctend2.append(PreceptByte(true,  0x55));
+    correctend2.append(PreceptByte(false, 0xFF));
+    endseq->append(correctend1);
+    endseq->append(correctend2);
+}
+
+/*!
+ *  \brief Замеры по реализациям CSMScan на правилах из main.cpp
+ */
+static void benchScan()
+{
+    PreceptSet beginseq;
+    PreceptSet endseq;
+
+    makeMainRules(&beginseq, &endseq);
+
+    QByteArray stream = makeStream();
+    CSMMatcher matcher(beginseq, endseq);
+
+    printf("stream %d bytes, window %d, chunk %d\n",
+           stream.length(), CT_BENCH_WINDOW, CT_BENCH_CHUNK);
+
+    benchApplier("ruleApplier baseline", endseq, true);
+
+    const CSMScan::Engine engines[] = {CSMScan::Scalar, CSMScan::SSE2,
+                                       CSMScan::AVX2};
+    for (qint32 i = 0; i < 3; i++)
+    {
+        if (CSMScan::setEngine(engines[i]) != engines[i])
+            continue;
+
+        QByteArray name = QByteArray("ruleApplier ") + engineName(engines[i]);
+        benchApplier(name.constData(), endseq, false);
+
+        name = QByteArray("CSMFramer ") + engineName(engines[i]);
+        benchFramer(name.constData(), matcher, stream);
+    }
+    CSMScan::setEngine(CSMScan::Auto);
+}
+
+/*!
+ *  \brief Замер одной контрольной суммы
+ */
+static void benchOneChecksum(const char * name, const CSMChecksum & checksum,
+                             const QByteArray & stream)
+{
+    QElapsedTimer timer;
+    qint64        bytes  = 0;
+    quint32       result = 0;
+
+    timer.start();
+    do
+    {
+        result ^= checksum.compute(stream.constData(), stream.length());
+        bytes  += stream.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MINTIME);
+
+    qint64 nsecs = timer.nsecsElapsed();
+    printf("%-28s %10.1f MB/s  (%08X)\n", name,
+           (nsecs > 0) ? (bytes * 1000.0 / nsecs) : 0.0, result);
+}
+
+/*!
+ *  \brief Замеры контрольных сумм
+ */
+static void benchChecksum()
+{
+    QByteArray stream = makeStream();
+
+    benchOneChecksum("xor8",         CSMChecksum::xor8(),        stream);
+    benchOneChecksum("sum8",         CSMChecksum::sum8(),        stream);
+    benchOneChecksum("crc8",         CSMChecksum::crc8(),        stream);
+    benchOneChecksum("crc16 modbus", CSMChecksum::crc16Modbus(), stream);
+    benchOneChecksum("crc16 ccitt",  CSMChecksum::crc16Ccitt(),  stream);
+    benchOneChecksum("crc32",        CSMChecksum::crc32(),       stream);
+    benchOneChecksum(CSMChecksum::crc32c().isAccelerated() ?
+                     "crc32c sse4.2" : "crc32c",
+                     CSMChecksum::crc32c(), stream);
+}
+
+/*!
+ *  \brief Замер выделения и декодирования одного протокола байт-стаффинга
+ *
+ *  Поток - закодированные пакеты по 256 байт, примерно каждый 64-й байт
+ * тела требует замены.
+ */
+static void benchOneStuffing(const char * name, CSMStuffing::Mode mode)
+{
+    QByteArray    stream;
+    QByteArray    packet(256, '\0');
+    QByteArray    encoded;
+    QByteArray    decoded;
+    quint32       seed = 1;
+    CSMMatcher    matcher(PreceptSet(), CSMStuffing::rules(mode));
+    CSMFramer     framer;
+    QByteArray    frame;
+    QElapsedTimer timer;
+    qint64        bytes  = 0;
+    qint64        frames = 0;
+
+    while (stream.length() < CT_BENCH_STREAM)
+    {
+        for (qint32 i = 0; i < packet.length(); i++)
+        {
+            packet[i] = (nextRandom(&seed) % 64 == 0) ?
+                        (char)CSMStuffing::delimiter(mode) :
+                        (char)(nextRandom(&seed) & 0xFF);
+        }
+        CSMStuffing::encode(mode, packet, &encoded);
+        stream.append(encoded);
+    }
+
+    framer.setMatcher(&matcher);
+    timer.start();
+    do
+    {
+        frames = 0;
+        for (qint32 at = 0; at < stream.length(); at += CT_BENCH_CHUNK)
+        {
+            framer.feed(stream.mid(at, CT_BENCH_CHUNK));
+            while (framer.next(&frame))
+            {
+                if ((CSMStuffing::decode(mode, frame.constData(),
+                                         frame.length() - 1, &decoded)) &&
+                    (!decoded.isEmpty()))
+                {
+                    frames++;
+                }
+            }
+        }
+        bytes += stream.length();
+    }
+    while (timer.elapsed() < CT_BENCH_MINTIME);
+
+    report(name, bytes, timer.nsecsElapsed(), frames);
+}
+
+/*!
+ *  \brief Замеры протоколов байт-стаффинга
+ */
+static void benchStuffing()
+{
+    benchOneStuffing("stuffing slip", CSMStuffing::Slip);
+    benchOneStuffing("stuffing hdlc", CSMStuffing::Hdlc);
+    benchOneStuffing("stuffing cobs", CSMStuffing::Cobs);
+}
+
+/*!
+ *  \brief Воспроизведение записи сеанса (CSMCapture) через CSMFramer с
+ * правилами из main.cpp
+ */
+static int benchReplay(const char * path)
+{
+    CSMCaptureReader reader;
+    CSMCaptureRecord record;
+    PreceptSet       beginseq;
+    PreceptSet       endseq;
+    qint64           rxbytes = 0;
+
+    if (!reader.open(QString::fromLocal8Bit(path)))
+    {
+        fprintf(stderr, "can't open capture %s\n", path);
+        return 1;
+    }
+    while (reader.next(&record))
+    {
+        if (record.kind == CSMCapture::Rx)
+            rxbytes += record.length;
+    }
+
+    makeMainRules(&beginseq, &endseq);
+
+    CSMMatcher    matcher(beginseq, endseq);
+    CSMFramer     framer;
+    QElapsedTimer timer;
+    qint64        bytes  = 0;
+    qint64        frames = 0;
+
+    framer.setMatcher(&matcher);
+    timer.start();
+    do
+    {
+        reader.rewind();
+        framer.reset();
+        frames = reader.replay(&framer);
+        bytes += rxbytes;
+    }
+    while (timer.elapsed() < CT_BENCH_MINTIME);
+
+    printf("capture %lld Rx bytes\n", (long long)rxbytes);
+    report("CSMFramer replay", bytes, timer.nsecsElapsed(), frames);
+
+    return 0;
+}
+
+#ifdef Q_OS_UNIX
+/*!
+ *  \brief Сравнение доставки пакета сигналом и обработчиком в потоке
+ * ввода-вывода
+ *
+ *  Выполняет замеры frame и direct подряд в одном процессе и выводит выигрыш
+ * прямой доставки по квантилям задержки.
+ *  \param app Приложение, цикл событий которого запускается для каждого замера
+ *  \param count Число пакетов
+ *  \param payload Длина тела пакета
+ *  \return Код завершения
+ */
+static int benchCompare(QCoreApplication & app, qint32 count, qint32 payload)
+{
+    const CSMLoopback::Mode modes[]     = {CSMLoopback::Frame, CSMLoopback::Direct};
+    const double            quantiles[] = {0.5, 0.99, 0.999};
+    qint64                  latencies[2][3];
+    int                     status = 0;
+
+    for (qint32 i = 0; i < 2; i++)
+    {
+        CSMLoopback loop(modes[i], count, 1, payload);
+        if (!loop.start())
+        {
+            fprintf(stderr, "can't open a pseudo-terminal pair\n");
+            return 1;
+        }
+        status |= app.exec();
+        for (qint32 j = 0; j < 3; j++)
+            latencies[i][j] = loop.latency(quantiles[j]);
+    }
+
+    printf("%-8s saving us:", "compare");
+    for (qint32 j = 0; j < 3; j++)
+        printf("  p%g %.1f", quantiles[j] * 100,
+               (latencies[0][j] - latencies[1][j]) / 1e3);
+    printf("\n");
+    fflush(stdout);
+
+    return status;
+}
+#endif
+
+/*!
+ *  \brief Сквозной замер: loop [stream|request|frame|direct|compare] [число]
+ * [глубина] [тело]
+ */
+static int benchLoop(int argc, char * argv[])
+{
+#ifdef Q_OS_UNIX
+    QCoreApplication  app(argc, argv);
+    CSMLoopback::Mode mode    = CSMLoopback::Request;
+    qint32            count   = CT_BENCH_LOOPCOUNT;
+    qint32            depth   = CT_BENCH_LOOPDEPTH;
+    qint32            payload = CT_BENCH_LOOPPAYLOAD;
+
+    if ((argc > 2) && (strcmp(argv[2], "stream") == 0))
+        mode = CSMLoopback::Stream;
+    if ((argc > 2) && (strcmp(argv[2], "frame") == 0))
+        mode = CSMLoopback::Frame;
+    if ((argc > 2) && (strcmp(argv[2], "direct") == 0))
+        mode = CSMLoopback::Direct;
+    if (argc > 3)
+        count = qMax(atoi(argv[3]), 1);
+    if (argc > 4)
+        depth = qMax(atoi(argv[4]), 1);
+    if (argc > 5)
+        payload = qMax(atoi(argv[5]), 0);
+    if ((argc > 2) && (strcmp(argv[2], "compare") == 0))
+        return benchCompare(app, count, payload);
+
+    CSMLoopback loop(mode, count, depth, payload);
+    if (!loop.start())
+    {
+        fprintf(stderr, "can't open a pseudo-terminal pair\n");
+        return 1;
+    }
+
+    return app.exec();
+#else
+    fprintf(stderr, "loop benchmark needs a pseudo-terminal (*nix only)\n");
+    return 1;
+#endif
+}
+
+#ifdef Q_OS_UNIX
+/*!
+ *  \brief Число потоков процесса по /proc/self/status
+ *  \return Число потоков или -1, если оно недоступно
+ */
+static qint32 threadCount()
+{
+    QFile status("/proc/self/status");
+
+    if (!status.open(QIODevice::ReadOnly))
+        return -1;
+    while (!status.atEnd())
+    {
+        QByteArray line = status.readLine();
+        if (line.startsWith("Threads:"))
+            return line.mid(8).trimmed().toInt();
+    }
+
+    return -1;
+}
+#endif
+
+/*!
+ *  \brief Замер простоя: idle [порты] [секунды]
+ */
+static int benchIdle(int argc, char * argv[])
+{
+#ifdef Q_OS_UNIX
+    QCoreApplication           app(argc, argv);
+    qint32                     ports   = CT_BENCH_IDLEPORTS;
+    qint32                     seconds = CT_BENCH_IDLETIME;
+    QVector<CSMPtyTransport *> devices;
+    QVector<CSMCom *>          coms;
+
+    if (argc > 2)
+        ports = qMax(atoi(argv[2]), 1);
+    if (argc > 3)
+        seconds = qMax(atoi(argv[3]), 1);
+
+    for (qint32 i = 0; i < ports; i++)
+    {
+        CSMPtyTransport * device = 0;
+        CSMPtyTransport * slave  = 0;
+
+        if (!CSMPtyTransport::openPair(&device, &slave))
+        {
+            fprintf(stderr, "can't open pseudo-terminal pair %d\n", i);
+            break;
+        }
+        devices.append(device);
+        coms.append(new CSMCom(slave));
+    }
+
+    /* Only the idle period counts, not opening the ports */
+    CSMUsage      usage = CSMUsage::now();
+    QElapsedTimer clock;
+    clock.start();
+    QTimer::singleShot(seconds * 1000, &app, SLOT(quit()));
+    app.exec();
+
+    CSMUsage spent = CSMUsage::now();
+    double   secs  = clock.nsecsElapsed() / 1e9;
+
+    printf("idle     %4d ports  threads %3d (reactor %d)  cpu %8.3f ms/s  ctxsw %8.1f/s\n",
+           coms.size(), threadCount(), CSMReactor::instance()->threadCount(),
+           (spent.cpu - usage.cpu) / 1e6 / secs,
+           (spent.switches - usage.switches) / secs);
+    fflush(stdout);
+
+    qDeleteAll(coms);
+    qDeleteAll(devices);
+
+    return (coms.size() == ports) ? 0 : 1;
+#else
+    fprintf(stderr, "idle benchmark needs a pseudo-terminal (*nix only)\n");
+    return 1;
+#endif
+}
+
+int main(int argc, char * argv[])
+{
+    const char * mode = (argc > 1) ? argv[1] : "";
+
+    if (strcmp(mode, "loop") == 0)
+        return benchLoop(argc, argv);
+    if (strcmp(mode, "idle") == 0)
+        return benchIdle(argc, argv);
+    if ((strcmp(mode, "replay") == 0) && (argc > 2))
+        return benchReplay(argv[2]);
+    if ((mode[0] == '\0') || (strcmp(mode, "scan") == 0))
+        benchScan();
+    if ((mode[0] == '\0') || (strcmp(mode, "matrix") == 0))
+        benchMatrix();
+    if ((mode[0] == '\0') || (strcmp(mode, "checksum") == 0))
+        benchChecksum();
+    if ((mode[0] == '\0') || (strcmp(mode, "stuffing") == 0))
+        benchStuffing();
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#-------------------------------------------------
+#
+# Microbenchmarks of the Cosmic Turtle packet search
+#
+#-------------------------------------------------
+
+QT       += core
+QT       += serialport
+QT       -= gui
+
+TARGET = csmbench
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG   += c++11
+
+TEMPLATE = app
+
+INCLUDEPATH += ../com
+
+SOURCES += csmbench.cpp \
+    ../com/csmturtle.cpp \
+    ../com/csmframer.cpp \
+    ../com/csmchecksum.cpp \
+    ../com/csmstuffing.cpp \
+    ../com/csmscan.cpp \
+    ../com/csmqueue.cpp \
+    ../com/csmpool.cpp \
+    ../com/csmreactor.cpp \
+    ../com/csmstats.cpp \
+    ../com/csmcapture.cpp \
+    ../com/csmtransport.cpp
+
+HEADERS += \
+    ../com/csmturtle.hpp \
+    ../com/csmframer.hpp \
+    ../com/csmchecksum.hpp \
+    ../com/csmstuffing.hpp \
+    ../com/csmscan.hpp \
+    ../com/csmqueue.hpp \
+    ../com/csmpool.hpp \
+    ../com/csmreactor.hpp \
+    ../com/csmstats.hpp \
+    ../com/csmcapture.hpp \
+    ../com/csmtransport.hpp
+
+unix {
+    SOURCES += csmloopback.cpp \
+        ../com/csmptytransport.cpp
+    HEADERS += csmloopback.hpp \
+        ../com/csmptytransport.hpp
+    LIBS    += -lutil
+}
@@ -0,0 +1,272 @@
+#include <QCoreApplication>
+#include <algorithm>
+#include <stdio.h>
+#include <sys/resource.h>
+#include "csmloopback.hpp"
+
+CSMUsage CSMUsage::now()
+{
+    struct rusage self;
+    CSMUsage      usage;
+
+    getrusage(RUSAGE_SELF, &self);
+    usage.cpu = ((qint64)self.ru_utime.tv_sec + self.ru_stime.tv_sec) * 1000000000 +
+                ((qint64)self.ru_utime.tv_usec + self.ru_stime.tv_usec) * 1000;
+    usage.switches = self.ru_nvcsw + self.ru_nivcsw;
+
+    return usage;
+}
+
+CSMLoopback::CSMLoopback(Mode mode, qint32 count, qint32 depth, qint32 payload)
+{
+    this->mode    = mode;
+    this->count   = count;
+    this->depth   = qMax(depth, 1);
+    this->payload = payload;
+    sent   = 0;
+    done   = 0;
+    lost   = 0;
+    bytes  = 0;
+    stamp  = 0;
+    device = 0;
+    com    = 0;
+    latencies.reserve(count);
+
+    idle.setSingleShot(true);
+    idle.setInterval(CT_LOOP_IDLE);
+    connect(&idle, SIGNAL(timeout()),
+            this,  SLOT(idleExpired()));
+}
+
+CSMLoopback::~CSMLoopback()
+{
+    delete com;
+    delete device;
+}
+
+bool CSMLoopback::start()
+{
+    CSMPtyTransport * slave = 0;
+
+    if (!CSMPtyTransport::openPair(&device, &slave))
+        return false;
+
+    PreceptSet   endseq;
+    PreceptArray end;
+    end.append(PreceptByte(true, 0x55));
+    end.append(PreceptByte(true, 0xFF));
+    endseq.append(end);
+
+    com = new CSMCom(slave);
+    com->setEndSequence(endseq);
+    connect(com,  SIGNAL(bytesOut(QByteArray)),
+            this, SLOT(packetIn(QByteArray)));
+
+    usage = CSMUsage::now();
+    clock.start();
+    idle.start();
+    if (mode == Direct)
+    {
+        /* Stamp on the I/O thread, everything else back on ours */
+        com->setFrameCallback([this](const QByteArray & frame)
+        {
+            QMetaObject::invokeMethod(this, "directIn", Qt::QueuedConnection,
+                                      Q_ARG(qint64, clock.nsecsElapsed()),
+                                      Q_ARG(qint32, frame.length()));
+        });
+    }
+    if ((mode == Frame) || (mode == Direct))
+    {
+        sendFrame();
+        return true;
+    }
+    if (mode == Stream)
+    {
+        QByteArray stream;
+
+        for (qint32 i = 0; i < count; i++)
+            stream.append(makePacket(i));
+        device->write(stream);
+        return true;
+    }
+
+    connect(device, SIGNAL(readyRead()),
+            this,   SLOT(deviceRead()));
+    connect(com,  SIGNAL(replyReceived(QByteArray,QByteArray)),
+            this, SLOT(replyIn(QByteArray,QByteArray)));
+    connect(com,  SIGNAL(requestTimeout(QByteArray)),
+            this, SLOT(requestLost(QByteArray)));
+    com->setPipelineDepth(depth);
+    com->setCorrelationKey(1, 1, 2);
+    for (qint32 i = 0; i < depth; i++)
+        sendRequest();
+
+    return true;
+}
+
+QByteArray CSMLoopback::makePacket(quint16 sequence)
+{
+    QByteArray packet;
+
+    /* 7 bits per sequence byte: the number can never look like 55 FF */
+    packet.reserve(payload + 5);
+    packet.append('\xAA');
+    packet.append((char)((sequence >> 7) & 0x7F));
+    packet.append((char)(sequence & 0x7F));
+    for (qint32 i = 0; i < payload; i++)
+        packet.append((char)((i * 7) % 0x50));
+    packet.append('\x55');
+    packet.append('\xFF');
+
+    return packet;
+}
+
+void CSMLoopback::sendRequest()
+{
+    if (sent >= count)
+        return;
+
+    quint16 sequence = sent & 0x3FFF;
+
+    stamps.insert(sequence, clock.nsecsElapsed());
+    com->bytesIn(makePacket(sequence), CT_LOOP_TIMEOUT);
+    sent++;
+}
+
+void CSMLoopback::sendFrame()
+{
+    if (sent >= count)
+        return;
+
+    QByteArray packet = makePacket(sent & 0x3FFF);
+
+    stamp = clock.nsecsElapsed();
+    device->write(packet);
+    sent++;
+}
+
+void CSMLoopback::frameIn(qint64 arrived, qint32 length)
+{
+    latencies.append(arrived - stamp);
+    bytes += length;
+    complete();
+    sendFrame();
+}
+
+void CSMLoopback::deviceRead()
+{
+    qint64 available = device->bytesAvailable();
+
+    if (available <= 0)
+        return;
+
+    QByteArray echo((int)available, '\0');
+    qint64     received = device->read(echo.data(), available);
+
+    if (received > 0)
+    {
+        echo.resize((int)received);
+        device->write(echo);
+    }
+}
+
+void CSMLoopback::packetIn(QByteArray bytes)
+{
+    if (mode == Frame)
+    {
+        frameIn(clock.nsecsElapsed(), bytes.length());
+        return;
+    }
+    if (mode != Stream)
+        return;
+
+    this->bytes += bytes.length();
+    complete();
+}
+
+void CSMLoopback::directIn(qint64 arrived, qint32 length)
+{
+    frameIn(arrived, length);
+}
+
+void CSMLoopback::replyIn(QByteArray request, QByteArray reply)
+{
+    quint16 sequence = (((quint8)request.at(1)) << 7) | (quint8)request.at(2);
+
+    latencies.append(clock.nsecsElapsed() - stamps.take(sequence));
+    bytes += reply.length();
+    complete();
+    sendRequest();
+}
+
+void CSMLoopback::requestLost(QByteArray request)
+{
+    quint16 sequence = (((quint8)request.at(1)) << 7) | (quint8)request.at(2);
+
+    stamps.remove(sequence);
+    lost++;
+    complete();
+    sendRequest();
+}
+
+void CSMLoopback::idleExpired()
+{
+    lost += count - done;
+    done  = count;
+    finish();
+}
+
+void CSMLoopback::complete()
+{
+    done++;
+    if (done >= count)
+        finish();
+    else
+        idle.start();
+}
+
+qint64 CSMLoopback::latency(qreal quantile) const
+{
+    /* finish() has sorted the samples */
+    if (latencies.isEmpty())
+        return -1;
+
+    qint32 at = qBound(0, (qint32)(quantile * latencies.length()),
+                       latencies.length() - 1);
+
+    return latencies.at(at);
+}
+
+void CSMLoopback::finish()
+{
+    static const char * names[] = {"stream", "request", "frame", "direct"};
+
+    qint64   nsecs  = clock.nsecsElapsed();
+    double   secs   = (nsecs > 0) ? (nsecs / 1e9) : 1.0;
+    CSMUsage spent  = CSMUsage::now();
+    qint32   frames = qMax(done - lost, 1);
+
+    idle.stop();
+    printf("%-8s %7d x %4d B  depth %3d  %10.0f frames/s  %7.2f MB/s  lost %d\n",
+           names[mode], count, payload + 5,
+           (mode == Request) ? depth : 0, (done - lost) / secs,
+           bytes / secs / 1e6, lost);
+
+    if (!latencies.isEmpty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+
+        const double quantiles[] = {0.5, 0.99, 0.999};
+        printf("%-8s latency us:", "");
+        for (qint32 i = 0; i < 3; i++)
+            printf("  p%g %.1f", quantiles[i] * 100, latency(quantiles[i]) / 1e3);
+        printf("  max %.1f\n", latencies.last() / 1e3);
+    }
+    /* Both ends live in this process: the device's share is included */
+    printf("%-8s cpu %.2f us/frame  ctxsw %.2f/frame\n", "",
+           (spent.cpu - usage.cpu) / 1e3 / frames,
+           (double)(spent.switches - usage.switches) / frames);
+    fflush(stdout);
+
+    QCoreApplication::exit((lost > 0) ? 1 : 0);
+}
@@ -0,0 +1,239 @@
+#ifndef CSMLOOPBACK_HPP
+#define CSMLOOPBACK_HPP
+
+/*! \file csmloopback.hpp
+ *  \brief Сквозной замер проекта Cosmic Turtle на паре псевдотерминалов
+ *
+ *  CSMCom работает на ведомом конце пары CSMPtyTransport, ведущий конец
+ * играет роль устройства. Замеряется весь путь данных: очередь, поток
+ * ввода-вывода, выделение пакетов и доставка сигналов в поток приложения.
+ *
+ *  Режимы:
+ * - Stream: устройство непрерывно присылает пакеты, CSMCom только слушает.
+ *   Выводятся пакеты/с и байт/с.
+ * - Request: CSMCom отправляет запросы, устройство возвращает их обратно
+ *   (эхо). Выводятся запросы/с, байт/с и задержка p50/p99/p999 от bytesIn до
+ *   replyReceived.
+ * - Frame, Direct: устройство присылает следующий пакет, только когда принят
+ *   предыдущий. Выводится задержка от записи пакета устройством до его
+ *   получения приложением: сигналом bytesOut (Frame) или обработчиком
+ *   setFrameCallback в потоке ввода-вывода (Direct). Разность - выигрыш
+ *   прямой доставки на пакет. Режим compare в csmbench выполняет оба замера
+ *   подряд и выводит эту разность.
+ *
+ *  Во всех режимах выводится также расход процессора и число переключений
+ * контекста процесса на пакет (getrusage).
+ */
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "csmturtle.hpp"
+#include "csmptytransport.hpp"
+
+/*!
+ *  \brief Таймаут одного запроса в сквозном замере, мс
+ */
+#define CT_LOOP_TIMEOUT 1000
+/*!
+ *  \brief Время без поступления данных, после которого замер прерывается, мс
+ */
+#define CT_LOOP_IDLE    2000
+
+/*!
+ *  \brief Расход ресурсов процесса
+ */
+struct CSMUsage
+{
+    /*!
+     *  \brief Время процессора, пользователь и ядро, нс
+     */
+    qint64 cpu;
+    /*!
+     *  \brief Переключения контекста, добровольные и вынужденные
+     */
+    qint64 switches;
+
+    /*!
+     *  \brief Текущий расход процесса
+     */
+    static CSMUsage now();
+};
+
+/*!
+ *  \brief Сквозной замер на паре псевдотерминалов
+ */
+class CSMLoopback : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Режим замера
+     */
+    enum Mode
+    {
+        Stream,  //!< Поток пакетов от устройства
+        Request, //!< Запрос-ответ через эхо
+        Frame,   //!< Пакет за пакетом, доставка сигналом
+        Direct   //!< Пакет за пакетом, доставка обработчиком
+    };
+
+    /*!
+     *  \brief Конструктор класса
+     *  \param mode Режим замера
+     *  \param count Число пакетов или запросов
+     *  \param depth Глубина конвейера (только Request)
+     *  \param payload Длина тела пакета, байт
+     */
+    CSMLoopback(Mode mode, qint32 count, qint32 depth, qint32 payload);
+    /*!
+     *  \brief Деструктор класса
+     */
+    ~CSMLoopback();
+
+    /*!
+     *  \brief Запуск замера
+     *
+     *  По окончании замера выводит результат и завершает цикл событий
+     * приложения с кодом 0 (или 1, если часть пакетов потеряна).
+     *  \return Статус успешности создания пары псевдотерминалов
+     */
+    bool start();
+    /*!
+     *  \brief Квантиль задержки завершенного замера
+     *  \param quantile Квантиль, от 0 до 1
+     *  \return Задержка, нс, или -1, если задержки не измерялись
+     */
+    qint64 latency(qreal quantile) const;
+
+private slots:
+    /*!
+     *  \brief Слот устройства: данные, записанные CSMCom
+     */
+    void deviceRead();
+    /*!
+     *  \brief Слот пакета, принятого CSMCom
+     *  \param bytes Пакет
+     */
+    void packetIn(QByteArray bytes);
+    /*!
+     *  \brief Слот ответа на запрос
+     *  \param request Запрос
+     *  \param reply Ответ
+     */
+    void replyIn(QByteArray request, QByteArray reply);
+    /*!
+     *  \brief Слот пакета, принятого обработчиком (режим Direct)
+     *  \param arrived Время вызова обработчика по часам замера, нс
+     *  \param length Длина пакета
+     */
+    void directIn(qint64 arrived, qint32 length);
+    /*!
+     *  \brief Слот таймаута запроса
+     *  \param request Запрос
+     */
+    void requestLost(QByteArray request);
+    /*!
+     *  \brief Слот простоя: данные перестали поступать
+     */
+    void idleExpired();
+
+private:
+    /*!
+     *  \brief Сборка пакета AA <номер, 2 байта> <тело> 55 FF
+     *  \param sequence Номер пакета
+     */
+    QByteArray makePacket(quint16 sequence);
+    /*!
+     *  \brief Отправка очередного запроса
+     */
+    void sendRequest();
+    /*!
+     *  \brief Запись устройством очередного пакета (Frame, Direct)
+     */
+    void sendFrame();
+    /*!
+     *  \brief Учет доставленного пакета (Frame, Direct)
+     *  \param arrived Время доставки по часам замера, нс
+     *  \param length Длина пакета
+     */
+    void frameIn(qint64 arrived, qint32 length);
+    /*!
+     *  \brief Учет завершенного пакета или запроса
+     */
+    void complete();
+    /*!
+     *  \brief Вывод результата и выход из цикла событий
+     */
+    void finish();
+
+    /*!
+     *  \brief Режим замера
+     */
+    Mode mode;
+    /*!
+     *  \brief Число пакетов или запросов
+     */
+    qint32 count;
+    /*!
+     *  \brief Глубина конвейера
+     */
+    qint32 depth;
+    /*!
+     *  \brief Длина тела пакета
+     */
+    qint32 payload;
+    /*!
+     *  \brief Отправлено запросов
+     */
+    qint32 sent;
+    /*!
+     *  \brief Завершено пакетов или запросов
+     */
+    qint32 done;
+    /*!
+     *  \brief Потеряно запросов
+     */
+    qint32 lost;
+    /*!
+     *  \brief Принято байт в пакетах
+     */
+    qint64 bytes;
+    /*!
+     *  \brief Ведущий конец пары - "устройство"
+     */
+    CSMPtyTransport * device;
+    /*!
+     *  \brief Проверяемый экземпляр CSMCom
+     */
+    CSMCom * com;
+    /*!
+     *  \brief Часы замера
+     */
+    QElapsedTimer clock;
+    /*!
+     *  \brief Расход процесса в начале замера
+     */
+    CSMUsage usage;
+    /*!
+     *  \brief Время отправки запросов по номеру, нс
+     */
+    QHash<quint16, qint64> stamps;
+    /*!
+     *  \brief Время записи последнего пакета устройством, нс
+     */
+    qint64 stamp;
+    /*!
+     *  \brief Задержки ответов, нс
+     */
+    QVector<qint64> latencies;
+    /*!
+     *  \brief Таймер простоя
+     */
+    QTimer idle;
+};
+
+#endif // CSMLOOPBACK_HPP
@@ -0,0 +1,276 @@
+#include <QDateTime>
+#include <QMutexLocker>
+#include <string.h>
+#include "csmcapture.hpp"
+#include "csmframer.hpp"
+
+static const char CT_CAPTURE_MAGIC[] = "CSMCAP";
+
+static void appendVarint(QByteArray * out, quint64 value)
+{
+    while (value >= 0x80)
+    {
+        out->append((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out->append((char)value);
+}
+
+/* CSMCapture */
+
+CSMCapture::CSMCapture(QObject * parent) : QObject(parent)
+{
+    last = 0;
+}
+
+CSMCapture::~CSMCapture()
+{
+    close();
+}
+
+bool CSMCapture::open(QString path)
+{
+    QMutexLocker locker(&lock);
+    QByteArray   header(CT_CAPTURE_MAGIC, 6);
+    qint64       now = QDateTime::currentMSecsSinceEpoch();
+
+    if (file.isOpen())
+        file.close();
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    header.append((char)CT_CAPTURE_VERSION);
+    header.append('\0');
+    for (qint32 i = 0; i < 8; i++)
+        header.append((char)((now >> (i * 8)) & 0xFF));
+    file.write(header);
+
+    clock.start();
+    last = 0;
+
+    return true;
+}
+
+void CSMCapture::close()
+{
+    QMutexLocker locker(&lock);
+
+    if (file.isOpen())
+        file.close();
+}
+
+bool CSMCapture::isOpen()
+{
+    QMutexLocker locker(&lock);
+
+    return file.isOpen();
+}
+
+void CSMCapture::flush()
+{
+    QMutexLocker locker(&lock);
+
+    if (file.isOpen())
+        file.flush();
+}
+
+void CSMCapture::record(Kind kind, const char * data, qint32 length)
+{
+    QMutexLocker locker(&lock);
+
+    if (!file.isOpen())
+        return;
+
+    qint64 now = clock.nsecsElapsed() / 1000;
+
+    scratch.clear();
+    scratch.append((char)kind);
+    appendVarint(&scratch, (quint64)qMax(now - last, (qint64)0));
+    appendVarint(&scratch, (quint64)length);
+    file.write(scratch);
+    file.write(data, length);
+    last = now;
+}
+
+void CSMCapture::tx(QByteArray bytes)
+{
+    record(Tx, bytes.constData(), bytes.length());
+}
+
+void CSMCapture::rx(QByteArray bytes)
+{
+    record(Rx, bytes.constData(), bytes.length());
+}
+
+void CSMCapture::timeout(QByteArray request)
+{
+    record(Timeout, request.constData(), request.length());
+}
+
+void CSMCapture::warning(QString message)
+{
+    QByteArray text = message.toUtf8();
+
+    record(Warning, text.constData(), text.length());
+}
+
+/* CSMCaptureReader */
+
+CSMCaptureReader::CSMCaptureReader()
+{
+    data    = 0;
+    size    = 0;
+    offset  = 0;
+    time    = 0;
+    started = 0;
+}
+
+CSMCaptureReader::~CSMCaptureReader()
+{
+    close();
+}
+
+bool CSMCaptureReader::open(QString path)
+{
+    close();
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    size = file.size();
+    if (size < CT_CAPTURE_HEADER)
+    {
+        close();
+        return false;
+    }
+
+    data = file.map(0, size);
+    if ((data == 0) ||
+        (memcmp(data, CT_CAPTURE_MAGIC, 6) != 0) ||
+        (data[6] != CT_CAPTURE_VERSION))
+    {
+        close();
+        return false;
+    }
+
+    started = 0;
+    for (qint32 i = 0; i < 8; i++)
+        started |= (qint64)data[8 + i] << (i * 8);
+    rewind();
+
+    return true;
+}
+
+void CSMCaptureReader::close()
+{
+    if (data != 0)
+        file.unmap((uchar *)data);
+    if (file.isOpen())
+        file.close();
+
+    data   = 0;
+    size   = 0;
+    offset = 0;
+    time   = 0;
+}
+
+qint64 CSMCaptureReader::startTime() const
+{
+    return started;
+}
+
+void CSMCaptureReader::rewind()
+{
+    offset = CT_CAPTURE_HEADER;
+    time   = 0;
+}
+
+bool CSMCaptureReader::readVarint(quint64 * value)
+{
+    quint64 result = 0;
+
+    for (qint32 shift = 0; (offset < size) && (shift < 64); shift += 7)
+    {
+        quint8 byte = data[offset++];
+
+        result |= (quint64)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CSMCaptureReader::next(CSMCaptureRecord * record)
+{
+    quint64 delta;
+    quint64 length;
+
+    if ((data == 0) || (offset >= size))
+        return false;
+
+    qint64 start = offset;
+    quint8 kind  = data[offset++];
+
+    /* A record cut short by a crash ends the capture */
+    if ((!readVarint(&delta)) || (!readVarint(&length)) ||
+        (length > (quint64)(size - offset)))
+    {
+        offset = start;
+        return false;
+    }
+
+    time          += delta;
+    record->kind   = (CSMCapture::Kind)kind;
+    record->time   = time;
+    record->data   = (const char *)data + offset;
+    record->length = (qint32)length;
+    offset        += length;
+
+    return true;
+}
+
+qint64 CSMCaptureReader::replay(CSMFramer * framer, CSMFrameSink sink)
+{
+    CSMCaptureRecord record;
+    QByteArray       frame;
+    qint64           frames = 0;
+
+    while (next(&record))
+    {
+        if (record.kind == CSMCapture::Timeout)
+        {
+            framer->reset();
+            continue;
+        }
+        if (record.kind != CSMCapture::Rx)
+            continue;
+
+        /* Copy straight from the mapping into the framer buffer */
+        for (qint32 at = 0; at < record.length; )
+        {
+            qint32 space;
+            char * target = framer->reserve(&space);
+            qint32 length = qMin(space, record.length - at);
+
+            memcpy(target, record.data + at, length);
+            framer->commit(length);
+            at += length;
+
+            while (framer->next(&frame))
+            {
+                frames++;
+                if (sink)
+                    sink(frame);
+            }
+        }
+    }
+
+    return frames;
+}
@@ -0,0 +1,272 @@
+#ifndef CSMCAPTURE_HPP
+#define CSMCAPTURE_HPP
+
+/*! \file csmcapture.hpp
+ *  \brief Заголовочный файл двоичной записи сеансов проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуры классов CSMCapture - записи сеанса работы с
+ * портом в компактный двоичный файл - и CSMCaptureReader - чтения такого
+ * файла через отображение в память для воспроизведения.
+ *
+ *  Формат файла (все многобайтовые числа - little endian):
+ * - Заголовок, 16 байт: "CSMCAP", версия (1 байт), 0 (1 байт), время начала
+ *   записи в мс от 01.01.1970 UTC (8 байт).
+ * - Записи подряд до конца файла: тип (1 байт, CSMCapture::Kind), прошедшее
+ *   с предыдущей записи время в мкс (varint), длина данных (varint), данные.
+ *
+ *  varint - беззнаковое число по 7 бит в байте, младшие биты первыми, старший
+ * бит байта означает продолжение (как в LEB128). Время берется по монотонным
+ * часам и не зависит от перевода системного времени.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QObject>
+#include <QFile>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+class CSMFramer;
+
+/*!
+ *  \brief Получатель пакетов при воспроизведении записи
+ */
+typedef std::function<void (const QByteArray &)> CSMFrameSink;
+
+/*!
+ *  \brief Версия формата записи
+ */
+#define CT_CAPTURE_VERSION 1
+/*!
+ *  \brief Размер заголовка файла записи
+ */
+#define CT_CAPTURE_HEADER  16
+
+/*!
+ *  \brief Запись сеанса работы с портом
+ *
+ *  Фиксирует каждую порцию переданных и принятых данных, таймауты и
+ * предупреждения. Принятые данные записываются такими, какими они были
+ * прочитаны из порта, до выделения пакетов, поэтому сеанс можно в точности
+ * воспроизвести на другом выделителе или других правилах.
+ *
+ *  Запись потокобезопасна: обработчик порта пишет из потока ввода-вывода,
+ * предупреждения могут приходить из потока владельца. Подключается к порту
+ * функцией CSMCom::setCapture.
+ */
+class CSMCapture : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Тип записи
+     */
+    enum Kind
+    {
+        Tx      = 1, //!< Данные, записанные в порт
+        Rx      = 2, //!< Данные, прочитанные из порта
+        Timeout = 3, //!< Таймаут запроса, данные - запрос
+        Warning = 4  //!< Предупреждение, данные - текст в UTF-8
+    };
+
+    /*!
+     *  \brief Конструктор класса
+     *  \param parent Родитель
+     */
+    CSMCapture(QObject * parent = 0);
+    /*!
+     *  \brief Деструктор класса. Закрывает файл.
+     */
+    ~CSMCapture();
+
+    /*!
+     *  \brief Создание файла записи
+     *
+     *  Существующий файл перезаписывается.
+     *  \param path Путь к файлу
+     *  \return Статус успешности создания
+     */
+    bool open(QString path);
+    /*!
+     *  \brief Закрытие файла записи
+     */
+    void close();
+    /*!
+     *  \brief Флаг открытого файла
+     */
+    bool isOpen();
+    /*!
+     *  \brief Сброс буфера записи на диск
+     */
+    void flush();
+    /*!
+     *  \brief Добавление записи
+     *  \param kind Тип записи
+     *  \param data Данные
+     *  \param length Длина данных
+     */
+    void record(Kind kind, const char * data, qint32 length);
+
+public slots:
+    /*!
+     *  \brief Слот записи переданных данных
+     */
+    void tx(QByteArray bytes);
+    /*!
+     *  \brief Слот записи принятых данных
+     */
+    void rx(QByteArray bytes);
+    /*!
+     *  \brief Слот записи таймаута запроса
+     */
+    void timeout(QByteArray request);
+    /*!
+     *  \brief Слот записи предупреждения
+     */
+    void warning(QString message);
+
+private:
+    /*!
+     *  \brief Файл записи
+     */
+    QFile file;
+    /*!
+     *  \brief Защита файла от одновременной записи
+     */
+    QMutex lock;
+    /*!
+     *  \brief Монотонные часы записи
+     */
+    QElapsedTimer clock;
+    /*!
+     *  \brief Время предыдущей записи по часам clock, мкс
+     */
+    qint64 last;
+    /*!
+     *  \brief Буфер кодирования заголовка записи
+     */
+    QByteArray scratch;
+};
+
+/*!
+ *  \brief Запись, прочитанная из файла
+ *
+ *  Данные указывают в отображенный в память файл и действительны, пока
+ * открыт читатель.
+ */
+struct CSMCaptureRecord
+{
+    /*!
+     *  \brief Тип записи
+     */
+    CSMCapture::Kind kind;
+    /*!
+     *  \brief Время от начала записи, мкс
+     */
+    qint64 time;
+    /*!
+     *  \brief Данные
+     */
+    const char * data;
+    /*!
+     *  \brief Длина данных
+     */
+    qint32 length;
+};
+
+/*!
+ *  \brief Чтение файла записи
+ *
+ *  Файл отображается в память целиком, записи выдаются без копирования.
+ * Обрыв файла на середине записи (например, при аварийном завершении
+ * программы) считается концом файла.
+ */
+class CSMCaptureReader
+{
+public:
+    /*!
+     *  \brief Конструктор класса
+     */
+    CSMCaptureReader();
+    /*!
+     *  \brief Деструктор класса. Закрывает файл.
+     */
+    ~CSMCaptureReader();
+
+    /*!
+     *  \brief Открытие файла записи
+     *  \param path Путь к файлу
+     *  \return Статус успешности открытия и проверки заголовка
+     */
+    bool open(QString path);
+    /*!
+     *  \brief Закрытие файла
+     */
+    void close();
+    /*!
+     *  \brief Время начала записи, мс от 01.01.1970 UTC
+     */
+    qint64 startTime() const;
+    /*!
+     *  \brief Чтение очередной записи
+     *  \param record (out) Запись
+     *  \return true, если запись прочитана; false - конец файла
+     */
+    bool next(CSMCaptureRecord * record);
+    /*!
+     *  \brief Возврат к первой записи
+     */
+    void rewind();
+    /*!
+     *  \brief Воспроизведение принятых данных через выделитель пакетов
+     *
+     *  Все записи Rx от текущей позиции до конца файла подаются в framer,
+     * выделенные пакеты передаются функции sink как ссылки на буфер
+     * выделителя. По записи Timeout выделитель сбрасывается, как это делает
+     * обработчик порта при глубине конвейера 1.
+     *  \param framer Выделитель с установленным автоматом
+     *  \param sink Получатель пакетов, может быть пустым
+     *  \return Число выделенных пакетов
+     */
+    qint64 replay(CSMFramer * framer, CSMFrameSink sink = CSMFrameSink());
+
+private:
+    /*!
+     *  \brief Чтение varint
+     *  \param value (out) Значение
+     *  \return Статус успешности чтения
+     */
+    bool readVarint(quint64 * value);
+
+    /*!
+     *  \brief Файл записи
+     */
+    QFile file;
+    /*!
+     *  \brief Отображение файла в память
+     */
+    const uchar * data;
+    /*!
+     *  \brief Размер файла
+     */
+    qint64 size;
+    /*!
+     *  \brief Позиция чтения
+     */
+    qint64 offset;
+    /*!
+     *  \brief Время последней прочитанной записи, мкс
+     */
+    qint64 time;
+    /*!
+     *  \brief Время начала записи, мс от 01.01.1970 UTC
+     */
+    qint64 started;
+};
+
+#endif // CSMCAPTURE_HPP
@@ -0,0 +1,382 @@
+#include <string.h>
+#include "csmchecksum.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CT_CHECKSUM_SSE42
+#include <nmmintrin.h>
+#endif
+
+static quint32 reflectBits(quint32 value, qint32 bits)
+{
+    quint32 result = 0;
+
+    for (qint32 i = 0; i < bits; i++)
+    {
+        result = (result << 1) | (value & 1);
+        value >>= 1;
+    }
+
+    return result;
+}
+
+static inline quint32 loadLE(const uchar * data)
+{
+    return  (quint32)data[0]        | ((quint32)data[1] << 8) |
+           ((quint32)data[2] << 16) | ((quint32)data[3] << 24);
+}
+
+static inline quint32 loadBE(const uchar * data)
+{
+    return ((quint32)data[0] << 24) | ((quint32)data[1] << 16) |
+           ((quint32)data[2] << 8)  |  (quint32)data[3];
+}
+
+#ifdef CT_CHECKSUM_SSE42
+/* Built for SSE4.2 regardless of the compiler flags, called only after the
+ * CPU has been checked */
+__attribute__((target("sse4.2")))
+static quint32 crc32cHardware(quint32 crc, const uchar * data, qint32 length)
+{
+#if defined(__x86_64__)
+    quint64 wide = crc;
+
+    while (length >= 8)
+    {
+        quint64 word;
+
+        memcpy(&word, data, 8);
+        wide    = _mm_crc32_u64(wide, word);
+        data   += 8;
+        length -= 8;
+    }
+    crc = (quint32)wide;
+#endif
+    while (length >= 4)
+    {
+        quint32 word;
+
+        memcpy(&word, data, 4);
+        crc     = _mm_crc32_u32(crc, word);
+        data   += 4;
+        length -= 4;
+    }
+    while (length > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+
+    return crc;
+}
+
+static bool hasSse42()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+CSMChecksum::CSMChecksum()
+{
+    kind       = None;
+    bits       = 8;
+    polynomial = 0;
+    initial    = 0;
+    reflect    = false;
+    finalxor   = 0;
+    skip       = 0;
+    trailer    = 0;
+    bigendian  = false;
+    action     = Drop;
+    hardware   = false;
+}
+
+CSMChecksum::CSMChecksum(Algorithm algorithm, qint32 width, quint32 poly,
+                         quint32 init, bool reflected, quint32 xorout)
+{
+    kind       = algorithm;
+    bits       = width;
+    polynomial = poly;
+    initial    = init;
+    reflect    = reflected;
+    finalxor   = xorout;
+    skip       = 0;
+    trailer    = 0;
+    bigendian  = false;
+    action     = Drop;
+    hardware   = false;
+
+    if ((kind == Crc) && (isValid()))
+    {
+        buildTables();
+#ifdef CT_CHECKSUM_SSE42
+        hardware = (bits == 32) && (reflect) && (poly == 0x1EDC6F41) &&
+                   (hasSse42());
+#endif
+    }
+}
+
+CSMChecksum CSMChecksum::crc8()
+{
+    return CSMChecksum(Crc, 8, 0x07);
+}
+
+CSMChecksum CSMChecksum::crc16Modbus()
+{
+    return CSMChecksum(Crc, 16, 0x8005, 0xFFFF, true);
+}
+
+CSMChecksum CSMChecksum::crc16Ccitt()
+{
+    return CSMChecksum(Crc, 16, 0x1021, 0xFFFF);
+}
+
+CSMChecksum CSMChecksum::crc32()
+{
+    return CSMChecksum(Crc, 32, 0x04C11DB7, 0xFFFFFFFF, true, 0xFFFFFFFF);
+}
+
+CSMChecksum CSMChecksum::crc32c()
+{
+    return CSMChecksum(Crc, 32, 0x1EDC6F41, 0xFFFFFFFF, true, 0xFFFFFFFF);
+}
+
+CSMChecksum CSMChecksum::xor8()
+{
+    return CSMChecksum(Xor, 8);
+}
+
+CSMChecksum CSMChecksum::sum8()
+{
+    return CSMChecksum(Sum, 8);
+}
+
+bool CSMChecksum::isEnabled() const
+{
+    return kind != None;
+}
+
+bool CSMChecksum::isValid() const
+{
+    if ((skip < 0) || (trailer < 0))
+        return false;
+
+    switch (kind)
+    {
+    case None:
+        return true;
+    case Xor:
+        return bits == 8;
+    case Sum:
+        return (bits == 8) || (bits == 16) || (bits == 32);
+    case Crc:
+        return (bits >= 8) && (bits <= 32);
+    }
+
+    return false;
+}
+
+bool CSMChecksum::isAccelerated() const
+{
+    return hardware;
+}
+
+CSMChecksum::Algorithm CSMChecksum::algorithm() const
+{
+    return kind;
+}
+
+qint32 CSMChecksum::width() const
+{
+    return bits;
+}
+
+void CSMChecksum::setCoverage(qint32 skip, qint32 trailer)
+{
+    this->skip    = skip;
+    this->trailer = trailer;
+}
+
+void CSMChecksum::setBigEndian(bool bigendian)
+{
+    this->bigendian = bigendian;
+}
+
+void CSMChecksum::setPolicy(Policy policy)
+{
+    action = policy;
+}
+
+CSMChecksum::Policy CSMChecksum::policy() const
+{
+    return action;
+}
+
+void CSMChecksum::buildTables()
+{
+    tables.resize(CT_CHECKSUM_SLICES * 256);
+
+    quint32 * table = tables.data();
+
+    /* table[k][b] - remainder of byte b followed by k zero bytes */
+    if (reflect)
+    {
+        quint32 reversed = reflectBits(polynomial, bits);
+
+        for (quint32 b = 0; b < 256; b++)
+        {
+            quint32 crc = b;
+
+            for (qint32 i = 0; i < 8; i++)
+                crc = (crc & 1) ? ((crc >> 1) ^ reversed) : (crc >> 1);
+            table[b] = crc;
+        }
+        for (qint32 k = 1; k < CT_CHECKSUM_SLICES; k++)
+        {
+            for (quint32 b = 0; b < 256; b++)
+            {
+                quint32 previous = table[(k - 1) * 256 + b];
+
+                table[k * 256 + b] = (previous >> 8) ^ table[previous & 0xFF];
+            }
+        }
+    }
+    else
+    {
+        /* The register is kept left-aligned, so every width shares the code */
+        quint32 aligned = polynomial << (32 - bits);
+
+        for (quint32 b = 0; b < 256; b++)
+        {
+            quint32 crc = b << 24;
+
+            for (qint32 i = 0; i < 8; i++)
+                crc = (crc & 0x80000000) ? ((crc << 1) ^ aligned) : (crc << 1);
+            table[b] = crc;
+        }
+        for (qint32 k = 1; k < CT_CHECKSUM_SLICES; k++)
+        {
+            for (quint32 b = 0; b < 256; b++)
+            {
+                quint32 previous = table[(k - 1) * 256 + b];
+
+                table[k * 256 + b] = (previous << 8) ^ table[previous >> 24];
+            }
+        }
+    }
+}
+
+quint32 CSMChecksum::crcTable(quint32 crc, const uchar * data,
+                              qint32 length) const
+{
+    const quint32 * t = tables.constData();
+
+    if (reflect)
+    {
+        while (length >= 8)
+        {
+            quint32 low  = loadLE(data) ^ crc;
+            quint32 high = loadLE(data + 4);
+
+            crc = t[7 * 256 + (low & 0xFF)]         ^
+                  t[6 * 256 + ((low >> 8) & 0xFF)]  ^
+                  t[5 * 256 + ((low >> 16) & 0xFF)] ^
+                  t[4 * 256 + (low >> 24)]          ^
+                  t[3 * 256 + (high & 0xFF)]        ^
+                  t[2 * 256 + ((high >> 8) & 0xFF)] ^
+                  t[1 * 256 + ((high >> 16) & 0xFF)] ^
+                  t[high >> 24];
+            data   += 8;
+            length -= 8;
+        }
+        while (length > 0)
+        {
+            crc = t[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+            length--;
+        }
+    }
+    else
+    {
+        while (length >= 8)
+        {
+            quint32 high = loadBE(data) ^ crc;
+            quint32 low  = loadBE(data + 4);
+
+            crc = t[7 * 256 + (high >> 24)]         ^
+                  t[6 * 256 + ((high >> 16) & 0xFF)] ^
+                  t[5 * 256 + ((high >> 8) & 0xFF)] ^
+                  t[4 * 256 + (high & 0xFF)]        ^
+                  t[3 * 256 + (low >> 24)]          ^
+                  t[2 * 256 + ((low >> 16) & 0xFF)] ^
+                  t[1 * 256 + ((low >> 8) & 0xFF)]  ^
+                  t[low & 0xFF];
+            data   += 8;
+            length -= 8;
+        }
+        while (length > 0)
+        {
+            crc = (crc << 8) ^ t[(crc >> 24) ^ *data++];
+            length--;
+        }
+    }
+
+    return crc;
+}
+
+quint32 CSMChecksum::compute(const char * data, qint32 length) const
+{
+    const uchar * bytes  = (const uchar *)data;
+    quint32       mask   = (bits >= 32) ? 0xFFFFFFFF : ((1u << bits) - 1);
+    quint32       result = initial;
+
+    switch (kind)
+    {
+    case None:
+        return 0;
+    case Xor:
+        for (qint32 i = 0; i < length; i++)
+            result ^= bytes[i];
+        break;
+    case Sum:
+        for (qint32 i = 0; i < length; i++)
+            result += bytes[i];
+        break;
+    case Crc:
+        if (reflect)
+        {
+            result = reflectBits(initial & mask, bits);
+#ifdef CT_CHECKSUM_SSE42
+            if (hardware)
+                result = crc32cHardware(result, bytes, length);
+            else
+#endif
+                result = crcTable(result, bytes, length);
+        }
+        else
+        {
+            result = crcTable((initial & mask) << (32 - bits), bytes, length);
+            result = result >> (32 - bits);
+        }
+        break;
+    }
+
+    return (result ^ finalxor) & mask;
+}
+
+bool CSMChecksum::verify(const QByteArray & frame) const
+{
+    qint32 size = (bits + 7) / 8;
+    qint32 at   = frame.length() - trailer - size;
+
+    if (at < skip)
+        return false;
+
+    const uchar * stored = (const uchar *)frame.constData() + at;
+    quint32       value  = 0;
+
+    for (qint32 i = 0; i < size; i++)
+        value = (value << 8) | stored[bigendian ? i : (size - 1 - i)];
+
+    return compute(frame.constData() + skip, at - skip) == value;
+}
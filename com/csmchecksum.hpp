@@ -0,0 +1,204 @@
+#ifndef CSMCHECKSUM_HPP
+#define CSMCHECKSUM_HPP
+
+/*! \file csmchecksum.hpp
+ *  \brief Заголовочный файл проверки контрольных сумм проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMChecksum - описания контрольной
+ * суммы пакета и ее вычислителя.
+ *
+ *  CRC любой ширины от 8 до 32 бит задается параметрами модели Rocksoft
+ * (полином, начальное значение, отражение, выходная маска) и считается по
+ * таблицам "slice-by-8": восемь байт за шаг. Для CRC-32C на процессорах x86 с
+ * SSE4.2 используется аппаратная инструкция crc32. Кроме CRC доступны
+ * исключающее ИЛИ и сумма байт.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QByteArray>
+#include <QVector>
+
+/*!
+ *  \brief Число таблиц CRC (байт, обрабатываемых за шаг)
+ */
+#define CT_CHECKSUM_SLICES 8
+
+/*!
+ *  \brief Контрольная сумма пакета
+ *
+ *  Сумма хранится в пакете непосредственно перед trailer завершающими
+ * байтами (например, перед сигнатурой конца) и занимает (width + 7) / 8 байт.
+ * Считается по байтам пакета от skip до самой суммы.
+ *
+ *  Объект после настройки не изменяется и может читаться из любого потока.
+ * Таблицы CRC общие для всех копий объекта.
+ */
+class CSMChecksum
+{
+public:
+    /*!
+     *  \brief Алгоритм
+     */
+    enum Algorithm
+    {
+        None, //!< Проверка отключена
+        Xor,  //!< Исключающее ИЛИ байт, 8 бит
+        Sum,  //!< Сумма байт по модулю 2^width, width 8 или 16
+        Crc   //!< CRC
+    };
+
+    /*!
+     *  \brief Действие над пакетом с неверной суммой
+     */
+    enum Policy
+    {
+        Drop, //!< Пакет отбрасывается
+        Flag  //!< Пакет выдается сигналом CSMCom::bytesInvalid
+    };
+
+    /*!
+     *  \brief Конструктор отключенной проверки
+     */
+    CSMChecksum();
+    /*!
+     *  \brief Основной инициализирующий конструктор
+     *  \param algorithm Алгоритм
+     *  \param width Ширина суммы в битах
+     *  \param poly Полином CRC в прямой записи, без старшего бита
+     *  \param init Начальное значение
+     *  \param reflected Флаг отражения входных байт и результата CRC
+     *  \param xorout Маска, накладываемая на результат
+     */
+    CSMChecksum(Algorithm algorithm, qint32 width, quint32 poly = 0,
+                quint32 init = 0, bool reflected = false, quint32 xorout = 0);
+
+    /*!
+     *  \brief CRC-8, полином 0x07
+     */
+    static CSMChecksum crc8();
+    /*!
+     *  \brief CRC-16/MODBUS
+     */
+    static CSMChecksum crc16Modbus();
+    /*!
+     *  \brief CRC-16/CCITT-FALSE
+     */
+    static CSMChecksum crc16Ccitt();
+    /*!
+     *  \brief CRC-32 (Ethernet, zip)
+     */
+    static CSMChecksum crc32();
+    /*!
+     *  \brief CRC-32C (Castagnoli)
+     */
+    static CSMChecksum crc32c();
+    /*!
+     *  \brief Исключающее ИЛИ байт
+     */
+    static CSMChecksum xor8();
+    /*!
+     *  \brief Сумма байт по модулю 256
+     */
+    static CSMChecksum sum8();
+
+    /*!
+     *  \brief Признак включенной проверки
+     */
+    bool isEnabled() const;
+    /*!
+     *  \brief Признак допустимых параметров
+     */
+    bool isValid() const;
+    /*!
+     *  \brief Признак использования аппаратного вычисления
+     */
+    bool isAccelerated() const;
+    /*!
+     *  \brief Алгоритм
+     */
+    Algorithm algorithm() const;
+    /*!
+     *  \brief Ширина суммы в битах
+     */
+    qint32 width() const;
+
+    /*!
+     *  \brief Установка покрываемой суммой части пакета
+     *  \param skip Число начальных байт пакета, не входящих в сумму
+     *  \param trailer Число байт пакета после суммы
+     */
+    void setCoverage(qint32 skip, qint32 trailer);
+    /*!
+     *  \brief Установка порядка байт суммы в пакете
+     *  \param bigendian TRUE - старший байт первый
+     */
+    void setBigEndian(bool bigendian);
+    /*!
+     *  \brief Установка действия над пакетом с неверной суммой
+     */
+    void setPolicy(Policy policy);
+    /*!
+     *  \brief Действие над пакетом с неверной суммой
+     */
+    Policy policy() const;
+
+    /*!
+     *  \brief Вычисление суммы
+     *  \param data Данные
+     *  \param length Длина данных
+     *  \return Сумма
+     */
+    quint32 compute(const char * data, qint32 length) const;
+    /*!
+     *  \brief Проверка суммы пакета
+     *  \param frame Пакет
+     *  \return false, если сумма неверна или пакет короче skip + сумма +
+     * trailer
+     */
+    bool verify(const QByteArray & frame) const;
+
+private:
+    /*!
+     *  \brief Построение таблиц CRC
+     */
+    void buildTables();
+    /*!
+     *  \brief CRC по таблицам
+     */
+    quint32 crcTable(quint32 crc, const uchar * data, qint32 length) const;
+
+    /*!
+     *  \brief Параметры алгоритма, см. основной конструктор
+     */
+    Algorithm kind;
+    qint32    bits;
+    quint32   polynomial;
+    quint32   initial;
+    bool      reflect;
+    quint32   finalxor;
+    /*!
+     *  \brief Покрытие суммой, см. setCoverage
+     */
+    qint32    skip;
+    qint32    trailer;
+    /*!
+     *  \brief Порядок байт суммы в пакете
+     */
+    bool      bigendian;
+    /*!
+     *  \brief Действие над пакетом с неверной суммой
+     */
+    Policy    action;
+    /*!
+     *  \brief Флаг аппаратного CRC-32C
+     */
+    bool      hardware;
+    /*!
+     *  \brief Таблицы CRC, CT_CHECKSUM_SLICES x 256
+     */
+    QVector<quint32> tables;
+};
+
+#endif // CSMCHECKSUM_HPP
@@ -0,0 +1,733 @@
+#include <QMap>
+#include <string.h>
+#include <algorithm>
+#include "csmframer.hpp"
+
+/*!
+ *  \brief Правило, подготовленное к построению автомата
+ */
+struct CSMCompiledRule
+{
+    /*!
+     *  \brief Байты правила
+     */
+    PreceptArray precept;
+    /*!
+     *  \brief Флаг правила начала пакета
+     */
+    bool   isbegin;
+    /*!
+     *  \brief Индекс правила в своем наборе
+     */
+    qint32 index;
+    /*!
+     *  \brief Индекс первого байта exactly=true (0, если таких нет)
+     */
+    qint32 head;
+    /*!
+     *  \brief Индекс после последнего байта exactly=true (длина, если таких
+     * нет)
+     */
+    qint32 tail;
+    /*!
+     *  \brief Число совпавших байт, начиная с которого остаток правила
+     * состоит только из байт exactly=false
+     */
+    qint32 pendfrom;
+    /*!
+     *  \brief Номер позиции (правило, 0) в общей нумерации позиций НКА
+     */
+    qint32 offset;
+};
+
+static inline bool preceptMatches(const PreceptByte & precept, quint8 byte)
+{
+    return precept.exactly ? (precept.byte == byte) : (precept.byte != byte);
+}
+
+static void appendRules(QVector<CSMCompiledRule> * rules,
+                        const PreceptSet & set, bool isbegin)
+{
+    for (qint32 i = 0; i < set.length(); i++)
+    {
+        const PreceptArray & precept = set.at(i);
+
+        if (precept.isEmpty())
+            continue;
+
+        CSMCompiledRule rule;
+        rule.precept  = precept;
+        rule.isbegin  = isbegin;
+        rule.index    = i;
+        rule.head     = -1;
+        rule.tail     = precept.length();
+        rule.pendfrom = 0;
+        for (qint32 k = 0; k < precept.length(); k++)
+        {
+            if (precept.at(k).exactly)
+            {
+                if (rule.head < 0) rule.head = k;
+                rule.pendfrom = k + 1;
+            }
+        }
+        if (rule.head < 0)
+        {
+            rule.head = 0;
+        }
+        else
+        {
+            rule.tail = rule.pendfrom;
+        }
+        rules->append(rule);
+    }
+}
+
+/* CSMMatcher */
+
+CSMMatcher::CSMMatcher()
+{
+    valid    = true;
+    begins   = false;
+    beginlen = 0;
+    classes  = 1;
+    memset(classmap, 0, sizeof(classmap));
+    table.append(0);
+    hitflags.append(false);
+    skipflags.append(false);
+    beginhits.append(CSMMatchHit());
+    endhits.append(CSMMatchHit());
+    endpendings.append(CSMMatchHit());
+}
+
+CSMMatcher::CSMMatcher(const PreceptSet & beginset, const PreceptSet & endset,
+                       const CSMLengthField & length)
+{
+    QVector<CSMCompiledRule> rules;
+    QVector<qint32>          posrule;
+    QVector<qint32>          posdepth;
+
+    valid    = true;
+    begins   = !beginset.isEmpty();
+    beginlen = 0;
+    lengthfield = length;
+
+    appendRules(&rules, beginset, true);
+    /* The length field tells where the frame ends, no end rules to watch */
+    if (!lengthfield.isEnabled())
+        appendRules(&rules, endset, false);
+
+    /* Number NFA positions (rule, depth) */
+    for (qint32 r = 0; r < rules.length(); r++)
+    {
+        rules[r].offset = posrule.length();
+        for (qint32 k = 0; k <= rules.at(r).precept.length(); k++)
+        {
+            posrule.append(r);
+            posdepth.append(k);
+        }
+        if (rules.at(r).isbegin)
+            beginlen = qMax(beginlen, rules.at(r).precept.length());
+    }
+
+    /* Split bytes into classes: every mentioned byte is a class of its own,
+     * all the others share class 0 */
+    QVector<quint8> representative;
+    bool            mentioned[256];
+
+    memset(mentioned, 0, sizeof(mentioned));
+    memset(classmap,  0, sizeof(classmap));
+    for (qint32 r = 0; r < rules.length(); r++)
+        for (qint32 k = 0; k < rules.at(r).precept.length(); k++)
+            mentioned[rules.at(r).precept.at(k).byte] = true;
+
+    representative.append(0);
+    for (qint32 b = 0; b < 256; b++)
+    {
+        if (mentioned[b])
+        {
+            classmap[b] = representative.length();
+            representative.append(b);
+            specials.insert(b);
+        }
+    }
+    for (qint32 b = 0; b < 256; b++)
+    {
+        if (!mentioned[b])
+        {
+            representative[0] = b;
+            break;
+        }
+    }
+    classes = representative.length();
+
+    /* Stream start: leading exactly=false bytes may lie before the stream */
+    QVector<qint32> initial;
+    for (qint32 r = 0; r < rules.length(); r++)
+    {
+        const CSMCompiledRule & rule = rules.at(r);
+        for (qint32 k = 0; k <= rule.precept.length(); k++)
+        {
+            initial.append(rule.offset + k);
+            if ((k == rule.precept.length()) || (rule.precept.at(k).exactly))
+                break;
+        }
+    }
+
+    /* Subset construction */
+    QMap<QVector<qint32>, qint32> ids;
+    QVector<QVector<qint32> >     sets;
+
+    ids.insert(initial, 0);
+    sets.append(initial);
+    for (qint32 s = 0; s < sets.length(); s++)
+    {
+        for (qint32 c = 0; c < classes; c++)
+        {
+            const QVector<qint32> & current = sets.at(s);
+            QVector<qint32>         target;
+            quint8                  byte = representative.at(c);
+
+            for (qint32 r = 0; r < rules.length(); r++)
+                target.append(rules.at(r).offset);
+            for (qint32 i = 0; i < current.length(); i++)
+            {
+                const CSMCompiledRule & rule = rules.at(posrule.at(current.at(i)));
+                qint32 depth = posdepth.at(current.at(i));
+
+                if ((depth < rule.precept.length()) &&
+                    (preceptMatches(rule.precept.at(depth), byte)))
+                {
+                    target.append(current.at(i) + 1);
+                }
+            }
+            std::sort(target.begin(), target.end());
+            target.erase(std::unique(target.begin(), target.end()), target.end());
+
+            qint32 id = ids.value(target, -1);
+            if (id < 0)
+            {
+                if (sets.length() >= CT_MATCHER_MAXSTATES)
+                {
+                    valid = false;
+                    break;
+                }
+                id = sets.length();
+                ids.insert(target, id);
+                sets.append(target);
+            }
+            table.append(id);
+        }
+
+        if (!valid)
+            break;
+    }
+
+    if (!valid)
+    {
+        *this = CSMMatcher();
+        valid = false;
+        return;
+    }
+
+    /* Describe matches available in every state */
+    for (qint32 s = 0; s < sets.length(); s++)
+    {
+        const QVector<qint32> & current = sets.at(s);
+        CSMMatchHit beginhit;
+        CSMMatchHit endhit;
+        CSMMatchHit endpending;
+
+        for (qint32 i = 0; i < current.length(); i++)
+        {
+            const CSMCompiledRule & rule = rules.at(posrule.at(current.at(i)));
+            qint32 depth = posdepth.at(current.at(i));
+
+            if (depth < rule.pendfrom)
+                continue;
+
+            CSMMatchHit hit;
+            hit.rule      = rule.index;
+            hit.startback = depth - rule.head;
+            hit.endback   = qMax(0, depth - rule.tail);
+
+            if (rule.isbegin)
+            {
+                if ((depth == rule.precept.length()) &&
+                    ((beginhit.rule < 0) || (hit.startback > beginhit.startback)))
+                {
+                    beginhit = hit;
+                }
+            }
+            else
+            {
+                if ((depth == rule.precept.length()) &&
+                    ((endhit.rule < 0) ||
+                     (hit.endback > endhit.endback) ||
+                     ((hit.endback == endhit.endback) &&
+                      (hit.startback < endhit.startback))))
+                {
+                    endhit = hit;
+                }
+                if ((endpending.rule < 0) ||
+                    (hit.endback > endpending.endback) ||
+                    ((hit.endback == endpending.endback) &&
+                     (hit.startback < endpending.startback)))
+                {
+                    endpending = hit;
+                }
+            }
+        }
+
+        beginhits.append(beginhit);
+        endhits.append(endhit);
+        endpendings.append(endpending);
+        hitflags.append((beginhit.rule >= 0) || (endhit.rule >= 0));
+
+        /* Bytes outside the rules lead back to the same state */
+        skipflags.append((classes <= 256) &&
+                         (table.at(s * classes) == s) &&
+                         (!hitflags.last()));
+    }
+}
+
+bool CSMMatcher::isValid() const
+{
+    return valid;
+}
+
+bool CSMMatcher::hasBegin() const
+{
+    return begins;
+}
+
+qint32 CSMMatcher::stateCount() const
+{
+    return hitflags.length();
+}
+
+qint32 CSMMatcher::beginLength() const
+{
+    return beginlen;
+}
+
+const CSMLengthField & CSMMatcher::lengthField() const
+{
+    return lengthfield;
+}
+
+qint32 CSMMatcher::initialState() const
+{
+    return 0;
+}
+
+const CSMByteSet & CSMMatcher::specialBytes() const
+{
+    return specials;
+}
+
+const CSMMatchHit & CSMMatcher::beginHit(qint32 state) const
+{
+    return beginhits.at(state);
+}
+
+const CSMMatchHit & CSMMatcher::endHit(qint32 state) const
+{
+    return endhits.at(state);
+}
+
+const CSMMatchHit & CSMMatcher::endPending(qint32 state) const
+{
+    return endpendings.at(state);
+}
+
+/* CSMFramer */
+
+CSMFramer::CSMFramer(qint32 capacity)
+{
+    matcher = 0;
+    storage.resize(qMax(capacity, 1));
+    reset();
+}
+
+void CSMFramer::setMatcher(const CSMMatcher * newmatcher)
+{
+    if (matcher != newmatcher)
+    {
+        matcher = newmatcher;
+        reset();
+    }
+}
+
+void CSMFramer::reset()
+{
+    head       = 0;
+    tail       = 0;
+    base       = 0;
+    position   = 0;
+    boundary   = 0;
+    framestart = 0;
+    frameexact = 0;
+    frameend   = -1;
+    framebegin = -1;
+    laststart  = -1;
+    lastbegin  = -1;
+    lastend    = -1;
+    state      = (matcher != 0) ? matcher->initialState() : 0;
+    inframe    = false;
+    recheck    = false;
+
+    if ((matcher != 0) && (!matcher->hasBegin()))
+        enterFrame(0, 0, -1);
+}
+
+qint32 CSMFramer::buffered() const
+{
+    return tail - head;
+}
+
+qint32 CSMFramer::beginRule() const
+{
+    return lastbegin;
+}
+
+qint32 CSMFramer::endRule() const
+{
+    return lastend;
+}
+
+qint32 CSMFramer::capacity() const
+{
+    return storage.length();
+}
+
+void CSMFramer::setCapacity(qint32 capacity)
+{
+    storage.resize(qMax(capacity, 1));
+    storage.squeeze();
+    reset();
+}
+
+void CSMFramer::feed(const QByteArray & bytes)
+{
+    compact();
+    if (storage.length() - tail < bytes.length())
+    {
+        pack();
+        if (storage.length() - tail < bytes.length())
+            storage.resize(tail + bytes.length());
+    }
+
+    memcpy(storage.data() + tail, bytes.constData(), bytes.length());
+    tail += bytes.length();
+}
+
+char * CSMFramer::reserve(qint32 * space, bool * dropped)
+{
+    compact();
+    if (dropped != 0)
+        *dropped = false;
+
+    /* Move the live bytes only when the tail runs short: each byte is moved
+     * at most once per quarter of the capacity read */
+    if ((head > 0) && (storage.length() - tail < storage.length() / 4 + 1))
+        pack();
+
+    if (tail == storage.length())
+    {
+        dropPartial();
+        pack();
+        if (dropped != 0)
+            *dropped = true;
+    }
+
+    *space = storage.length() - tail;
+
+    return storage.data() + tail;
+}
+
+void CSMFramer::commit(qint32 length)
+{
+    tail += qBound(0, length, storage.length() - tail);
+}
+
+bool CSMFramer::next(QByteArray * frame)
+{
+    if (matcher == 0)
+        return false;
+
+    /* The rules were replaced under our feet, start over */
+    if (state >= matcher->stateCount())
+        reset();
+
+    /* A frame was cut at the current byte, it may also begin the next one */
+    if (recheck)
+    {
+        recheck = false;
+        if (evaluate(frame))
+            return true;
+    }
+
+    const char * data = storage.constData() + head;
+    qint64       end  = base + (tail - head);
+
+    for (;;)
+    {
+        /* The body of a length-prefixed frame is not matched at all */
+        if ((inframe) && (matcher->lengthField().isEnabled()))
+        {
+            if (measure(frame))
+                return true;
+            if (inframe)
+                break;
+        }
+
+        if (position >= end)
+            break;
+
+        /* Nothing changes until one of the rule bytes shows up */
+        if (matcher->isSkippable(state))
+        {
+            qint32 found = CSMScan::findAny(data + (position - base),
+                                            end - position,
+                                            matcher->specialBytes());
+            if (found < 0)
+            {
+                position = end;
+                break;
+            }
+            position += found;
+        }
+
+        state = matcher->step(state, data[position - base]);
+        position++;
+
+        if ((matcher->isHit(state)) && (evaluate(frame)))
+            return true;
+    }
+
+    compact();
+
+    return false;
+}
+
+bool CSMFramer::hasPending() const
+{
+    if ((matcher == 0) || (!inframe) || (state >= matcher->stateCount()))
+        return false;
+
+    const CSMMatchHit & hit = matcher->endPending(state);
+
+    return ((hit.rule >= 0) && (position - hit.startback >= frameexact));
+}
+
+bool CSMFramer::flush(QByteArray * frame)
+{
+    if (!hasPending())
+        return false;
+
+    /* No more data: trailing exactly=false bytes are satisfied */
+    const CSMMatchHit & hit = matcher->endPending(state);
+
+    takeFrame(position - hit.endback, hit.rule, frame);
+
+    return true;
+}
+
+void CSMFramer::reject()
+{
+    if ((matcher == 0) || (laststart < 0))
+        return;
+
+    /* Frames that simply follow one another have nowhere else to start */
+    if ((!matcher->hasBegin()) && (!matcher->lengthField().isEnabled()))
+        return;
+
+    qint64 restart = laststart + 1;
+
+    inframe   = false;
+    recheck   = false;
+    boundary  = restart;
+    laststart = -1;
+    seek(restart);
+    if (!matcher->hasBegin())
+        enterFrame(restart, restart, -1);
+}
+
+bool CSMFramer::evaluate(QByteArray * frame)
+{
+    if (!inframe)
+    {
+        const CSMMatchHit & hit = matcher->beginHit(state);
+
+        if (hit.rule >= 0)
+        {
+            qint64 start = position - hit.startback;
+
+            /* Leading exactly=false bytes may lie before the stream */
+            if ((start < boundary) && (boundary == 0))
+                start = 0;
+            if (start >= boundary)
+                enterFrame(start, qMax(start, position - hit.endback),
+                           hit.rule);
+        }
+    }
+
+    if (inframe)
+    {
+        const CSMMatchHit & hit = matcher->endHit(state);
+
+        if ((hit.rule >= 0) && (position - hit.startback >= frameexact))
+        {
+            takeFrame(position - hit.endback, hit.rule, frame);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void CSMFramer::enterFrame(qint64 start, qint64 exactend, qint32 rule)
+{
+    inframe    = true;
+    framestart = start;
+    frameexact = exactend;
+    frameend   = -1;
+    framebegin = rule;
+}
+
+bool CSMFramer::measure(QByteArray * frame)
+{
+    const CSMLengthField & field = matcher->lengthField();
+    qint64                 end   = base + (tail - head);
+
+    if (frameend < 0)
+    {
+        qint64 at = framestart + field.offset;
+
+        if (at + field.width > end)
+            return false;
+
+        const uchar * bytes = (const uchar *)storage.constData() + head +
+                              (at - base);
+        quint32       value = 0;
+
+        for (qint32 i = 0; i < field.width; i++)
+        {
+            value = (value << 8) |
+                    bytes[field.bigendian ? i : (field.width - 1 - i)];
+        }
+
+        qint64 length = (qint64)value + field.bias;
+
+        /* Garbage in the header: look for the next begin one byte later */
+        if ((length < field.offset + field.width) ||
+            (framestart + length < frameexact) ||
+            (length > capacity()))
+        {
+            qint64 restart = framestart + 1;
+
+            inframe  = false;
+            boundary = restart;
+            seek(restart);
+            if (!matcher->hasBegin())
+                enterFrame(restart, restart, -1);
+            return false;
+        }
+
+        frameend = framestart + length;
+    }
+
+    if (frameend > end)
+        return false;
+
+    seek(qMax(position, frameend));
+    takeFrame(frameend, -1, frame);
+
+    return true;
+}
+
+void CSMFramer::seek(qint64 at)
+{
+    qint64 from = qMax(base, at - matcher->beginLength());
+
+    state = matcher->initialState();
+    for (qint64 i = from; i < at; i++)
+        state = matcher->step(state, storage.at(head + (i - base)));
+    position = at;
+}
+
+void CSMFramer::takeFrame(qint64 end, qint32 rule, QByteArray * frame)
+{
+    *frame    = QByteArray::fromRawData(storage.constData() + head +
+                                        (framestart - base),
+                                        end - framestart);
+    boundary  = end;
+    inframe   = false;
+    recheck   = true;
+    laststart = framestart;
+    lastbegin = framebegin;
+    lastend   = rule;
+
+    if (!matcher->hasBegin())
+        enterFrame(end, end, -1);
+}
+
+void CSMFramer::compact()
+{
+    qint64 discard;
+
+    if (inframe)
+    {
+        discard = framestart;
+    }
+    else
+    {
+        discard = qMax(boundary,
+                       position - ((matcher != 0) ? matcher->beginLength() : 0));
+    }
+    discard = qMin(discard, position);
+
+    if (discard > base)
+    {
+        head += discard - base;
+        base  = discard;
+    }
+
+    if (head == tail)
+    {
+        head = 0;
+        tail = 0;
+    }
+}
+
+void CSMFramer::pack()
+{
+    if (head == 0)
+        return;
+
+    memmove(storage.data(), storage.constData() + head, tail - head);
+    tail -= head;
+    head  = 0;
+}
+
+void CSMFramer::dropPartial()
+{
+    qint64 end = base + (tail - head);
+
+    /* Bytes the automaton has not seen yet are lost too, start over */
+    if (position < end)
+    {
+        position = end;
+        state    = (matcher != 0) ? matcher->initialState() : 0;
+    }
+
+    boundary = position;
+    inframe  = false;
+    recheck  = false;
+    head     = 0;
+    tail     = 0;
+    base     = position;
+
+    if ((matcher != 0) && (!matcher->hasBegin()))
+        enterFrame(position, position, -1);
+}
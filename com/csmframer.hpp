@@ -0,0 +1,583 @@
+#ifndef CSMFRAMER_HPP
+#define CSMFRAMER_HPP
+
+/*! \file csmframer.hpp
+ *  \brief Заголовочный файл механизма выделения пакетов проекта Cosmic Turtle
+ *
+ * Данный файл содержит описание правил поиска пакетов (PreceptByte,
+ * PreceptArray, PreceptSet), а также сигнатуры классов CSMMatcher и
+ * CSMFramer.
+ *
+ *  Класс CSMMatcher - скомпилированный из наборов правил начала и конца пакета
+ * детерминированный конечный автомат. Автомат строится один раз при установке
+ * правил и далее только читается.
+ *
+ *  Класс CSMFramer - потоковый выделитель пакетов. Хранит приемный буфер
+ * фиксированной емкости и состояние автомата между чтениями, поэтому каждый
+ * новый байт обрабатывается один раз за O(1). Участки данных без байт, упомянутых в
+ * правилах, пропускаются векторным поиском CSMScan.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+
+#include "csmscan.hpp"
+
+/*!
+ * \brief Структура, определяющая один байт правила
+ */
+struct PreceptByte
+{
+    /*!
+     * \brief Флаг выбора байта. Значение TRUE - использовать байт byte,
+     * значение FALSE - использовать любой байт кроме byte.
+     */
+    bool     exactly;
+    /*!
+     * \brief Значение байта, задающего правило.
+     */
+    quint8   byte;
+
+    /*!
+     * \brief Конструктор по умолчанию для обеспечения компиляции кода.
+     */
+    PreceptByte() {}
+    /*!
+     * \brief Основной инициализирующий конструктор
+     * \param flag Флаг выбора байта
+     * \param val Значение байта
+     */
+    PreceptByte(bool flag, quint8 val) : exactly(flag), byte(val) {}
+};
+/*!
+ * \brief Shortcut для описания последовательности.
+ */
+typedef QVector<PreceptByte > PreceptArray;
+/*!
+ * \brief Short для задания набора последовательностей.
+ */
+typedef QList  <PreceptArray> PreceptSet;
+
+/*!
+ *  \brief Описание поля длины пакета
+ *
+ *  Поле длины находится на фиксированном смещении от начала пакета (первого
+ * байта exactly=true правила начала). Длина пакета в байтах от его начала
+ * равна значению поля плюс bias. Например, для пакета "AA <длина тела, 1
+ * байт> <тело> <CRC, 2 байта>" это offset = 1, width = 1, bias = 4.
+ */
+struct CSMLengthField
+{
+    /*!
+     *  \brief Смещение поля от начала пакета
+     */
+    qint32 offset;
+    /*!
+     *  \brief Ширина поля, от 1 до 4 байт. 0 - поле длины не используется.
+     */
+    qint32 width;
+    /*!
+     *  \brief Порядок байт поля. TRUE - старший байт первый.
+     */
+    bool   bigendian;
+    /*!
+     *  \brief Поправка, прибавляемая к значению поля
+     */
+    qint32 bias;
+
+    /*!
+     *  \brief Конструктор выключенного поля длины
+     */
+    CSMLengthField() : offset(0), width(0), bigendian(false), bias(0) {}
+    /*!
+     *  \brief Основной инициализирующий конструктор
+     */
+    CSMLengthField(qint32 offset, qint32 width, bool bigendian, qint32 bias) :
+        offset(offset), width(width), bigendian(bigendian), bias(bias) {}
+
+    /*!
+     *  \brief Признак включенного поля длины
+     */
+    bool isEnabled() const { return width > 0; }
+    /*!
+     *  \brief Признак допустимого описания
+     */
+    bool isValid() const { return (offset >= 0) && (width >= 0) && (width <= 4); }
+};
+
+/*!
+ *  \brief Максимальное число состояний автомата CSMMatcher
+ *
+ *  Наборы правил, для которых построение автомата превышает данное значение,
+ * отвергаются.
+ */
+#define CT_MATCHER_MAXSTATES 4096
+/*!
+ *  \brief Емкость приемного буфера CSMFramer по умолчанию
+ *
+ *  Пакет длиннее емкости не может быть выделен и отбрасывается. В байтах.
+ */
+#define CT_FRAMER_CAPACITY 65536
+
+/*!
+ *  \brief Структура, описывающая совпадение правила в состоянии автомата
+ *
+ *  Смещения отсчитываются назад от позиции сразу после последнего
+ * прочитанного байта.
+ */
+struct CSMMatchHit
+{
+    /*!
+     *  \brief Индекс совпавшего правила в своем наборе, -1 - совпадения нет
+     */
+    qint32 rule;
+    /*!
+     *  \brief Смещение назад до первого байта exactly=true совпадения
+     */
+    qint32 startback;
+    /*!
+     *  \brief Смещение назад до позиции после последнего байта exactly=true
+     */
+    qint32 endback;
+
+    /*!
+     *  \brief Конструктор пустого совпадения
+     */
+    CSMMatchHit() : rule(-1), startback(0), endback(0) {}
+};
+
+/*!
+ *  \brief Скомпилированный автомат поиска начала и конца пакета.
+ *
+ *  Правила начала и конца пакета компилируются в один ДКА методом построения
+ * подмножеств. Позиция НКА - пара (правило, число совпавших байт), состояние
+ * ДКА - множество таких позиций. Байты, не упомянутые ни в одном правиле,
+ * объединяются в один класс, поэтому таблица переходов имеет размер
+ * (число состояний) x (число различных байт в правилах + 1).
+ *
+ *  Байты правила, выходящие за начало потока, считаются совпавшими, если это
+ * байты exactly=false (так же, как это делал CSMSpinner::ruleApplier). Для
+ * этого начальное состояние потока отличается от состояния "в середине
+ * потока". Аналогично завершающие байты exactly=false могут быть выполнены
+ * концом доступных данных - такие совпадения помечаются как предварительные.
+ *
+ *  Если задано поле длины, правила конца пакета не используются: конец
+ * пакета вычисляется по полю длины, автомат ищет только начало.
+ *
+ *  После построения объект не изменяется и может читаться из любого потока.
+ */
+class CSMMatcher
+{
+public:
+    /*!
+     *  \brief Конструктор пустого автомата
+     *
+     *  Пустой автомат не находит ни начала, ни конца пакета.
+     */
+    CSMMatcher();
+    /*!
+     *  \brief Конструктор, компилирующий наборы правил
+     *  \param beginset Правила начала пакета. Пустой набор означает, что
+     * пакет начинается сразу после предыдущего.
+     *  \param endset Правила конца пакета.
+     *  \param length Поле длины. Если оно включено, endset не используется.
+     */
+    CSMMatcher(const PreceptSet & beginset, const PreceptSet & endset,
+               const CSMLengthField & length = CSMLengthField());
+
+    /*!
+     *  \brief Признак успешного построения автомата
+     *  \return false, если число состояний превысило CT_MATCHER_MAXSTATES
+     */
+    bool isValid() const;
+    /*!
+     *  \brief Признак наличия правил начала пакета
+     */
+    bool hasBegin() const;
+    /*!
+     *  \brief Число состояний автомата
+     */
+    qint32 stateCount() const;
+    /*!
+     *  \brief Наибольшая длина правила начала пакета
+     */
+    qint32 beginLength() const;
+    /*!
+     *  \brief Поле длины пакета
+     */
+    const CSMLengthField & lengthField() const;
+    /*!
+     *  \brief Состояние автомата в начале потока
+     */
+    qint32 initialState() const;
+    /*!
+     *  \brief Переход автомата по очередному байту
+     *  \param state Текущее состояние
+     *  \param byte Очередной байт
+     *  \return Новое состояние
+     */
+    inline qint32 step(qint32 state, quint8 byte) const
+    {
+        return table.at(state * classes + classmap[byte]);
+    }
+    /*!
+     *  \brief Признак полного совпадения какого-либо правила в состоянии
+     */
+    inline bool isHit(qint32 state) const
+    {
+        return hitflags.at(state);
+    }
+    /*!
+     *  \brief Признак состояния, не меняющегося на байтах вне правил
+     *
+     *  Из такого состояния автомат выходит только на одном из байт
+     * specialBytes, поэтому все байты до него можно пропустить векторным
+     * поиском.
+     */
+    inline bool isSkippable(qint32 state) const
+    {
+        return skipflags.at(state);
+    }
+    /*!
+     *  \brief Набор байт, упомянутых в правилах
+     */
+    const CSMByteSet & specialBytes() const;
+    /*!
+     *  \brief Полное совпадение правила начала пакета
+     *
+     *  Среди совпавших выбирается правило с самым ранним началом.
+     */
+    const CSMMatchHit & beginHit(qint32 state) const;
+    /*!
+     *  \brief Полное совпадение правила конца пакета
+     *
+     *  Среди совпавших выбирается правило с самым ранним концом.
+     */
+    const CSMMatchHit & endHit(qint32 state) const;
+    /*!
+     *  \brief Предварительное совпадение правила конца пакета
+     *
+     *  Совпадение, у которого все оставшиеся байты - exactly=false. Считается
+     * действительным, если данные на текущий момент закончились.
+     */
+    const CSMMatchHit & endPending(qint32 state) const;
+
+private:
+    /*!
+     *  \brief Флаг успешного построения
+     */
+    bool valid;
+    /*!
+     *  \brief Флаг наличия правил начала пакета
+     */
+    bool begins;
+    /*!
+     *  \brief Наибольшая длина правила начала пакета
+     */
+    qint32 beginlen;
+    /*!
+     *  \brief Поле длины пакета
+     */
+    CSMLengthField lengthfield;
+    /*!
+     *  \brief Число классов байт (столбцов таблицы переходов)
+     */
+    qint32 classes;
+    /*!
+     *  \brief Отображение байта в его класс
+     */
+    quint16 classmap[256];
+    /*!
+     *  \brief Таблица переходов, state * classes + class
+     */
+    QVector<qint32> table;
+    /*!
+     *  \brief Флаги полного совпадения по состояниям
+     */
+    QVector<quint8> hitflags;
+    /*!
+     *  \brief Флаги состояний, допускающих пропуск байт вне правил
+     */
+    QVector<quint8> skipflags;
+    /*!
+     *  \brief Байты, упомянутые в правилах
+     */
+    CSMByteSet specials;
+    /*!
+     *  \brief Полные совпадения начала по состояниям
+     */
+    QVector<CSMMatchHit> beginhits;
+    /*!
+     *  \brief Полные совпадения конца по состояниям
+     */
+    QVector<CSMMatchHit> endhits;
+    /*!
+     *  \brief Предварительные совпадения конца по состояниям
+     */
+    QVector<CSMMatchHit> endpendings;
+};
+
+/*!
+ *  \brief Потоковый выделитель пакетов.
+ *
+ *  Новые данные добавляются функцией feed, готовые пакеты забираются функцией
+ * next. Каждый байт проходит через автомат ровно один раз; состояние автомата
+ * и незавершенный пакет сохраняются между чтениями.
+ *
+ *  Пакет начинается с первого байта exactly=true найденного правила начала и
+ * заканчивается последним байтом exactly=true первого найденного после него
+ * правила конца. Окружающие байты exactly=false служат только условием и в
+ * пакет не входят. Пакеты не перекрываются.
+ *
+ *  Если в автомате задано поле длины, конец пакета известен сразу после
+ * прихода поля: байты тела не проходят через автомат, пакет выдается, как
+ * только получено ровно указанное число байт. Пакет с недопустимой длиной
+ * (короче заголовка или длиннее емкости буфера) не выдается, поиск начала
+ * продолжается со следующего за его началом байта.
+ *
+ *  Если правило конца заканчивается байтами exactly=false, а данные
+ * закончились раньше, чем они пришли, конец пакета считается предварительным
+ * (hasPending) и выдается функцией flush по решению владельца, обычно после
+ * паузы в линии.
+ *
+ *  Данные хранятся в непрерывном буфере фиксированной емкости. Читать в него
+ * можно напрямую: reserve возвращает указатель на свободное место, commit
+ * фиксирует прочитанное. Обработанные байты не сдвигаются при каждом пакете -
+ * буфер уплотняется одним переносом, только когда место в конце кончается.
+ * Пакеты выдаются без копирования, как ссылки на буфер
+ * (QByteArray::fromRawData), и действительны до следующего вызова reserve или
+ * feed; владелец копирует пакет, если хранит его дольше.
+ */
+class CSMFramer
+{
+public:
+    /*!
+     *  \brief Конструктор класса
+     *  \param capacity Емкость приемного буфера
+     */
+    CSMFramer(qint32 capacity = CT_FRAMER_CAPACITY);
+
+    /*!
+     *  \brief Установка автомата
+     *
+     *  При смене автомата накопленные данные сбрасываются.
+     *  \param newmatcher Указатель на автомат. Должен жить дольше выделителя.
+     */
+    void setMatcher(const CSMMatcher * newmatcher);
+    /*!
+     *  \brief Добавление прочитанных данных
+     *
+     *  Копирует данные в буфер. Если они не помещаются, буфер расширяется.
+     *  \param bytes Новые байты
+     */
+    void feed(const QByteArray & bytes);
+    /*!
+     *  \brief Место в буфере для чтения напрямую
+     *
+     *  Вызывается после того, как next вернул false. При необходимости
+     * уплотняет буфер. Если буфер целиком занят незавершенным пакетом, пакет
+     * отбрасывается.
+     *  \param space (out) Размер свободного места, всегда больше 0
+     *  \param dropped (out) Флаг отброшенного пакета, может быть 0
+     *  \return Указатель на свободное место
+     */
+    char * reserve(qint32 * space, bool * dropped = 0);
+    /*!
+     *  \brief Фиксация данных, прочитанных в место, выданное reserve
+     *  \param length Число прочитанных байт
+     */
+    void commit(qint32 length);
+    /*!
+     *  \brief Извлечение очередного готового пакета
+     *  \param frame (out) Пакет - ссылка на приемный буфер
+     *  \return true, если пакет был найден
+     */
+    bool next(QByteArray * frame);
+    /*!
+     *  \brief Признак предварительно найденного конца пакета
+     *
+     *  Конец пакета найден, если считать, что данные на этом закончились:
+     * завершающие байты exactly=false правила конца еще не получены.
+     *  \return true, если вызов flush выдаст пакет
+     */
+    bool hasPending() const;
+    /*!
+     *  \brief Выдача пакета по предварительно найденному концу
+     *
+     *  Вызывается, когда новых данных не поступало в течение паузы в линии.
+     *  \param frame (out) Пакет
+     *  \return true, если пакет был выдан
+     *  \see hasPending
+     */
+    bool flush(QByteArray * frame);
+    /*!
+     *  \brief Отказ от только что выданного пакета
+     *
+     *  Вызывается сразу после next или flush, если пакет оказался
+     * поврежденным (например, не сошлась контрольная сумма). Поиск начала
+     * пакета продолжается со следующего за началом отвергнутого пакета байта:
+     * испорченные длина или сигнатура конца не уносят с собой следующие за
+     * ними верные пакеты. Без правил начала и поля длины пакеты идут вплотную,
+     * и искать начало негде: вызов ничего не меняет.
+     */
+    void reject();
+    /*!
+     *  \brief Сброс накопительного буфера и состояния потока
+     */
+    void reset();
+    /*!
+     *  \brief Число байт в приемном буфере
+     */
+    qint32 buffered() const;
+    /*!
+     *  \brief Емкость приемного буфера
+     */
+    qint32 capacity() const;
+    /*!
+     *  \brief Установка емкости приемного буфера
+     *
+     *  Накопленные данные сбрасываются.
+     *  \param capacity Емкость, байт
+     */
+    void setCapacity(qint32 capacity);
+    /*!
+     *  \brief Индекс правила начала последнего выданного пакета
+     *  \return Индекс в наборе правил начала, -1 - правила начала не заданы
+     */
+    qint32 beginRule() const;
+    /*!
+     *  \brief Индекс правила конца последнего выданного пакета
+     *  \return Индекс в наборе правил конца, -1 - пакетов еще не было
+     */
+    qint32 endRule() const;
+
+private:
+    /*!
+     *  \brief Обработка совпадений в текущем состоянии автомата
+     *  \param frame (out) Пакет
+     *  \return true, если пакет был выделен
+     */
+    bool evaluate(QByteArray * frame);
+    /*!
+     *  \brief Переход в состояние "внутри пакета"
+     *  \param start Позиция первого байта пакета
+     *  \param exactend Позиция, раньше которой не может начаться конец пакета
+     *  \param rule Индекс правила начала, -1 - правила начала не заданы
+     */
+    void enterFrame(qint64 start, qint64 exactend, qint32 rule);
+    /*!
+     *  \brief Выдача пакета и переход в состояние поиска начала
+     *  \param end Позиция после последнего байта пакета
+     *  \param rule Индекс правила конца
+     *  \param frame (out) Пакет
+     */
+    void takeFrame(qint64 end, qint32 rule, QByteArray * frame);
+    /*!
+     *  \brief Обработка пакета по полю длины
+     *
+     *  Если поле длины недопустимо, пакет отбрасывается и флаг "внутри
+     * пакета" снимается.
+     *  \param frame (out) Пакет
+     *  \return true, если пакет получен целиком и выдан
+     */
+    bool measure(QByteArray * frame);
+    /*!
+     *  \brief Перевод автомата в позицию потока без обработки всех байт
+     *  до нее
+     *
+     *  Автомат проходит только последние beginLength байт: этого достаточно,
+     * чтобы найти начало пакета, начинающееся в позиции at или позже.
+     *  \param at Новая позиция
+     */
+    void seek(qint64 at);
+    /*!
+     *  \brief Пропуск байт буфера, которые больше не понадобятся
+     *
+     *  Данные не переносятся, сдвигается только начало занятой части.
+     */
+    void compact();
+    /*!
+     *  \brief Перенос занятой части в начало буфера
+     */
+    void pack();
+    /*!
+     *  \brief Отбрасывание незавершенного пакета при переполнении
+     */
+    void dropPartial();
+
+    /*!
+     *  \brief Указатель на автомат
+     */
+    const CSMMatcher * matcher;
+    /*!
+     *  \brief Приемный буфер. Размер равен емкости, занята часть
+     * [head, tail)
+     */
+    QByteArray storage;
+    /*!
+     *  \brief Индекс первого занятого байта буфера
+     */
+    qint32 head;
+    /*!
+     *  \brief Индекс после последнего занятого байта буфера
+     */
+    qint32 tail;
+    /*!
+     *  \brief Позиция потока, соответствующая байту head буфера
+     */
+    qint64 base;
+    /*!
+     *  \brief Позиция потока после последнего обработанного автоматом байта
+     */
+    qint64 position;
+    /*!
+     *  \brief Позиция, раньше которой не может начаться следующий пакет
+     */
+    qint64 boundary;
+    /*!
+     *  \brief Позиция начала текущего пакета
+     */
+    qint64 framestart;
+    /*!
+     *  \brief Позиция, раньше которой не может начаться конец текущего пакета
+     */
+    qint64 frameexact;
+    /*!
+     *  \brief Позиция конца текущего пакета по полю длины, -1 - неизвестна
+     */
+    qint64 frameend;
+    /*!
+     *  \brief Индекс правила начала текущего пакета
+     */
+    qint32 framebegin;
+    /*!
+     *  \brief Позиция начала последнего выданного пакета, -1 - нет
+     */
+    qint64 laststart;
+    /*!
+     *  \brief Индексы правил начала и конца последнего выданного пакета
+     */
+    qint32 lastbegin;
+    qint32 lastend;
+    /*!
+     *  \brief Текущее состояние автомата
+     */
+    qint32 state;
+    /*!
+     *  \brief Флаг "внутри пакета"
+     */
+    bool inframe;
+    /*!
+     *  \brief Флаг повторной проверки текущего состояния
+     *
+     *  Взводится после выдачи пакета: байт, завершивший пакет, может
+     * одновременно завершать начало следующего.
+     */
+    bool recheck;
+};
+
+#endif // CSMFRAMER_HPP
@@ -0,0 +1,95 @@
+#include <QMutexLocker>
+#include <atomic>
+#include <string.h>
+#include "csmpool.hpp"
+
+CSMBufferPool::CSMBufferPool(qint32 size)
+{
+    limit  = qMax(size, 0);
+    cursor = 0;
+    hit.store(0);
+    miss.store(0);
+}
+
+QByteArray CSMBufferPool::take(const char * data, qint32 length)
+{
+    if (length <= 0)
+        return QByteArray();
+
+    QMutexLocker locker(&lock);
+    qint32       count = buffers.length();
+
+    if ((limit == 0) || (length > CT_POOL_MAXLENGTH))
+    {
+        miss.fetchAndAddRelaxed(1);
+        return QByteArray(data, length);
+    }
+
+    for (qint32 i = 0; i < count; i++)
+    {
+        QByteArray & buffer = buffers[cursor];
+
+        cursor = (cursor + 1) % count;
+        if (!buffer.isDetached())
+            continue;
+
+        /* Whatever the last holder did with the data happened before this */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (buffer.capacity() < length)
+        {
+            buffer.reserve(qMax(length, CT_POOL_BUFFERSIZE));
+            miss.fetchAndAddRelaxed(1);
+        }
+        else
+        {
+            hit.fetchAndAddRelaxed(1);
+        }
+
+        /* Reserved capacity is kept, the array stays where it is */
+        buffer.resize(length);
+        memcpy(buffer.data(), data, length);
+
+        return buffer;
+    }
+
+    miss.fetchAndAddRelaxed(1);
+    if (count >= limit)
+        return QByteArray(data, length);
+
+    QByteArray buffer;
+
+    buffer.reserve(qMax(length, CT_POOL_BUFFERSIZE));
+    buffer.append(data, length);
+    buffers.append(buffer);
+
+    return buffer;
+}
+
+void CSMBufferPool::setSize(qint32 size)
+{
+    QMutexLocker locker(&lock);
+
+    limit = qMax(size, 0);
+    if (buffers.length() > limit)
+    {
+        buffers.resize(limit);
+        cursor = 0;
+    }
+}
+
+qint32 CSMBufferPool::size() const
+{
+    QMutexLocker locker(&lock);
+
+    return limit;
+}
+
+quint64 CSMBufferPool::hits() const
+{
+    return hit.load();
+}
+
+quint64 CSMBufferPool::misses() const
+{
+    return miss.load();
+}
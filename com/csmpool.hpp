@@ -0,0 +1,108 @@
+#ifndef CSMPOOL_HPP
+#define CSMPOOL_HPP
+
+/*! \file csmpool.hpp
+ *  \brief Заголовочный файл пула буферов проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMBufferPool - пула буферов для
+ * пакетов, испускаемых портом, и сообщений, которые ему передаются.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QByteArray>
+#include <QVector>
+#include <QMutex>
+#include <QAtomicInteger>
+
+/*!
+ *  \brief Число буферов в пуле по умолчанию, 0 - пул отключен
+ */
+#define CT_DEFAULT_POOLSIZE   64
+/*!
+ *  \brief Наименьшая емкость буфера пула, байт
+ */
+#define CT_POOL_BUFFERSIZE    256
+/*!
+ *  \brief Наибольшая длина данных, размещаемых в пуле, байт
+ *
+ *  Более длинные данные размещаются обычным образом, чтобы редкий длинный
+ * пакет не держал память в пуле.
+ */
+#define CT_POOL_MAXLENGTH     4096
+
+/*!
+ *  \brief Пул буферов
+ *
+ *  Держит ссылки на несколько QByteArray и раздает их копии. Буфер снова
+ * выдается, когда все прочие ссылки на него отпущены (QByteArray::isDetached)
+ * - в любом потоке, - и тогда данные пишутся в уже выделенную память без
+ * обращения к куче. Буферы просматриваются по кругу: пакеты и сообщения
+ * обычно отпускаются в порядке выдачи, поэтому свободный находится сразу.
+ *
+ *  Вызывающий получает разделяемую копию: ее изменение, как обычно для
+ * QByteArray, создает собственную копию данных. Все функции потокобезопасны.
+ */
+class CSMBufferPool
+{
+public:
+    /*!
+     *  \brief Конструктор пула
+     *  \param size Число буферов, 0 - пул отключен
+     */
+    CSMBufferPool(qint32 size = CT_DEFAULT_POOLSIZE);
+
+    /*!
+     *  \brief Копия данных в буфере пула
+     *  \param data Данные
+     *  \param length Длина данных
+     *  \return Массив, разделяющий буфер пула, или обычный массив, если
+     * свободного буфера нет
+     */
+    QByteArray take(const char * data, qint32 length);
+    /*!
+     *  \brief Установка числа буферов
+     *
+     *  Лишние буферы освобождаются, как только их отпустят получатели.
+     *  \param size Число буферов, 0 - пул отключен
+     */
+    void setSize(qint32 size);
+    /*!
+     *  \brief Число буферов
+     */
+    qint32 size() const;
+    /*!
+     *  \brief Число выдач без выделения памяти
+     */
+    quint64 hits() const;
+    /*!
+     *  \brief Число выдач с выделением памяти
+     */
+    quint64 misses() const;
+
+private:
+    /*!
+     *  \brief Защита буферов
+     */
+    mutable QMutex lock;
+    /*!
+     *  \brief Буферы
+     */
+    QVector<QByteArray> buffers;
+    /*!
+     *  \brief Число буферов
+     */
+    qint32 limit;
+    /*!
+     *  \brief Следующий просматриваемый буфер
+     */
+    qint32 cursor;
+    /*!
+     *  \brief Счетчики выдач, см. hits и misses
+     */
+    QAtomicInteger<quint64> hit;
+    QAtomicInteger<quint64> miss;
+};
+
+#endif // CSMPOOL_HPP
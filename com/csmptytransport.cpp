@@ -0,0 +1,195 @@
+#include "csmptytransport.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#ifdef Q_OS_MAC
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+/* CSMPtyTransport */
+
+CSMPtyTransport::CSMPtyTransport(int descriptor, QObject * parent)
+    : CSMTransport(parent)
+{
+    fd     = -1;
+    reader = 0;
+    writer = 0;
+
+    if (descriptor >= 0)
+        attach(descriptor);
+}
+
+CSMPtyTransport::~CSMPtyTransport()
+{
+    close();
+}
+
+bool CSMPtyTransport::openPair(CSMPtyTransport ** master,
+                               CSMPtyTransport ** slave)
+{
+    struct termios line;
+    int            masterfd;
+    int            slavefd;
+    char           slavename[256];
+
+    memset(&line, 0, sizeof(line));
+    cfmakeraw(&line);
+    if (openpty(&masterfd, &slavefd, slavename, &line, 0) != 0)
+        return false;
+
+    *master = new CSMPtyTransport(masterfd);
+    *slave  = new CSMPtyTransport(slavefd);
+    (*slave)->path = QString::fromLocal8Bit(slavename);
+
+    return true;
+}
+
+void CSMPtyTransport::attach(int descriptor)
+{
+    struct termios line;
+
+    fd = descriptor;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (tcgetattr(fd, &line) == 0)
+    {
+        cfmakeraw(&line);
+        tcsetattr(fd, TCSANOW, &line);
+    }
+
+    reader = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(reader, SIGNAL(activated(int)),
+            this,   SLOT(readable()));
+
+    writer = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+    writer->setEnabled(false);
+    connect(writer, SIGNAL(activated(int)),
+            this,   SLOT(writable()));
+}
+
+bool CSMPtyTransport::open(QString name)
+{
+    close();
+
+    int descriptor = ::open(name.toLocal8Bit().constData(),
+                            O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (descriptor < 0)
+        return false;
+
+    attach(descriptor);
+    path = name;
+
+    return true;
+}
+
+void CSMPtyTransport::close()
+{
+    if (fd < 0)
+        return;
+
+    delete reader;
+    delete writer;
+    reader = 0;
+    writer = 0;
+    ::close(fd);
+    fd = -1;
+    pending.clear();
+}
+
+bool CSMPtyTransport::isOpen() const
+{
+    return (fd >= 0);
+}
+
+QString CSMPtyTransport::name() const
+{
+    return path;
+}
+
+qint64 CSMPtyTransport::bytesAvailable()
+{
+    int available = 0;
+
+    if ((fd < 0) || (ioctl(fd, FIONREAD, &available) != 0))
+        return 0;
+
+    return available;
+}
+
+qint64 CSMPtyTransport::read(char * data, qint64 maxlength)
+{
+    if (fd < 0)
+        return -1;
+
+    ssize_t received = ::read(fd, data, maxlength);
+    if (received < 0)
+        return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+
+    return received;
+}
+
+qint64 CSMPtyTransport::write(const QByteArray & bytes)
+{
+    if (fd < 0)
+        return -1;
+
+    pending.append(bytes);
+    flush();
+
+    return bytes.length();
+}
+
+qint32 CSMPtyTransport::baudRate() const
+{
+    return 0;
+}
+
+void CSMPtyTransport::readable()
+{
+    /* The other end is gone: stop the notifier from firing forever */
+    if (bytesAvailable() == 0)
+    {
+        struct pollfd state;
+
+        state.fd      = fd;
+        state.events  = POLLIN;
+        state.revents = 0;
+        if ((poll(&state, 1, 0) > 0) && (state.revents & (POLLHUP | POLLERR)))
+        {
+            reader->setEnabled(false);
+            return;
+        }
+    }
+
+    emit readyRead();
+}
+
+void CSMPtyTransport::writable()
+{
+    flush();
+}
+
+void CSMPtyTransport::flush()
+{
+    while (!pending.isEmpty())
+    {
+        ssize_t sent = ::write(fd, pending.constData(), pending.length());
+
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                pending.clear();
+            break;
+        }
+        pending.remove(0, sent);
+    }
+
+    writer->setEnabled(!pending.isEmpty());
+}
@@ -0,0 +1,107 @@
+#ifndef CSMPTYTRANSPORT_HPP
+#define CSMPTYTRANSPORT_HPP
+
+/*! \file csmptytransport.hpp
+ *  \brief Заголовочный файл канала на псевдотерминале проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMPtyTransport - канала поверх
+ * дескриптора псевдотерминала (только *nix). Пара CSMPtyTransport::openPair
+ * образует петлю: байты, записанные в один конец, читаются из другого. Это
+ * позволяет проверять весь стек CSMCom на любой машине без COM-порта.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QSocketNotifier>
+#include "csmtransport.hpp"
+
+/*!
+ *  \brief Канал на дескрипторе псевдотерминала
+ *
+ *  Дескриптор переводится в неблокирующий режим, линия - в "сырой" режим
+ * (cfmakeraw). Данные, которые не удалось записать сразу, копятся в буфере и
+ * дописываются по готовности дескриптора.
+ */
+class CSMPtyTransport : public CSMTransport
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Конструктор класса
+     *  \param descriptor Открытый дескриптор, которым будет владеть канал,
+     * или -1
+     *  \param parent Родитель
+     */
+    CSMPtyTransport(int descriptor = -1, QObject * parent = 0);
+    /*!
+     *  \brief Деструктор класса. Закрывает дескриптор.
+     */
+    ~CSMPtyTransport();
+
+    /*!
+     *  \brief Создание петли из двух концов псевдотерминала
+     *  \param master (out) Ведущий конец
+     *  \param slave (out) Ведомый конец; его имя можно передать другому
+     * процессу
+     *  \return Статус успешности создания
+     */
+    static bool openPair(CSMPtyTransport ** master, CSMPtyTransport ** slave);
+
+    /*!
+     *  \brief Открытие терминала по пути, например ведомого конца /dev/pts/N
+     */
+    bool open(QString name);
+    void close();
+    bool isOpen() const;
+    QString name() const;
+    qint64 bytesAvailable();
+    qint64 read(char * data, qint64 maxlength);
+    qint64 write(const QByteArray & bytes);
+    qint32 baudRate() const;
+
+private slots:
+    /*!
+     *  \brief Слот готовности дескриптора к чтению
+     */
+    void readable();
+    /*!
+     *  \brief Слот готовности дескриптора к записи
+     */
+    void writable();
+
+private:
+    /*!
+     *  \brief Подготовка дескриптора и уведомителей
+     *  \param descriptor Дескриптор
+     */
+    void attach(int descriptor);
+    /*!
+     *  \brief Дозапись накопленных данных
+     */
+    void flush();
+
+    /*!
+     *  \brief Дескриптор, -1 - канал закрыт
+     */
+    int fd;
+    /*!
+     *  \brief Имя терминала
+     */
+    QString path;
+    /*!
+     *  \brief Уведомитель о готовности к чтению
+     */
+    QSocketNotifier * reader;
+    /*!
+     *  \brief Уведомитель о готовности к записи
+     */
+    QSocketNotifier * writer;
+    /*!
+     *  \brief Данные, ожидающие записи
+     */
+    QByteArray pending;
+};
+
+#endif // CSMPTYTRANSPORT_HPP
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <QMutexLocker>
+#include "csmqueue.hpp"
+
+CSMSendQueue::CSMSendQueue()
+{
+    counter = 0;
+}
+
+bool CSMSendQueue::before(const CSMRequest & a, const CSMRequest & b)
+{
+    if (a.priority != b.priority)
+        return (a.priority > b.priority);
+
+    return (a.sequence < b.sequence);
+}
+
+void CSMSendQueue::siftUp(qint32 index)
+{
+    while (index > 0)
+    {
+        qint32 parent = (index - 1) / 2;
+
+        if (!before(heap.at(index), heap.at(parent)))
+            break;
+        std::swap(heap[index], heap[parent]);
+        index = parent;
+    }
+}
+
+void CSMSendQueue::siftDown(qint32 index)
+{
+    qint32 count = heap.length();
+
+    for (;;)
+    {
+        qint32 first = index;
+        qint32 left  = 2 * index + 1;
+        qint32 right = left + 1;
+
+        if ((left < count) && (before(heap.at(left), heap.at(first))))
+            first = left;
+        if ((right < count) && (before(heap.at(right), heap.at(first))))
+            first = right;
+        if (first == index)
+            break;
+
+        std::swap(heap[index], heap[first]);
+        index = first;
+    }
+}
+
+void CSMSendQueue::push(CSMRequest request)
+{
+    request.sequence = counter++;
+    heap.append(request);
+    siftUp(heap.length() - 1);
+}
+
+CSMRequest CSMSendQueue::pop()
+{
+    CSMRequest request = heap.first();
+
+    heap.first() = heap.last();
+    heap.removeLast();
+    if (!heap.isEmpty())
+        siftDown(0);
+
+    return request;
+}
+
+CSMRequest CSMSendQueue::takeOldest()
+{
+    qint32 victim = 0;
+
+    /* Lowest priority first, then the earliest among them */
+    for (qint32 i = 1; i < heap.length(); i++)
+    {
+        const CSMRequest & current = heap.at(i);
+        const CSMRequest & chosen  = heap.at(victim);
+
+        if ((current.priority < chosen.priority) ||
+            ((current.priority == chosen.priority) &&
+             (current.sequence < chosen.sequence)))
+        {
+            victim = i;
+        }
+    }
+
+    CSMRequest request = heap.at(victim);
+
+    heap[victim] = heap.last();
+    heap.removeLast();
+    if (victim < heap.length())
+    {
+        siftUp(victim);
+        siftDown(victim);
+    }
+
+    return request;
+}
+
+const CSMRequest & CSMSendQueue::top() const
+{
+    return heap.first();
+}
+
+bool CSMSendQueue::isEmpty() const
+{
+    return heap.isEmpty();
+}
+
+qint32 CSMSendQueue::length() const
+{
+    return heap.length();
+}
+
+void CSMSendQueue::clear()
+{
+    heap.clear();
+}
+
+/* CSMWaiter */
+
+CSMWaiter::CSMWaiter()
+{
+    done      = false;
+    resolved  = false;
+    abandoned = false;
+    cause     = CSMTransactException::Timeout;
+}
+
+void CSMWaiter::resolve(const QByteArray & reply)
+{
+    QMutexLocker locker(&lock);
+
+    result   = reply;
+    resolved = true;
+    done     = true;
+    ready.wakeAll();
+}
+
+void CSMWaiter::fail(CSMTransactException::Reason reason)
+{
+    QMutexLocker locker(&lock);
+
+    cause = reason;
+    done  = true;
+    ready.wakeAll();
+}
+
+bool CSMWaiter::wait(QDeadlineTimer deadline)
+{
+    QMutexLocker locker(&lock);
+
+    /* Spurious wakeups just go around again */
+    while (!done)
+    {
+        if (!ready.wait(&lock, deadline))
+            return done;
+    }
+
+    return true;
+}
+
+void CSMWaiter::abandon()
+{
+    QMutexLocker locker(&lock);
+
+    abandoned = true;
+}
+
+bool CSMWaiter::isAbandoned() const
+{
+    QMutexLocker locker(&lock);
+
+    return abandoned;
+}
+
+bool CSMWaiter::isResolved() const
+{
+    QMutexLocker locker(&lock);
+
+    return resolved;
+}
+
+QByteArray CSMWaiter::reply() const
+{
+    QMutexLocker locker(&lock);
+
+    return result;
+}
+
+CSMTransactException::Reason CSMWaiter::reason() const
+{
+    QMutexLocker locker(&lock);
+
+    return cause;
+}
+
+/* CSMQueueGauge */
+
+CSMQueueGauge::CSMQueueGauge()
+{
+    counter.store(0);
+    limit.store(CT_DEFAULT_QUEUECAPACITY);
+    action.store(CSMSendQueue::Reject);
+    high.store(-1);
+    low.store(-1);
+    throttled.store(0);
+    lost.store(0);
+}
+
+void CSMQueueGauge::setCapacity(qint32 capacity, CSMSendQueue::Policy policy)
+{
+    limit.store(capacity);
+    action.store(policy);
+}
+
+qint32 CSMQueueGauge::capacity() const
+{
+    return limit.load();
+}
+
+CSMSendQueue::Policy CSMQueueGauge::policy() const
+{
+    return (CSMSendQueue::Policy)action.load();
+}
+
+void CSMQueueGauge::setWatermarks(qint32 highmark, qint32 lowmark)
+{
+    high.store(highmark);
+    low.store(lowmark);
+    throttled.store(0);
+}
+
+qint32 CSMQueueGauge::highWatermark() const
+{
+    return high.load();
+}
+
+qint32 CSMQueueGauge::lowWatermark() const
+{
+    return low.load();
+}
+
+qint32 CSMQueueGauge::count() const
+{
+    return counter.load();
+}
+
+bool CSMQueueGauge::isFull() const
+{
+    qint32 capacity = limit.load();
+
+    return ((capacity >= 0) && (counter.load() >= capacity));
+}
+
+CSMQueueGauge::Crossing CSMQueueGauge::acquire()
+{
+    return rise(counter.fetchAndAddOrdered(1) + 1);
+}
+
+bool CSMQueueGauge::tryAcquire(Crossing * crossing)
+{
+    qint32 length = counter.load();
+
+    for (;;)
+    {
+        qint32 capacity = limit.load();
+
+        if ((capacity >= 0) && (length >= capacity))
+            return false;
+        if (counter.testAndSetOrdered(length, length + 1))
+            break;
+        length = counter.load();
+    }
+
+    *crossing = rise(length + 1);
+
+    return true;
+}
+
+CSMQueueGauge::Crossing CSMQueueGauge::rise(qint32 length)
+{
+    qint32 mark = high.load();
+
+    /* The flag makes the crossing reported once, whichever thread sees it */
+    if ((mark >= 0) && (length >= mark) && (throttled.testAndSetOrdered(0, 1)))
+        return High;
+
+    return Steady;
+}
+
+CSMQueueGauge::Crossing CSMQueueGauge::release()
+{
+    qint32 length = counter.fetchAndAddOrdered(-1) - 1;
+
+    if ((length <= low.load()) && (throttled.testAndSetOrdered(1, 0)))
+        return Low;
+
+    return Steady;
+}
+
+void CSMQueueGauge::addDropped()
+{
+    lost.fetchAndAddRelaxed(1);
+}
+
+quint64 CSMQueueGauge::dropped() const
+{
+    return lost.load();
+}
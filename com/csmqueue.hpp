@@ -0,0 +1,445 @@
+#ifndef CSMQUEUE_HPP
+#define CSMQUEUE_HPP
+
+/*! \file csmqueue.hpp
+ *  \brief Заголовочный файл очереди отправки проекта Cosmic Turtle
+ *
+ * Данный файл содержит описание запроса CSMRequest и сигнатуры классов
+ * CSMSendQueue - очереди отправки с приоритетами, CSMQueueGauge -
+ * ограничителя ее длины, CSMTransactException - ошибки транзакции - и
+ * CSMWaiter - ожидания результата блокирующей транзакции.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QByteArray>
+#include <QVector>
+#include <QDeadlineTimer>
+#include <QAtomicInt>
+#include <QFutureInterface>
+#include <QException>
+#include <QMutex>
+#include <QWaitCondition>
+#include <memory>
+
+/*!
+ *  \brief Приоритет сообщения по умолчанию
+ *
+ *  Сообщения с большим приоритетом отправляются раньше.
+ */
+#define CT_DEFAULT_PRIORITY 0
+/*!
+ *  \brief Наибольшая длина очереди отправки по умолчанию
+ *
+ *  Значение -1 снимает ограничение: очередь ограничивается только явным
+ * вызовом CSMCom::setSendQueueCapacity.
+ */
+#define CT_DEFAULT_QUEUECAPACITY -1
+
+/*!
+ *  \brief Обещание результата транзакции CSMCom::transact
+ */
+typedef std::shared_ptr<QFutureInterface<QByteArray> > CSMPromise;
+
+/*!
+ *  \brief Ошибка транзакции
+ *
+ *  Передается через QFuture, возвращенный CSMCom::transact: result()
+ * выбрасывает ее вместо возврата ответа.
+ */
+class CSMTransactException : public QException
+{
+public:
+    /*!
+     *  \brief Причина
+     */
+    enum Reason
+    {
+        Timeout,  //!< Ответ не получен за отведенное время
+        Expired,  //!< Срок запроса истек в очереди
+        Dropped,  //!< Запрос вытеснен при переполнении очереди
+        Rejected, //!< Очередь заполнена, запрос не принят
+        Closed    //!< Порт закрыт до завершения транзакции
+    };
+
+    /*!
+     *  \brief Конструктор класса
+     *  \param reason Причина
+     */
+    CSMTransactException(Reason reason) : cause(reason) {}
+
+    /*!
+     *  \brief Причина
+     */
+    Reason reason() const { return cause; }
+    void raise() const { throw *this; }
+    CSMTransactException * clone() const { return new CSMTransactException(*this); }
+
+private:
+    /*!
+     *  \brief Причина
+     */
+    Reason cause;
+};
+
+/*!
+ *  \brief Ожидание результата блокирующей транзакции
+ *
+ *  Поток, вызвавший CSMCom::transact с крайним сроком, спит на условной
+ * переменной, пока поток ввода-вывода не передаст ответ или ошибку. Объект
+ * принадлежит совместно запросу и ожидающему потоку: если срок вышел раньше
+ * ответа, поток уходит, а запрос завершается без него.
+ */
+class CSMWaiter
+{
+public:
+    /*!
+     *  \brief Конструктор незавершенного ожидания
+     */
+    CSMWaiter();
+
+    /*!
+     *  \brief Завершение ответом
+     *  \param reply Ответ
+     */
+    void resolve(const QByteArray & reply);
+    /*!
+     *  \brief Завершение ошибкой
+     *  \param reason Причина
+     */
+    void fail(CSMTransactException::Reason reason);
+    /*!
+     *  \brief Ожидание завершения
+     *  \param deadline Крайний срок
+     *  \return false, если срок вышел раньше
+     */
+    bool wait(QDeadlineTimer deadline);
+    /*!
+     *  \brief Отказ от ожидания
+     *
+     *  Еще не отправленный запрос после этого в порт не пишется.
+     */
+    void abandon();
+    /*!
+     *  \brief Признак отказа от ожидания
+     */
+    bool isAbandoned() const;
+    /*!
+     *  \brief Признак завершения ответом
+     */
+    bool isResolved() const;
+    /*!
+     *  \brief Ответ
+     */
+    QByteArray reply() const;
+    /*!
+     *  \brief Причина ошибки
+     */
+    CSMTransactException::Reason reason() const;
+
+private:
+    /*!
+     *  \brief Защита полей
+     */
+    mutable QMutex lock;
+    /*!
+     *  \brief Условие завершения
+     */
+    QWaitCondition ready;
+    /*!
+     *  \brief Флаги завершения, успеха и отказа от ожидания
+     */
+    bool done;
+    bool resolved;
+    bool abandoned;
+    /*!
+     *  \brief Ответ
+     */
+    QByteArray result;
+    /*!
+     *  \brief Причина ошибки
+     */
+    CSMTransactException::Reason cause;
+};
+
+/*!
+ *  \brief Ожидание блокирующей транзакции, общее для запроса и потока
+ */
+typedef std::shared_ptr<CSMWaiter> CSMWaiterPtr;
+
+/*!
+ *  \brief Запрос, ожидающий отправки или ответа
+ */
+struct CSMRequest
+{
+    /*!
+     *  \brief Байты запроса
+     */
+    QByteArray     bytes;
+    /*!
+     *  \brief Требуемый таймаут, мс, -1 - по настройкам порта
+     */
+    qint32         timeout;
+    /*!
+     *  \brief Приоритет
+     */
+    qint32         priority;
+    /*!
+     *  \brief Флаг сообщения, не требующего ответа
+     */
+    bool           oneway;
+    /*!
+     *  \brief Срок, после которого запрос не отправляется
+     */
+    QDeadlineTimer deadline;
+    /*!
+     *  \brief Порядковый номер постановки в очередь
+     */
+    quint64        sequence;
+    /*!
+     *  \brief Ключ сопоставления, вычисляется при отправке
+     */
+    QByteArray     key;
+    /*!
+     *  \brief Момент истечения таймаута по часам CSMSpinner, нс
+     */
+    qint64         expires;
+    /*!
+     *  \brief Момент записи в порт по часам CSMSpinner, нс
+     */
+    qint64         sent;
+    /*!
+     *  \brief Время передачи запроса по линии, нс
+     */
+    qint64         wiretime;
+    /*!
+     *  \brief Обещание ответа, пустое - запрос отправлен не через transact
+     */
+    CSMPromise     promise;
+    /*!
+     *  \brief Ожидание блокирующей транзакции или пустое
+     */
+    CSMWaiterPtr   waiter;
+
+    /*!
+     *  \brief Конструктор пустого запроса
+     */
+    CSMRequest() : timeout(-1), priority(CT_DEFAULT_PRIORITY), oneway(false),
+                   deadline(QDeadlineTimer::Forever), sequence(0),
+                   expires(0), sent(0), wiretime(0) {}
+};
+
+/*!
+ *  \brief Очередь отправки с приоритетами
+ *
+ *  Двоичная куча по паре (приоритет, порядковый номер): первым извлекается
+ * сообщение с наибольшим приоритетом, при равных приоритетах - поставленное
+ * раньше. Вставка и извлечение - O(log n). Сроки сообщений проверяет
+ * владелец очереди при извлечении.
+ */
+class CSMSendQueue
+{
+public:
+    /*!
+     *  \brief Действие при переполнении очереди
+     */
+    enum Policy
+    {
+        DropOldest, //!< Вытесняется самое старое сообщение с наименьшим приоритетом
+        DropNewest, //!< Новое сообщение отбрасывается
+        Reject      //!< Новое сообщение отвергается с предупреждением
+    };
+
+    /*!
+     *  \brief Конструктор пустой очереди
+     */
+    CSMSendQueue();
+
+    /*!
+     *  \brief Постановка запроса в очередь
+     *
+     *  Запросу присваивается очередной порядковый номер.
+     *  \param request Запрос
+     */
+    void push(CSMRequest request);
+    /*!
+     *  \brief Извлечение первого по очереди запроса
+     *
+     *  Очередь не должна быть пустой.
+     *  \return Запрос
+     */
+    CSMRequest pop();
+    /*!
+     *  \brief Извлечение самого старого запроса с наименьшим приоритетом
+     *
+     *  Запрос, который был бы отправлен последним из самых старых. Очередь не
+     * должна быть пустой. O(n).
+     *  \return Запрос
+     */
+    CSMRequest takeOldest();
+    /*!
+     *  \brief Первый по очереди запрос без извлечения
+     */
+    const CSMRequest & top() const;
+    /*!
+     *  \brief Признак пустой очереди
+     */
+    bool isEmpty() const;
+    /*!
+     *  \brief Число запросов в очереди
+     */
+    qint32 length() const;
+    /*!
+     *  \brief Очистка очереди
+     */
+    void clear();
+
+private:
+    /*!
+     *  \brief Порядок извлечения: true, если a извлекается раньше b
+     */
+    static bool before(const CSMRequest & a, const CSMRequest & b);
+    /*!
+     *  \brief Подъем элемента кучи
+     */
+    void siftUp(qint32 index);
+    /*!
+     *  \brief Спуск элемента кучи
+     */
+    void siftDown(qint32 index);
+
+    /*!
+     *  \brief Куча запросов
+     */
+    QVector<CSMRequest> heap;
+    /*!
+     *  \brief Следующий порядковый номер
+     */
+    quint64 counter;
+};
+
+/*!
+ *  \brief Ограничитель длины очереди отправки
+ *
+ *  Считает сообщения от приема слотом bytesIn до выхода из очереди
+ * отправки, то есть вместе с еще не доставленными в поток ввода-вывода.
+ * Увеличивается в потоке отправителя, уменьшается в потоке ввода-вывода; все
+ * поля атомарны. Отмечает пересечение порогов: верхнего - при росте, нижнего
+ * - при убывании, каждое один раз до пересечения другого.
+ */
+class CSMQueueGauge
+{
+public:
+    /*!
+     *  \brief Результат изменения длины
+     */
+    enum Crossing
+    {
+        Steady, //!< Порог не пересечен
+        High,   //!< Длина достигла верхнего порога
+        Low     //!< Длина опустилась до нижнего порога
+    };
+
+    /*!
+     *  \brief Конструктор пустого ограничителя
+     *
+     *  Емкость CT_DEFAULT_QUEUECAPACITY (без ограничения), действие Reject,
+     * пороги отключены.
+     */
+    CSMQueueGauge();
+
+    /*!
+     *  \brief Установка емкости и действия при переполнении
+     *  \param capacity Емкость, -1 - без ограничения
+     *  \param policy Действие
+     */
+    void setCapacity(qint32 capacity, CSMSendQueue::Policy policy);
+    /*!
+     *  \brief Емкость, -1 - без ограничения
+     */
+    qint32 capacity() const;
+    /*!
+     *  \brief Действие при переполнении
+     */
+    CSMSendQueue::Policy policy() const;
+    /*!
+     *  \brief Установка порогов
+     *  \param high Верхний порог, -1 - пороги отключены
+     *  \param low Нижний порог, меньше верхнего
+     */
+    void setWatermarks(qint32 high, qint32 low);
+    /*!
+     *  \brief Верхний порог, -1 - пороги отключены
+     */
+    qint32 highWatermark() const;
+    /*!
+     *  \brief Нижний порог
+     */
+    qint32 lowWatermark() const;
+    /*!
+     *  \brief Текущая длина
+     */
+    qint32 count() const;
+    /*!
+     *  \brief Признак заполненной очереди
+     */
+    bool isFull() const;
+    /*!
+     *  \brief Учет принятого сообщения без проверки емкости
+     */
+    Crossing acquire();
+    /*!
+     *  \brief Учет принятого сообщения, если очередь не заполнена
+     *
+     *  Проверка емкости и увеличение длины - одна атомарная операция, поэтому
+     * одновременные отправители не превышают емкость.
+     *  \param crossing (out) Пересечение порога
+     *  \return false, если очередь заполнена и сообщение не учтено
+     */
+    bool tryAcquire(Crossing * crossing);
+    /*!
+     *  \brief Учет сообщения, покинувшего очередь
+     */
+    Crossing release();
+    /*!
+     *  \brief Учет отброшенного сообщения
+     */
+    void addDropped();
+    /*!
+     *  \brief Число отброшенных сообщений
+     */
+    quint64 dropped() const;
+
+private:
+    /*!
+     *  \brief Проверка верхнего порога после роста длины
+     *  \param length Новая длина
+     */
+    Crossing rise(qint32 length);
+
+    /*!
+     *  \brief Текущая длина
+     */
+    QAtomicInt counter;
+    /*!
+     *  \brief Емкость и действие, см. setCapacity
+     */
+    QAtomicInt limit;
+    QAtomicInt action;
+    /*!
+     *  \brief Пороги, см. setWatermarks
+     */
+    QAtomicInt high;
+    QAtomicInt low;
+    /*!
+     *  \brief Флаг пересеченного верхнего порога
+     */
+    QAtomicInt throttled;
+    /*!
+     *  \brief Число отброшенных сообщений
+     */
+    QAtomicInteger<quint64> lost;
+};
+
+#endif // CSMQUEUE_HPP
@@ -0,0 +1,94 @@
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include "csmreactor.hpp"
+
+static QMutex       reactorlock;
+static CSMReactor * reactor      = 0;
+static qint32       reactorsize  = CT_REACTOR_THREADS;
+
+CSMReactor::CSMReactor(qint32 count)
+{
+    for (qint32 i = 0; i < count; i++)
+    {
+        QThread * thread = new QThread();
+
+        thread->setObjectName(QString("CSMReactor #%1").arg(i));
+        thread->start();
+        threads.append(thread);
+        load.append(0);
+    }
+}
+
+CSMReactor::~CSMReactor()
+{
+    for (qint32 i = 0; i < threads.length(); i++)
+    {
+        threads.at(i)->quit();
+        threads.at(i)->wait();
+        delete threads.at(i);
+    }
+}
+
+CSMReactor * CSMReactor::instance()
+{
+    QMutexLocker locker(&reactorlock);
+
+    if (reactor == 0)
+    {
+        reactor = new CSMReactor(reactorsize);
+        qAddPostRoutine(CSMReactor::shutdown);
+    }
+
+    return reactor;
+}
+
+bool CSMReactor::setThreadCount(qint32 count)
+{
+    QMutexLocker locker(&reactorlock);
+
+    if ((reactor != 0) || (count < 1))
+        return false;
+
+    reactorsize = count;
+
+    return true;
+}
+
+void CSMReactor::shutdown()
+{
+    QMutexLocker locker(&reactorlock);
+
+    delete reactor;
+    reactor = 0;
+}
+
+QThread * CSMReactor::attach(QObject * worker)
+{
+    QMutexLocker locker(&lock);
+    qint32       least = 0;
+
+    for (qint32 i = 1; i < load.length(); i++)
+    {
+        if (load.at(i) < load.at(least))
+            least = i;
+    }
+
+    load[least]++;
+    worker->moveToThread(threads.at(least));
+
+    return threads.at(least);
+}
+
+void CSMReactor::detach(QThread * thread)
+{
+    QMutexLocker locker(&lock);
+    qint32       index = threads.indexOf(thread);
+
+    if (index >= 0)
+        load[index]--;
+}
+
+qint32 CSMReactor::threadCount() const
+{
+    return threads.length();
+}
@@ -0,0 +1,100 @@
+#ifndef CSMREACTOR_HPP
+#define CSMREACTOR_HPP
+
+/*! \file csmreactor.hpp
+ *  \brief Заголовочный файл общего пула потоков ввода-вывода проекта
+ * Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMReactor - пула потоков, в которых
+ * живут обработчики всех портов. Каждый поток ведет один цикл событий, а
+ * ожидание данных сразу на всех его портах выполняет диспетчер событий Qt
+ * (epoll/poll на *nix), поэтому число потоков не зависит от числа портов.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QThread>
+#include <QVector>
+#include <QMutex>
+
+/*!
+ *  \brief Число потоков пула по умолчанию
+ *
+ *  Одного потока достаточно для десятков портов: обработчики не блокируются и
+ * большую часть времени ждут данных.
+ */
+#define CT_REACTOR_THREADS 1
+
+/*!
+ *  \brief Пул потоков ввода-вывода, общий для всех экземпляров CSMCom
+ *
+ *  Потоки создаются при первом обращении и останавливаются при уничтожении
+ * QCoreApplication. Обработчик размещается в наименее загруженном потоке.
+ */
+class CSMReactor
+{
+public:
+    /*!
+     *  \brief Единственный экземпляр пула
+     */
+    static CSMReactor * instance();
+    /*!
+     *  \brief Установка числа потоков пула
+     *
+     *  Действует только до первого обращения к instance().
+     *  \param count Число потоков, от 1
+     *  \return Статус успешности установки
+     */
+    static bool setThreadCount(qint32 count);
+
+    /*!
+     *  \brief Размещение обработчика в одном из потоков пула
+     *
+     *  Объект не должен иметь родителя.
+     *  \param worker Обработчик
+     *  \return Поток, в который перемещен обработчик
+     */
+    QThread * attach(QObject * worker);
+    /*!
+     *  \brief Снятие обработчика с учета
+     *
+     *  Вызывается после того, как обработчик покинул поток пула.
+     *  \param thread Поток, выданный attach
+     */
+    void detach(QThread * thread);
+    /*!
+     *  \brief Число потоков пула
+     */
+    qint32 threadCount() const;
+
+private:
+    /*!
+     *  \brief Конструктор пула
+     *  \param count Число потоков
+     */
+    CSMReactor(qint32 count);
+    /*!
+     *  \brief Остановка потоков пула
+     */
+    ~CSMReactor();
+    /*!
+     *  \brief Уничтожение пула при завершении приложения
+     */
+    static void shutdown();
+
+    /*!
+     *  \brief Потоки пула
+     */
+    QVector<QThread *> threads;
+    /*!
+     *  \brief Число обработчиков в каждом потоке
+     */
+    QVector<qint32> load;
+    /*!
+     *  \brief Защита load
+     */
+    QMutex lock;
+};
+
+#endif // CSMREACTOR_HPP
@@ -0,0 +1,280 @@
+#include <QAtomicInt>
+#include <string.h>
+#include "csmscan.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CT_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* CSMByteSet */
+
+CSMByteSet::CSMByteSet()
+{
+    count = 0;
+    memset(bytes,  0, sizeof(bytes));
+    memset(member, 0, sizeof(member));
+}
+
+void CSMByteSet::insert(quint8 byte)
+{
+    if (member[byte])
+        return;
+
+    member[byte] = true;
+    if (count < CT_SCAN_MAXSET)
+        bytes[count] = byte;
+    count++;
+}
+
+/* Scalar */
+
+static qint32 findScalar(const char * data, qint32 length, quint8 byte)
+{
+    const char * found = (const char *)memchr(data, byte, length);
+
+    return (found != 0) ? (qint32)(found - data) : -1;
+}
+
+static qint32 findAnyScalar(const char * data, qint32 length,
+                            const CSMByteSet & set)
+{
+    for (qint32 i = 0; i < length; i++)
+    {
+        if (set.member[(quint8)data[i]])
+            return i;
+    }
+
+    return -1;
+}
+
+#ifdef CT_SCAN_X86
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static qint32 findSSE2(const char * data, qint32 length, quint8 byte)
+{
+    const __m128i needle = _mm_set1_epi8((char)byte);
+    qint32        i      = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        qint32  mask  = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    qint32 tail = findScalar(data + i, length - i, byte);
+
+    return (tail < 0) ? -1 : i + tail;
+}
+
+__attribute__((target("sse2")))
+static qint32 findAnySSE2(const char * data, qint32 length,
+                          const CSMByteSet & set)
+{
+    __m128i needles[CT_SCAN_MAXSET];
+    qint32  i = 0;
+
+    for (qint32 n = 0; n < set.count; n++)
+        needles[n] = _mm_set1_epi8((char)set.bytes[n]);
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits  = _mm_cmpeq_epi8(chunk, needles[0]);
+
+        for (qint32 n = 1; n < set.count; n++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[n]));
+
+        qint32 mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    qint32 tail = findAnyScalar(data + i, length - i, set);
+
+    return (tail < 0) ? -1 : i + tail;
+}
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static qint32 findAVX2(const char * data, qint32 length, quint8 byte)
+{
+    const __m256i needle = _mm256_set1_epi8((char)byte);
+    qint32        i      = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        quint32 mask  = (quint32)_mm256_movemask_epi8(
+                            _mm256_cmpeq_epi8(chunk, needle));
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    /* Finish in place: calling SSE2 code with dirty upper halves of the
+     * ymm registers costs more than the whole search */
+    if (i + 16 <= length)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        qint32  mask  = _mm_movemask_epi8(
+                            _mm_cmpeq_epi8(chunk,
+                                           _mm256_castsi256_si128(needle)));
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+
+    for (; i < length; i++)
+    {
+        if ((quint8)data[i] == byte)
+            return i;
+    }
+
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static qint32 findAnyAVX2(const char * data, qint32 length,
+                          const CSMByteSet & set)
+{
+    __m256i needles[CT_SCAN_MAXSET];
+    qint32  i = 0;
+
+    for (qint32 n = 0; n < set.count; n++)
+        needles[n] = _mm256_set1_epi8((char)set.bytes[n]);
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i hits  = _mm256_cmpeq_epi8(chunk, needles[0]);
+
+        for (qint32 n = 1; n < set.count; n++)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[n]));
+
+        quint32 mask = (quint32)_mm256_movemask_epi8(hits);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    if (i + 16 <= length)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits  = _mm_setzero_si128();
+
+        for (qint32 n = 0; n < set.count; n++)
+            hits = _mm_or_si128(hits,
+                                _mm_cmpeq_epi8(chunk,
+                                               _mm256_castsi256_si128(needles[n])));
+
+        qint32 mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+
+    for (; i < length; i++)
+    {
+        if (set.member[(quint8)data[i]])
+            return i;
+    }
+
+    return -1;
+}
+
+#endif // CT_SCAN_X86
+
+/* Dispatch */
+
+static CSMScan::Engine bestEngine()
+{
+#ifdef CT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return CSMScan::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return CSMScan::SSE2;
+#endif
+    return CSMScan::Scalar;
+}
+
+static QAtomicInt selected(CSMScan::Auto);
+
+static CSMScan::Engine currentEngine()
+{
+    qint32 engine = selected.loadAcquire();
+
+    if (engine == CSMScan::Auto)
+    {
+        static const CSMScan::Engine detected = bestEngine();
+
+        return detected;
+    }
+
+    return (CSMScan::Engine)engine;
+}
+
+qint32 CSMScan::find(const char * data, qint32 length, quint8 byte)
+{
+    /* libc memchr is vectorized already and beats the loops above */
+    if (selected.loadAcquire() == Auto)
+        return findScalar(data, length, byte);
+
+    switch (currentEngine())
+    {
+#ifdef CT_SCAN_X86
+    case AVX2:
+        return findAVX2(data, length, byte);
+    case SSE2:
+        return findSSE2(data, length, byte);
+#endif
+    default:
+        return findScalar(data, length, byte);
+    }
+}
+
+qint32 CSMScan::findAny(const char * data, qint32 length,
+                        const CSMByteSet & set)
+{
+    if (set.count == 0)
+        return -1;
+    if (set.count == 1)
+        return find(data, length, set.bytes[0]);
+    if (set.count > CT_SCAN_MAXSET)
+        return findAnyScalar(data, length, set);
+
+    switch (currentEngine())
+    {
+#ifdef CT_SCAN_X86
+    case AVX2:
+        return findAnyAVX2(data, length, set);
+    case SSE2:
+        return findAnySSE2(data, length, set);
+#endif
+    default:
+        return findAnyScalar(data, length, set);
+    }
+}
+
+CSMScan::Engine CSMScan::setEngine(Engine engine)
+{
+    Engine best = bestEngine();
+
+    if ((engine != Auto) && (engine > best))
+        engine = best;
+    selected.storeRelease(engine);
+
+    return currentEngine();
+}
+
+CSMScan::Engine CSMScan::engine()
+{
+    return currentEngine();
+}
@@ -0,0 +1,112 @@
+#ifndef CSMSCAN_HPP
+#define CSMSCAN_HPP
+
+/*! \file csmscan.hpp
+ *  \brief Заголовочный файл векторного поиска байт проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMScan - набора функций поиска
+ * байта или одного из нескольких байт в буфере. Реализация выбирается при
+ * первом вызове по возможностям процессора: AVX2 (32 байта за шаг),
+ * SSE2 (16 байт за шаг) или скалярный вариант для остальных платформ.
+ * Поиск одного байта в автоматическом режиме выполняется через memchr,
+ * который векторизован в стандартной библиотеке.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QtGlobal>
+
+/*!
+ *  \brief Максимальное число байт в наборе для векторного поиска
+ *
+ *  Наборы большего размера ищутся скалярно по таблице.
+ */
+#define CT_SCAN_MAXSET 8
+
+/*!
+ *  \brief Набор искомых байт
+ */
+struct CSMByteSet
+{
+    /*!
+     *  \brief Искомые байты
+     */
+    quint8 bytes[CT_SCAN_MAXSET];
+    /*!
+     *  \brief Число байт в наборе. Значение больше CT_SCAN_MAXSET означает,
+     * что поиск выполняется только по таблице member.
+     */
+    qint32 count;
+    /*!
+     *  \brief Таблица принадлежности байта набору
+     */
+    bool   member[256];
+
+    /*!
+     *  \brief Конструктор пустого набора
+     */
+    CSMByteSet();
+    /*!
+     *  \brief Добавление байта в набор
+     *  \param byte Байт
+     */
+    void insert(quint8 byte);
+};
+
+/*!
+ *  \brief Векторный поиск байт в буфере
+ */
+class CSMScan
+{
+public:
+    /*!
+     *  \brief Используемая реализация
+     *
+     *  В режиме Auto find всегда вызывает memchr (как Scalar): libc уже
+     * векторизует его, и он быстрее собственных циклов. По возможностям
+     * процессора выбирается только реализация findAny.
+     */
+    enum Engine
+    {
+        Auto,   //!< memchr для find, выбор по процессору для findAny
+        Scalar, //!< memchr для find, побайтовый перебор для findAny
+        SSE2,   //!< 16 байт за шаг
+        AVX2    //!< 32 байта за шаг
+    };
+
+    /*!
+     *  \brief Поиск первого вхождения байта
+     *  \param data Буфер
+     *  \param length Длина буфера
+     *  \param byte Искомый байт
+     *  \return Индекс вхождения или -1
+     */
+    static qint32 find(const char * data, qint32 length, quint8 byte);
+    /*!
+     *  \brief Поиск первого вхождения любого байта из набора
+     *  \param data Буфер
+     *  \param length Длина буфера
+     *  \param set Набор искомых байт
+     *  \return Индекс вхождения или -1
+     */
+    static qint32 findAny(const char * data, qint32 length,
+                          const CSMByteSet & set);
+    /*!
+     *  \brief Принудительный выбор реализации
+     *
+     *  Используется для сравнения реализаций. Если процессор не поддерживает
+     * запрошенную реализацию, выбирается лучшая из доступных.
+     *  \param engine Реализация
+     *  \return Фактически выбранная реализация
+     */
+    static Engine setEngine(Engine engine);
+    /*!
+     *  \brief Текущая реализация findAny
+     *
+     *  В режиме Auto find при этом использует memchr, см. Engine.
+     */
+    static Engine engine();
+};
+
+#endif // CSMSCAN_HPP
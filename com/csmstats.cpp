@@ -0,0 +1,189 @@
+#include <string.h>
+#include "csmstats.hpp"
+
+/* Single writer: a plain load and store is enough, no locked add needed */
+static inline void bump(QAtomicInteger<quint64> & counter, quint64 value)
+{
+    counter.store(counter.load() + value);
+}
+
+static inline qint32 ruleSlot(qint32 rule)
+{
+    return qMin(rule, CT_STATS_RULES - 1);
+}
+
+/* CSMHistogram */
+
+CSMHistogram::CSMHistogram()
+{
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    total = 0;
+}
+
+quint64 CSMHistogram::percentile(qreal quantile) const
+{
+    if (count == 0)
+        return 0;
+
+    quint64 rank = (quint64)(quantile * count);
+    quint64 seen = 0;
+
+    if (rank >= count)
+        rank = count - 1;
+    for (qint32 i = 0; i < CT_STATS_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen > rank)
+            return ((quint64)1 << (i + 1)) - 1;
+    }
+
+    return ((quint64)1 << CT_STATS_BUCKETS) - 1;
+}
+
+quint64 CSMHistogram::mean() const
+{
+    return (count > 0) ? (total / count) : 0;
+}
+
+/* CSMStatistics */
+
+CSMStatistics::CSMStatistics()
+{
+    bytesread      = 0;
+    byteswritten   = 0;
+    writecalls     = 0;
+    coalesced      = 0;
+    frames         = 0;
+    timeouts       = 0;
+    expired        = 0;
+    dropped        = 0;
+    overflows      = 0;
+    invalid        = 0;
+    queuedepth     = 0;
+    queuehighwater = 0;
+    unframed       = 0;
+    poolhits       = 0;
+    poolmisses     = 0;
+    memset(beginframes, 0, sizeof(beginframes));
+    memset(endframes,   0, sizeof(endframes));
+}
+
+/* CSMAtomicHistogram */
+
+void CSMAtomicHistogram::add(qint64 nsecs)
+{
+    qint32  index = 0;
+    quint64 value = (nsecs > 0) ? nsecs : 0;
+
+    while ((value >>= 1) != 0)
+        index++;
+
+    bump(buckets[qMin(index, CT_STATS_BUCKETS - 1)], 1);
+    bump(count, 1);
+    bump(total, (nsecs > 0) ? nsecs : 0);
+}
+
+void CSMAtomicHistogram::snapshot(CSMHistogram * histogram) const
+{
+    for (qint32 i = 0; i < CT_STATS_BUCKETS; i++)
+        histogram->buckets[i] = buckets[i].load();
+    histogram->count = count.load();
+    histogram->total = total.load();
+}
+
+/* CSMStatCounters */
+
+void CSMStatCounters::addRead(qint64 bytes)
+{
+    bump(bytesread, bytes);
+}
+
+void CSMStatCounters::addWritten(qint64 bytes)
+{
+    bump(byteswritten, bytes);
+}
+
+void CSMStatCounters::addWriteCall(qint32 messages)
+{
+    bump(writecalls, 1);
+    bump(coalesced, messages - 1);
+}
+
+void CSMStatCounters::addFrame(qint32 beginrule, qint32 endrule)
+{
+    bump(frames, 1);
+    if (beginrule >= 0)
+        bump(beginframes[ruleSlot(beginrule)], 1);
+    if (endrule >= 0)
+        bump(endframes[ruleSlot(endrule)], 1);
+}
+
+void CSMStatCounters::addTimeout()
+{
+    bump(timeouts, 1);
+}
+
+void CSMStatCounters::addExpired()
+{
+    bump(expired, 1);
+}
+
+void CSMStatCounters::addOverflow()
+{
+    bump(overflows, 1);
+}
+
+void CSMStatCounters::addInvalid()
+{
+    bump(invalid, 1);
+}
+
+void CSMStatCounters::setQueueDepth(qint32 depth)
+{
+    queuedepth.store(depth);
+    if ((quint64)depth > queuehighwater.load())
+        queuehighwater.store(depth);
+}
+
+void CSMStatCounters::setUnframed(qint32 bytes)
+{
+    unframed.store(bytes);
+}
+
+void CSMStatCounters::addMatcherTime(qint64 nsecs)
+{
+    matchertime.add(nsecs);
+}
+
+void CSMStatCounters::addRoundTrip(qint64 nsecs)
+{
+    roundtrip.add(nsecs);
+}
+
+CSMStatistics CSMStatCounters::snapshot() const
+{
+    CSMStatistics stats;
+
+    stats.bytesread      = bytesread.load();
+    stats.byteswritten   = byteswritten.load();
+    stats.writecalls     = writecalls.load();
+    stats.coalesced      = coalesced.load();
+    stats.frames         = frames.load();
+    stats.timeouts       = timeouts.load();
+    stats.expired        = expired.load();
+    stats.overflows      = overflows.load();
+    stats.invalid        = invalid.load();
+    stats.queuedepth     = queuedepth.load();
+    stats.queuehighwater = queuehighwater.load();
+    stats.unframed       = unframed.load();
+    for (qint32 i = 0; i < CT_STATS_RULES; i++)
+    {
+        stats.beginframes[i] = beginframes[i].load();
+        stats.endframes[i]   = endframes[i].load();
+    }
+    matchertime.snapshot(&stats.matchertime);
+    roundtrip.snapshot(&stats.roundtrip);
+
+    return stats;
+}
@@ -0,0 +1,291 @@
+#ifndef CSMSTATS_HPP
+#define CSMSTATS_HPP
+
+/*! \file csmstats.hpp
+ *  \brief Заголовочный файл статистики работы порта проекта Cosmic Turtle
+ *
+ * Данный файл содержит описание снимка статистики CSMStatistics и сигнатуру
+ * класса CSMStatCounters - счетчиков, которые обработчик порта обновляет на
+ * каждом чтении и записи.
+ *
+ *  Счетчики атомарные: поток ввода-вывода обновляет их без блокировок, любой
+ * другой поток в любой момент может снять снимок. Снимок не является
+ * согласованным срезом всех счетчиков сразу - каждый счетчик читается
+ * отдельно, - но ни одно значение не бывает "порванным".
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QAtomicInteger>
+#include <QMetaType>
+
+/*!
+ *  \brief Число корзин гистограммы
+ *
+ *  Корзина i содержит значения из [2^i, 2^(i+1)) нс, последняя корзина -
+ * все значения от 2^(CT_STATS_BUCKETS-1) нс (около 2 с) и больше.
+ */
+#define CT_STATS_BUCKETS 32
+/*!
+ *  \brief Число правил, для которых пакеты считаются отдельно
+ *
+ *  Пакеты правил с большими индексами учитываются в последней ячейке.
+ */
+#define CT_STATS_RULES   8
+
+/*!
+ *  \brief Снимок гистограммы времени
+ */
+struct CSMHistogram
+{
+    /*!
+     *  \brief Число значений по корзинам
+     */
+    quint64 buckets[CT_STATS_BUCKETS];
+    /*!
+     *  \brief Число значений
+     */
+    quint64 count;
+    /*!
+     *  \brief Сумма значений, нс
+     */
+    quint64 total;
+
+    /*!
+     *  \brief Конструктор пустой гистограммы
+     */
+    CSMHistogram();
+    /*!
+     *  \brief Оценка квантиля
+     *  \param quantile Квантиль от 0 до 1
+     *  \return Верхняя граница корзины, в которую попал квантиль, нс. 0 -
+     * значений нет.
+     */
+    quint64 percentile(qreal quantile) const;
+    /*!
+     *  \brief Среднее значение, нс
+     */
+    quint64 mean() const;
+};
+
+/*!
+ *  \brief Снимок статистики порта
+ *
+ *  Все счетчики накопительные с момента создания CSMCom.
+ */
+struct CSMStatistics
+{
+    /*!
+     *  \brief Прочитано байт из порта
+     */
+    quint64 bytesread;
+    /*!
+     *  \brief Записано байт в порт
+     */
+    quint64 byteswritten;
+    /*!
+     *  \brief Вызовы записи в порт
+     */
+    quint64 writecalls;
+    /*!
+     *  \brief Сообщения, записанные одним вызовом с предыдущими, - число
+     * сэкономленных вызовов записи
+     */
+    quint64 coalesced;
+    /*!
+     *  \brief Выделено пакетов
+     */
+    quint64 frames;
+    /*!
+     *  \brief Пакеты по индексу правила начала (если правила начала заданы)
+     */
+    quint64 beginframes[CT_STATS_RULES];
+    /*!
+     *  \brief Пакеты по индексу правила конца
+     */
+    quint64 endframes[CT_STATS_RULES];
+    /*!
+     *  \brief Запросы, не дождавшиеся ответа
+     */
+    quint64 timeouts;
+    /*!
+     *  \brief Сообщения, срок которых истек до отправки
+     */
+    quint64 expired;
+    /*!
+     *  \brief Сообщения, отброшенные при переполнении очереди отправки
+     */
+    quint64 dropped;
+    /*!
+     *  \brief Незавершенные пакеты, отброшенные при переполнении буфера
+     */
+    quint64 overflows;
+    /*!
+     *  \brief Пакеты с неверной контрольной суммой
+     */
+    quint64 invalid;
+    /*!
+     *  \brief Текущее число сообщений в очереди отправки
+     */
+    quint64 queuedepth;
+    /*!
+     *  \brief Наибольшее число сообщений в очереди отправки
+     */
+    quint64 queuehighwater;
+    /*!
+     *  \brief Байты в приемном буфере, еще не вошедшие в пакет
+     */
+    quint64 unframed;
+    /*!
+     *  \brief Пакеты и сообщения, размещенные в буферах пула без выделения
+     * памяти
+     */
+    quint64 poolhits;
+    /*!
+     *  \brief Пакеты и сообщения, для которых выделялась память
+     */
+    quint64 poolmisses;
+    /*!
+     *  \brief Время выделения пакетов из одной порции данных порта
+     *
+     *  Только поиск пакетов в CSMFramer: снятие стаффинга, проверка
+     * контрольной суммы, обработчик setFrameCallback и испускание сигналов не
+     * входят.
+     */
+    CSMHistogram matchertime;
+    /*!
+     *  \brief Время от отправки запроса до получения ответа
+     */
+    CSMHistogram roundtrip;
+
+    /*!
+     *  \brief Конструктор нулевого снимка
+     */
+    CSMStatistics();
+};
+Q_DECLARE_METATYPE(CSMStatistics)
+
+/*!
+ *  \brief Атомарная гистограмма времени
+ */
+class CSMAtomicHistogram
+{
+public:
+    /*!
+     *  \brief Учет значения
+     *  \param nsecs Значение, нс
+     */
+    void add(qint64 nsecs);
+    /*!
+     *  \brief Снимок гистограммы
+     *  \param histogram (out) Снимок
+     */
+    void snapshot(CSMHistogram * histogram) const;
+
+private:
+    /*!
+     *  \brief Число значений по корзинам
+     */
+    QAtomicInteger<quint64> buckets[CT_STATS_BUCKETS];
+    /*!
+     *  \brief Число значений
+     */
+    QAtomicInteger<quint64> count;
+    /*!
+     *  \brief Сумма значений, нс
+     */
+    QAtomicInteger<quint64> total;
+};
+
+/*!
+ *  \brief Счетчики статистики порта
+ *
+ *  Обновляются только обработчиком порта (CSMSpinner), читаются функцией
+ * snapshot из любого потока. Писатель у счетчиков один, поэтому обновление -
+ * это обычные чтение и запись без блокирующих инструкций процессора.
+ */
+class CSMStatCounters
+{
+public:
+    /*!
+     *  \brief Учет прочитанных байт
+     */
+    void addRead(qint64 bytes);
+    /*!
+     *  \brief Учет записанных байт
+     */
+    void addWritten(qint64 bytes);
+    /*!
+     *  \brief Учет вызова записи в порт
+     *  \param messages Число сообщений, записанных вызовом
+     */
+    void addWriteCall(qint32 messages);
+    /*!
+     *  \brief Учет выделенного пакета
+     *  \param beginrule Индекс правила начала, -1 - нет
+     *  \param endrule Индекс правила конца, -1 - нет
+     */
+    void addFrame(qint32 beginrule, qint32 endrule);
+    /*!
+     *  \brief Учет запроса, не дождавшегося ответа
+     */
+    void addTimeout();
+    /*!
+     *  \brief Учет сообщения с истекшим сроком
+     */
+    void addExpired();
+    /*!
+     *  \brief Учет отброшенного при переполнении пакета
+     */
+    void addOverflow();
+    /*!
+     *  \brief Учет пакета с неверной контрольной суммой
+     */
+    void addInvalid();
+    /*!
+     *  \brief Обновление длины очереди отправки
+     *  \param depth Текущая длина
+     */
+    void setQueueDepth(qint32 depth);
+    /*!
+     *  \brief Обновление числа байт в буфере вне пакетов
+     *  \param bytes Число байт
+     */
+    void setUnframed(qint32 bytes);
+    /*!
+     *  \brief Учет времени выделения пакетов
+     */
+    void addMatcherTime(qint64 nsecs);
+    /*!
+     *  \brief Учет времени ответа
+     */
+    void addRoundTrip(qint64 nsecs);
+    /*!
+     *  \brief Снимок всех счетчиков
+     */
+    CSMStatistics snapshot() const;
+
+private:
+    /*!
+     *  \brief Счетчики, см. одноименные поля CSMStatistics
+     */
+    QAtomicInteger<quint64> bytesread;
+    QAtomicInteger<quint64> byteswritten;
+    QAtomicInteger<quint64> writecalls;
+    QAtomicInteger<quint64> coalesced;
+    QAtomicInteger<quint64> frames;
+    QAtomicInteger<quint64> beginframes[CT_STATS_RULES];
+    QAtomicInteger<quint64> endframes[CT_STATS_RULES];
+    QAtomicInteger<quint64> timeouts;
+    QAtomicInteger<quint64> expired;
+    QAtomicInteger<quint64> overflows;
+    QAtomicInteger<quint64> invalid;
+    QAtomicInteger<quint64> queuedepth;
+    QAtomicInteger<quint64> queuehighwater;
+    QAtomicInteger<quint64> unframed;
+    CSMAtomicHistogram      matchertime;
+    CSMAtomicHistogram      roundtrip;
+};
+
+#endif // CSMSTATS_HPP
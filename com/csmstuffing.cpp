@@ -0,0 +1,250 @@
+#include <string.h>
+#include "csmstuffing.hpp"
+#include "csmscan.hpp"
+
+/*!
+ *  \brief Набор байт, требующих замены при кодировании
+ */
+static CSMByteSet makeSpecials(quint8 first, quint8 second)
+{
+    CSMByteSet set;
+
+    set.insert(first);
+    set.insert(second);
+
+    return set;
+}
+
+/*!
+ *  \brief Кодирование SLIP или HDLC: флаг, данные с заменами, флаг
+ */
+static void escapeFrame(CSMStuffing::Mode mode, const QByteArray & bytes,
+                        QByteArray * out)
+{
+    static const CSMByteSet slip = makeSpecials(CT_SLIP_END, CT_SLIP_ESC);
+    static const CSMByteSet hdlc = makeSpecials(CT_HDLC_FLAG, CT_HDLC_ESC);
+
+    const CSMByteSet & specials = (mode == CSMStuffing::Slip) ? slip : hdlc;
+    quint8             flag     = CSMStuffing::delimiter(mode);
+    const char       * data     = bytes.constData();
+    qint32             length   = bytes.length();
+    qint32             position = 0;
+
+    out->resize(length * 2 + 2);
+
+    char * cursor = out->data();
+
+    *cursor++ = flag;
+    while (position < length)
+    {
+        qint32 found = CSMScan::findAny(data + position, length - position,
+                                        specials);
+        qint32 run   = (found < 0) ? (length - position) : found;
+
+        memcpy(cursor, data + position, run);
+        cursor   += run;
+        position += run;
+        if (found < 0)
+            break;
+
+        quint8 byte = data[position++];
+        if (mode == CSMStuffing::Slip)
+        {
+            *cursor++ = CT_SLIP_ESC;
+            *cursor++ = (byte == CT_SLIP_END) ? CT_SLIP_ESCEND : CT_SLIP_ESCESC;
+        }
+        else
+        {
+            *cursor++ = CT_HDLC_ESC;
+            *cursor++ = byte ^ CT_HDLC_XOR;
+        }
+    }
+    *cursor++ = flag;
+
+    out->resize(cursor - out->constData());
+}
+
+/*!
+ *  \brief Декодирование SLIP или HDLC
+ */
+static bool unescapeFrame(CSMStuffing::Mode mode, const char * data,
+                          qint32 length, QByteArray * out)
+{
+    quint8 escape   = (mode == CSMStuffing::Slip) ? CT_SLIP_ESC : CT_HDLC_ESC;
+    qint32 position = 0;
+
+    out->resize(length);
+
+    char * cursor = out->data();
+
+    while (position < length)
+    {
+        qint32 found = CSMScan::find(data + position, length - position,
+                                     escape);
+        qint32 run   = (found < 0) ? (length - position) : found;
+
+        memcpy(cursor, data + position, run);
+        cursor   += run;
+        position += run;
+        if (found < 0)
+            break;
+
+        /* An escape must be followed by a byte it applies to */
+        if (++position >= length)
+            return false;
+
+        quint8 byte = data[position++];
+        if (mode == CSMStuffing::Slip)
+        {
+            if (byte == CT_SLIP_ESCEND)
+                *cursor++ = (char)CT_SLIP_END;
+            else if (byte == CT_SLIP_ESCESC)
+                *cursor++ = (char)CT_SLIP_ESC;
+            else
+                return false;
+        }
+        else
+        {
+            *cursor++ = byte ^ CT_HDLC_XOR;
+        }
+    }
+
+    out->resize(cursor - out->constData());
+
+    return true;
+}
+
+/*!
+ *  \brief Кодирование COBS с завершающим нулем
+ */
+static void encodeCobs(const QByteArray & bytes, QByteArray * out)
+{
+    const char * data     = bytes.constData();
+    qint32       length   = bytes.length();
+    qint32       position = 0;
+
+    out->resize(length + length / CT_COBS_BLOCK + 2);
+
+    char * cursor = out->data();
+
+    for (;;)
+    {
+        qint32 window = qMin(CT_COBS_BLOCK, length - position);
+        qint32 found  = CSMScan::find(data + position, window, 0);
+        qint32 run    = (found < 0) ? window : found;
+
+        *cursor++ = (char)(run + 1);
+        memcpy(cursor, data + position, run);
+        cursor   += run;
+        position += run;
+
+        if (found >= 0)
+        {
+            /* The zero is implied by the block code */
+            position++;
+            if (position == length)
+            {
+                *cursor++ = 1;
+                break;
+            }
+        }
+        else if ((run < CT_COBS_BLOCK) || (position == length))
+        {
+            break;
+        }
+    }
+    *cursor++ = 0;
+
+    out->resize(cursor - out->constData());
+}
+
+/*!
+ *  \brief Декодирование COBS
+ */
+static bool decodeCobs(const char * data, qint32 length, QByteArray * out)
+{
+    qint32 position = 0;
+
+    out->resize(length);
+
+    char * cursor = out->data();
+
+    while (position < length)
+    {
+        quint8 code = data[position++];
+        qint32 run  = code - 1;
+
+        if ((code == 0) || (position + run > length))
+            return false;
+
+        memcpy(cursor, data + position, run);
+        cursor   += run;
+        position += run;
+        if ((code != CT_COBS_BLOCK + 1) && (position < length))
+            *cursor++ = 0;
+    }
+
+    out->resize(cursor - out->constData());
+
+    return true;
+}
+
+quint8 CSMStuffing::delimiter(Mode mode)
+{
+    switch (mode)
+    {
+    case Slip:
+        return CT_SLIP_END;
+    case Hdlc:
+        return CT_HDLC_FLAG;
+    default:
+        return 0;
+    }
+}
+
+PreceptSet CSMStuffing::rules(Mode mode)
+{
+    PreceptSet set;
+
+    if (mode != None)
+    {
+        PreceptArray end;
+        end.append(PreceptByte(true, delimiter(mode)));
+        set.append(end);
+    }
+
+    return set;
+}
+
+void CSMStuffing::encode(Mode mode, const QByteArray & bytes, QByteArray * out)
+{
+    switch (mode)
+    {
+    case Slip:
+    case Hdlc:
+        escapeFrame(mode, bytes, out);
+        break;
+    case Cobs:
+        encodeCobs(bytes, out);
+        break;
+    default:
+        *out = bytes;
+        break;
+    }
+}
+
+bool CSMStuffing::decode(Mode mode, const char * data, qint32 length,
+                         QByteArray * out)
+{
+    switch (mode)
+    {
+    case Slip:
+    case Hdlc:
+        return unescapeFrame(mode, data, length, out);
+    case Cobs:
+        return decodeCobs(data, length, out);
+    default:
+        *out = QByteArray(data, length);
+        return true;
+    }
+}
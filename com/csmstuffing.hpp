@@ -0,0 +1,100 @@
+#ifndef CSMSTUFFING_HPP
+#define CSMSTUFFING_HPP
+
+/*! \file csmstuffing.hpp
+ *  \brief Заголовочный файл кодеков байт-стаффинга проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMStuffing - кодеков протоколов,
+ * в которых пакеты разделяются байтом-флагом, а вхождения флага в данные
+ * заменяются escape-последовательностями (SLIP, HDLC) или исключаются
+ * перекодированием (COBS).
+ *
+ *  Граница пакета - байт-флаг, поэтому пакеты выделяет обычный CSMFramer с
+ * единственным правилом конца из одного байта (его участки между флагами
+ * пропускаются векторным поиском). Кодек только снимает и накладывает
+ * стаффинг: участки между escape-байтами копируются целиком, сами
+ * escape-байты ищутся векторным поиском CSMScan.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QByteArray>
+
+#include "csmframer.hpp"
+
+/*!
+ *  \brief Флаг конца пакета SLIP
+ */
+#define CT_SLIP_END     0xC0
+/*!
+ *  \brief Escape-байт SLIP и его замены
+ */
+#define CT_SLIP_ESC     0xDB
+#define CT_SLIP_ESCEND  0xDC
+#define CT_SLIP_ESCESC  0xDD
+/*!
+ *  \brief Флаг пакета HDLC
+ */
+#define CT_HDLC_FLAG    0x7E
+/*!
+ *  \brief Escape-байт HDLC. Следующий за ним байт сложен с CT_HDLC_XOR.
+ */
+#define CT_HDLC_ESC     0x7D
+#define CT_HDLC_XOR     0x20
+/*!
+ *  \brief Наибольшая длина блока COBS без нулевого байта
+ */
+#define CT_COBS_BLOCK   254
+
+/*!
+ *  \brief Кодеки байт-стаффинга
+ */
+class CSMStuffing
+{
+public:
+    /*!
+     *  \brief Протокол
+     */
+    enum Mode
+    {
+        None, //!< Стаффинг не используется
+        Slip, //!< RFC 1055: флаг C0, escape DB
+        Hdlc, //!< RFC 1662 (асинхронный HDLC): флаг 7E, escape 7D
+        Cobs  //!< Consistent Overhead Byte Stuffing, разделитель 00
+    };
+
+    /*!
+     *  \brief Байт-флаг, завершающий пакет
+     *  \param mode Протокол
+     */
+    static quint8 delimiter(Mode mode);
+    /*!
+     *  \brief Правила конца пакета для CSMMatcher
+     *  \param mode Протокол
+     *  \return Одно правило из байта-флага; пустой набор для None
+     */
+    static PreceptSet rules(Mode mode);
+    /*!
+     *  \brief Кодирование пакета для передачи
+     *
+     *  SLIP и HDLC пакет обрамляется флагами с обеих сторон: начальный флаг
+     * отделяет пакет от помех в линии. COBS пакет завершается нулевым байтом.
+     *  \param mode Протокол
+     *  \param bytes Пакет
+     *  \param out (out) Закодированный пакет. Память переиспользуется.
+     */
+    static void encode(Mode mode, const QByteArray & bytes, QByteArray * out);
+    /*!
+     *  \brief Декодирование принятого пакета
+     *  \param mode Протокол
+     *  \param data Пакет без завершающего флага
+     *  \param length Длина пакета
+     *  \param out (out) Декодированный пакет. Память переиспользуется.
+     *  \return false, если пакет содержит недопустимую последовательность
+     */
+    static bool decode(Mode mode, const char * data, qint32 length,
+                       QByteArray * out);
+};
+
+#endif // CSMSTUFFING_HPP
@@ -0,0 +1,75 @@
+#include "csmtransport.hpp"
+
+/* CSMTransport */
+
+CSMTransport::CSMTransport(QObject * parent) : QObject(parent)
+{
+
+}
+
+CSMTransport::~CSMTransport()
+{
+
+}
+
+QSerialPort * CSMTransport::serialPort()
+{
+    return 0;
+}
+
+/* CSMSerialTransport */
+
+CSMSerialTransport::CSMSerialTransport(QObject * parent) : CSMTransport(parent)
+{
+    port = new QSerialPort(this);
+    connect(port, SIGNAL(readyRead()),
+            this, SIGNAL(readyRead()));
+}
+
+bool CSMSerialTransport::open(QString name)
+{
+    port->close();
+    port->setPortName(name);
+
+    return port->open(QIODevice::ReadWrite);
+}
+
+void CSMSerialTransport::close()
+{
+    port->close();
+}
+
+bool CSMSerialTransport::isOpen() const
+{
+    return port->isOpen();
+}
+
+QString CSMSerialTransport::name() const
+{
+    return port->portName();
+}
+
+qint64 CSMSerialTransport::bytesAvailable()
+{
+    return port->bytesAvailable();
+}
+
+qint64 CSMSerialTransport::read(char * data, qint64 maxlength)
+{
+    return port->read(data, maxlength);
+}
+
+qint64 CSMSerialTransport::write(const QByteArray & bytes)
+{
+    return port->write(bytes);
+}
+
+qint32 CSMSerialTransport::baudRate() const
+{
+    return port->baudRate();
+}
+
+QSerialPort * CSMSerialTransport::serialPort()
+{
+    return port;
+}
@@ -0,0 +1,136 @@
+#ifndef CSMTRANSPORT_HPP
+#define CSMTRANSPORT_HPP
+
+/*! \file csmtransport.hpp
+ *  \brief Заголовочный файл транспортного уровня проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру абстрактного класса CSMTransport - канала
+ * байт, поверх которого работают CSMCom и CSMSpinner, - и его реализации
+ * CSMSerialTransport на основе QSerialPort.
+ *
+ *  Выделение пакетов, очередь и таймауты не зависят от того, откуда приходят
+ * байты, поэтому их можно проверять без COM-порта (см. CSMPtyTransport).
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QSerialPort>
+
+/*!
+ *  \brief Канал передачи байт
+ *
+ *  Объект живет в потоке ввода-вывода и вызывается только из него. О новых
+ * данных сообщает сигналом readyRead.
+ */
+class CSMTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Конструктор класса
+     *  \param parent Родитель
+     */
+    CSMTransport(QObject * parent = 0);
+    /*!
+     *  \brief Деструктор класса
+     */
+    virtual ~CSMTransport();
+
+    /*!
+     *  \brief Открытие канала по имени
+     *
+     *  Если канал был открыт, он предварительно закрывается.
+     *  \param name Имя устройства
+     *  \return Статус успешности открытия
+     */
+    virtual bool open(QString name) = 0;
+    /*!
+     *  \brief Закрытие канала
+     */
+    virtual void close() = 0;
+    /*!
+     *  \brief Флаг открытого канала
+     */
+    virtual bool isOpen() const = 0;
+    /*!
+     *  \brief Имя устройства
+     */
+    virtual QString name() const = 0;
+    /*!
+     *  \brief Число байт, которые можно прочитать без ожидания
+     */
+    virtual qint64 bytesAvailable() = 0;
+    /*!
+     *  \brief Чтение данных
+     *  \param data Буфер
+     *  \param maxlength Размер буфера
+     *  \return Число прочитанных байт, -1 при ошибке
+     */
+    virtual qint64 read(char * data, qint64 maxlength) = 0;
+    /*!
+     *  \brief Запись данных
+     *
+     *  Не блокирует: то, что не удалось передать сразу, передается позже.
+     *  \param bytes Данные
+     *  \return Число принятых к передаче байт, -1 при ошибке
+     */
+    virtual qint64 write(const QByteArray & bytes) = 0;
+    /*!
+     *  \brief Скорость линии
+     *  \return Скорость в бодах, 0 - у канала нет скорости линии
+     */
+    virtual qint32 baudRate() const = 0;
+    /*!
+     *  \brief Последовательный порт, лежащий в основе канала
+     *
+     *  Через него CSMCom настраивает параметры линии.
+     *  \return Порт или 0, если канал не является последовательным портом
+     */
+    virtual QSerialPort * serialPort();
+
+signals:
+    /*!
+     *  \brief Сигнал поступления данных
+     */
+    void readyRead();
+};
+
+/*!
+ *  \brief Канал на основе QSerialPort
+ */
+class CSMSerialTransport : public CSMTransport
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Конструктор класса
+     *
+     *  Порт создается закрытым.
+     *  \param parent Родитель
+     */
+    CSMSerialTransport(QObject * parent = 0);
+
+    bool open(QString name);
+    void close();
+    bool isOpen() const;
+    QString name() const;
+    qint64 bytesAvailable();
+    qint64 read(char * data, qint64 maxlength);
+    qint64 write(const QByteArray & bytes);
+    qint32 baudRate() const;
+    QSerialPort * serialPort();
+
+private:
+    /*!
+     *  \brief Порт
+     */
+    QSerialPort * port;
+};
+
+#endif // CSMTRANSPORT_HPP
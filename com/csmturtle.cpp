@@ -7,31 +7,62 @@ const QString CT_DATABITS_ERROR = QString(QObject::tr("Data bits hasn't been set
 const QString CT_STOPBITS_ERROR = QString(QObject::tr("Stop bits hasn't been set."));
 const QString CT_FLOWSET_ERROR  = QString(QObject::tr("Flow control hasn't been set."));
 const QString CT_CANTOPEN_ERROR = QString(QObject::tr("Port hasn't been opened"));
+const QString CT_RULES_ERROR    = QString(QObject::tr("Sequence rules are too complex."));
+const QString CT_OVERFLOW_ERROR = QString(QObject::tr("Receive buffer overflow, partial packet dropped."));
+const QString CT_NOTSERIAL_ERROR = QString(QObject::tr("Transport is not a serial port."));
+const QString CT_LENGTHFIELD_ERROR = QString(QObject::tr("Length field is invalid."));
+const QString CT_CHECKSUMSET_ERROR = QString(QObject::tr("Checksum parameters are invalid."));
+const QString CT_CHECKSUM_ERROR = QString(QObject::tr("Checksum mismatch, packet dropped."));
+const QString CT_STUFFING_ERROR = QString(QObject::tr("Invalid escape sequence, packet dropped."));
+const QString CT_QUEUEFULL_ERROR = QString(QObject::tr("Send queue is full, message rejected."));
+
+/* CSMCorrelation */
+
+bool CSMCorrelation::isEnabled() const
+{
+    return ((length > 0) || ((requestkey) && (responsekey)));
+}
+
+QByteArray CSMCorrelation::requestKey(const QByteArray & request) const
+{
+    if (requestkey)
+        return requestkey(request);
+    if (request.length() < requestoffset + length)
+        return QByteArray();
+
+    return request.mid(requestoffset, length);
+}
+
+QByteArray CSMCorrelation::responseKey(const QByteArray & response) const
+{
+    if (responsekey)
+        return responsekey(response);
+    if (response.length() < responseoffset + length)
+        return QByteArray();
+
+    return response.mid(responseoffset, length);
+}
 
 /* CSMCom */
 
 CSMCom::CSMCom(QString portName, qint32 baudRate)
 {
-    beginseq.clear();
+    CSMSerialTransport * serial = new CSMSerialTransport();
 
-    PreceptSet endset;
-    PreceptArray endarr;
-    endarr.append(CT_DEFAULT_ENDSEQ);
-    endset.append(endarr);
-    endseq.append(endset);
-    tpb = CT_DEFAULT_TPB;
-    port.setPortName(portName);
-    if (port.open(QIODevice::ReadWrite))
+    port = serial;
+    if (serial->open(portName))
     {
-        if (!port.setBaudRate(baudRate))
+        QSerialPort * line = serial->serialPort();
+
+        if (!line->setBaudRate(baudRate))
             emit logWarning(CT_BAUDRATE_ERROR);
-        if (!port.setParity(QSerialPort::NoParity))
+        if (!line->setParity(QSerialPort::NoParity))
             emit logWarning(CT_PARITY_ERROR);
-        if (!port.setDataBits(QSerialPort::Data8))
+        if (!line->setDataBits(QSerialPort::Data8))
             emit logWarning(CT_DATABITS_ERROR);
-        if (!port.setStopBits(QSerialPort::OneStop))
+        if (!line->setStopBits(QSerialPort::OneStop))
             emit logWarning(CT_STOPBITS_ERROR);
-        if (!port.setFlowControl(QSerialPort::NoFlowControl))
+        if (!line->setFlowControl(QSerialPort::NoFlowControl))
             emit logWarning(CT_FLOWSET_ERROR);
     }
     else
@@ -39,40 +70,257 @@ CSMCom::CSMCom(QString portName, qint32 baudRate)
         emit logWarning(CT_CANTOPEN_ERROR);
     }
 
-    spinner = new CSMSpinner(&port, &beginseq, &endseq, &tpb, this);
-    connect(spinner, SIGNAL(finished()),
-            spinner, SLOT(deleteLater()));
+    start();
+}
+
+CSMCom::CSMCom(CSMTransport * transport)
+{
+    port = transport;
+    if (!port->isOpen())
+        emit logWarning(CT_CANTOPEN_ERROR);
+
+    start();
+}
+
+void CSMCom::start()
+{
+    CSMConfig  * initial = new CSMConfig();
+    PreceptArray endarr;
+    endarr.append(CT_DEFAULT_ENDSEQ);
+    initial->endseq.append(endarr);
+    initial->matcher = std::make_shared<const CSMMatcher>(initial->beginseq,
+                                                          initial->endseq);
+    initial->tpb     = CT_DEFAULT_TPB;
+    initial->turnaround = CT_DEFAULT_TURNAROUND;
+    initial->adaptive = false;
+    initial->stuffing = CSMStuffing::None;
+    publish(initial);
+    batchwindow = CT_DEFAULT_BATCHWINDOW;
+    pipelinedepth = CT_DEFAULT_PIPELINEDEPTH;
+    coalescewindow = CT_DEFAULT_COALESCEWINDOW;
+    coalescebudget = CT_DEFAULT_COALESCEBUDGET;
+    receivecapacity = CT_FRAMER_CAPACITY;
+    qRegisterMetaType<QVector<QByteArray> >("QVector<QByteArray>");
+    qRegisterMetaType<CSMCorrelation>("CSMCorrelation");
+    qRegisterMetaType<QDeadlineTimer>("QDeadlineTimer");
+    qRegisterMetaType<CSMStatistics>("CSMStatistics");
+    qRegisterMetaType<CSMCapture *>("CSMCapture*");
+    qRegisterMetaType<CSMFrameSink>("CSMFrameSink");
+    qRegisterMetaType<CSMPromise>("CSMPromise");
+    qRegisterMetaType<CSMWaiterPtr>("CSMWaiterPtr");
+    capture = 0;
+
+    statstimer = new QTimer(this);
+    connect(statstimer, SIGNAL(timeout()),
+            this,       SLOT(statisticsExpired()));
+
+    spinner = new CSMSpinner(port, &config, &counters, &gauge, &pool, this);
     connect(spinner, SIGNAL(bytesOut(QByteArray)),
             this,    SLOT(bytesReady(QByteArray)));
-    spinner->start();
+    connect(spinner, SIGNAL(bytesOutBatch(QVector<QByteArray>)),
+            this,    SLOT(batchReady(QVector<QByteArray>)));
+    iothread = CSMReactor::instance()->attach(spinner);
 }
 
 CSMCom::~CSMCom()
 {
-    spinner->quit();
-    spinner->wait();
-    port.close();
+    /* The pool is gone when the application has already been destroyed */
+    if (iothread.isNull())
+    {
+        delete spinner;
+        return;
+    }
+
+    QMetaObject::invokeMethod(spinner,
+                              "shutdown",
+                              blockingConnection(),
+                              Q_ARG(QThread *, QThread::currentThread()));
+    delete spinner;
+    CSMReactor::instance()->detach(iothread);
+}
+
+Qt::ConnectionType CSMCom::blockingConnection()
+{
+    if (iothread == QThread::currentThread())
+        return Qt::DirectConnection;
+
+    return Qt::BlockingQueuedConnection;
 }
 
-void CSMCom::bytesIn(QByteArray bytes, qint32 requestedTimeout)
+bool CSMCom::bytesIn(QByteArray bytes, qint32 requestedTimeout)
 {
+    if (!admit(bytes))
+        return false;
+
     QMetaObject::invokeMethod(spinner,
                               "bytesToWrite",
                               Qt::QueuedConnection,
                               Q_ARG(QByteArray, bytes),
                               Q_ARG(qint32, requestedTimeout));
+    return true;
+}
+
+bool CSMCom::bytesIn(QByteArray bytes, qint32 priority, QDeadlineTimer deadline,
+                     qint32 requestedTimeout)
+{
+    if (!admit(bytes))
+        return false;
+
+    QMetaObject::invokeMethod(spinner,
+                              "bytesToWrite",
+                              Qt::QueuedConnection,
+                              Q_ARG(QByteArray, bytes),
+                              Q_ARG(qint32, requestedTimeout),
+                              Q_ARG(qint32, priority),
+                              Q_ARG(QDeadlineTimer, deadline));
+    return true;
+}
+
+bool CSMCom::bytesInOneWay(QByteArray bytes, qint32 priority,
+                           QDeadlineTimer deadline)
+{
+    if (!admit(bytes))
+        return false;
+
+    QMetaObject::invokeMethod(spinner,
+                              "bytesToWrite",
+                              Qt::QueuedConnection,
+                              Q_ARG(QByteArray, bytes),
+                              Q_ARG(qint32, -1),
+                              Q_ARG(qint32, priority),
+                              Q_ARG(QDeadlineTimer, deadline),
+                              Q_ARG(bool, true));
+    return true;
+}
+
+QFuture<QByteArray> CSMCom::transact(QByteArray     request,
+                                     qint32         requestedTimeout,
+                                     qint32         priority,
+                                     QDeadlineTimer deadline)
+{
+    CSMPromise          promise = std::make_shared<QFutureInterface<QByteArray> >();
+    QFuture<QByteArray> future  = promise->future();
+
+    promise->reportStarted();
+    if (!admit(request))
+    {
+        promise->reportException(CSMTransactException(CSMTransactException::Rejected));
+        promise->reportFinished();
+        return future;
+    }
+
+    QMetaObject::invokeMethod(spinner,
+                              "bytesToWrite",
+                              Qt::QueuedConnection,
+                              Q_ARG(QByteArray, request),
+                              Q_ARG(qint32, requestedTimeout),
+                              Q_ARG(qint32, priority),
+                              Q_ARG(QDeadlineTimer, deadline),
+                              Q_ARG(bool, false),
+                              Q_ARG(CSMPromise, promise));
+    return future;
+}
+
+QByteArray CSMCom::transact(QByteArray                     request,
+                            QDeadlineTimer                 deadline,
+                            bool                         * ok,
+                            CSMTransactException::Reason * reason)
+{
+    CSMWaiterPtr waiter = std::make_shared<CSMWaiter>();
+    CSMTransactException::Reason cause = CSMTransactException::Rejected;
+
+    if (ok != 0)
+        *ok = false;
+    if (reason != 0)
+        *reason = cause;
+    /* Nobody would be left to answer */
+    if ((iothread == QThread::currentThread()) || (!admit(request)))
+        return QByteArray();
+
+    /* The reply must come by the deadline too, not the port's own timeout */
+    qint64 remaining = deadline.remainingTime();
+    qint32 timeout   = (remaining < 0) ? -1 : (qint32)qMin<qint64>(remaining, 0x7FFFFFFF);
+
+    QMetaObject::invokeMethod(spinner,
+                              "bytesToWrite",
+                              Qt::QueuedConnection,
+                              Q_ARG(QByteArray, request),
+                              Q_ARG(qint32, timeout),
+                              Q_ARG(qint32, CT_DEFAULT_PRIORITY),
+                              Q_ARG(QDeadlineTimer, deadline),
+                              Q_ARG(bool, false),
+                              Q_ARG(CSMPromise, CSMPromise()),
+                              Q_ARG(CSMWaiterPtr, waiter));
+
+    if (!waiter->wait(deadline))
+    {
+        waiter->abandon();
+        cause = CSMTransactException::Timeout;
+    }
+    else if (waiter->isResolved())
+    {
+        if (ok != 0)
+            *ok = true;
+        return waiter->reply();
+    }
+    else
+        cause = waiter->reason();
+
+    if (reason != 0)
+        *reason = cause;
+    return QByteArray();
+}
+
+bool CSMCom::admit(const QByteArray & bytes)
+{
+    CSMQueueGauge::Crossing crossing = CSMQueueGauge::Steady;
+
+    /* DropOldest always takes the message, the I/O thread evicts */
+    if (gauge.policy() == CSMSendQueue::DropOldest)
+    {
+        crossing = gauge.acquire();
+    }
+    else if (!gauge.tryAcquire(&crossing))
+    {
+        gauge.addDropped();
+        if (gauge.policy() == CSMSendQueue::Reject)
+        {
+            emit logWarning(CT_QUEUEFULL_ERROR);
+        }
+        else
+        {
+            emit bytesDropped(bytes);
+        }
+        return false;
+    }
+
+    if (crossing == CSMQueueGauge::High)
+        emit sendQueueHigh(gauge.count());
+
+    return true;
 }
 
 QString CSMCom::portName()
 {
-       return port.portName();
+       QString name;
+
+       QMetaObject::invokeMethod(spinner,
+                                 "portName",
+                                 blockingConnection(),
+                                 Q_RETURN_ARG(QString, name));
+       return name;
 }
 
 bool CSMCom::setPortName(QString portName)
 {
-       port.close();
-       port.setPortName(portName);
-       if (!port.open(QIODevice::ReadWrite))
+       bool opened = false;
+
+       QMetaObject::invokeMethod(spinner,
+                                 "reopen",
+                                 blockingConnection(),
+                                 Q_RETURN_ARG(bool, opened),
+                                 Q_ARG(QString, portName));
+       if (!opened)
        {
            emit logWarning(CT_CANTOPEN_ERROR);
            return false;
@@ -85,14 +333,19 @@ bool CSMCom::setPortName(QString portName)
 
 qint32 CSMCom::baudRate()
 {
-       return port.baudRate();
+       return lineSetting(CSMSpinner::BaudRate);
 }
 
 bool CSMCom::setBaudRate(qint32 baudRate)
 {
-    if (port.isOpen())
+    if (port->serialPort() == 0)
+    {
+        emit logWarning(CT_NOTSERIAL_ERROR);
+        return false;
+    }
+    if (isConnected())
     {
-        if (port.setBaudRate(baudRate))
+        if (setLineSetting(CSMSpinner::BaudRate, baudRate))
         {
             return true;
         }
@@ -109,19 +362,47 @@ bool CSMCom::setBaudRate(qint32 baudRate)
     }
 }
 
+void CSMCom::publish(CSMConfig * next)
+{
+    std::atomic_store(&config, CSMConfigPtr(next));
+}
+
+bool CSMCom::publishRules(CSMConfig * next)
+{
+    CSMMatcher compiled;
+
+    /* Stuffed frames end at the flag byte, whatever the other rules say */
+    if (next->stuffing != CSMStuffing::None)
+        compiled = CSMMatcher(PreceptSet(), CSMStuffing::rules(next->stuffing));
+    else
+        compiled = CSMMatcher(next->beginseq, next->endseq, next->lengthfield);
+
+    if (!compiled.isValid())
+    {
+        delete next;
+        emit logWarning(CT_RULES_ERROR);
+        return false;
+    }
+
+    next->matcher = std::make_shared<const CSMMatcher>(compiled);
+    publish(next);
+
+    return true;
+}
+
 PreceptSet CSMCom::beginSequence()
 {
-    return beginseq;
+    return config->beginseq;
 }
 
 bool CSMCom::setBeginSequence(PreceptSet newseq)
 {
     if (newseq.length() > 0)
     {
-        beginseq.clear();
-        beginseq.append(newseq);
+        CSMConfig * next = new CSMConfig(*config);
+        next->beginseq = newseq;
 
-        return true;
+        return publishRules(next);
     }
     else
     {
@@ -131,17 +412,17 @@ bool CSMCom::setBeginSequence(PreceptSet newseq)
 
 PreceptSet CSMCom::endSequence()
 {
-    return endseq;
+    return config->endseq;
 }
 
 bool CSMCom::setEndSequence(PreceptSet newseq)
 {
     if (newseq.length() > 0)
     {
-        endseq.clear();
-        endseq.append(newseq);
+        CSMConfig * next = new CSMConfig(*config);
+        next->endseq = newseq;
 
-        return true;
+        return publishRules(next);
     }
     else
     {
@@ -149,269 +430,1287 @@ bool CSMCom::setEndSequence(PreceptSet newseq)
     }
 }
 
-qreal CSMCom::timeoutPerByte()
+CSMLengthField CSMCom::lengthField()
 {
-    return tpb;
+    return config->lengthfield;
 }
 
-bool CSMCom::setTimeoutPerByte(qreal timeout)
+bool CSMCom::setLengthField(CSMLengthField field)
 {
-    if (timeout > 0)
+    if (!field.isValid())
     {
-        tpb = timeout;
-        return true;
+        emit logWarning(CT_LENGTHFIELD_ERROR);
+        return false;
     }
-    else
+
+    CSMConfig * next = new CSMConfig(*config);
+    next->lengthfield = field;
+
+    return publishRules(next);
+}
+
+CSMStuffing::Mode CSMCom::stuffing()
+{
+    return config->stuffing;
+}
+
+bool CSMCom::setStuffing(CSMStuffing::Mode mode)
+{
+    CSMConfig * next = new CSMConfig(*config);
+    next->stuffing = mode;
+
+    return publishRules(next);
+}
+
+CSMChecksum CSMCom::checksum()
+{
+    return config->checksum;
+}
+
+bool CSMCom::setChecksum(CSMChecksum newchecksum)
+{
+    if (!newchecksum.isValid())
     {
+        emit logWarning(CT_CHECKSUMSET_ERROR);
         return false;
     }
+
+    CSMConfig * next = new CSMConfig(*config);
+    next->checksum = newchecksum;
+    publish(next);
+
+    return true;
 }
 
-bool CSMCom::setParity(QSerialPort::Parity parity)
+qreal CSMCom::timeoutPerByte()
+{
+    return config->tpb;
+}
+
+bool CSMCom::setTimeoutPerByte(qreal timeout)
 {
-    if (!port.setParity(parity))
+    if (timeout >= 0)
     {
-        emit logWarning(CT_PARITY_ERROR);
-        return false;
+        CSMConfig * next = new CSMConfig(*config);
+        next->tpb = timeout;
+        publish(next);
+        return true;
     }
     else
     {
-        return true;
+        return false;
     }
 }
 
-QSerialPort::Parity CSMCom::parity()
+qint32 CSMCom::turnaround()
 {
-    return port.parity();
+    return config->turnaround;
 }
 
-bool CSMCom::setDataBits(QSerialPort::DataBits dataBits)
+bool CSMCom::setTurnaround(qint32 time)
 {
-    if (!port.setDataBits(dataBits))
+    if ((time >= 0) && (time <= CT_MAX_TURNAROUND))
     {
-        emit logWarning(CT_DATABITS_ERROR);
-        return false;
+        CSMConfig * next = new CSMConfig(*config);
+        next->turnaround = time;
+        publish(next);
+        return true;
     }
     else
     {
-        return true;
+        return false;
     }
 }
 
-QSerialPort::DataBits CSMCom::dataBits()
+bool CSMCom::adaptiveTimeout()
 {
-    return port.dataBits();
+    return config->adaptive;
 }
 
-bool CSMCom::setStopBits(QSerialPort::StopBits stopBits)
+bool CSMCom::setAdaptiveTimeout(bool enabled)
 {
-    if (!port.setStopBits(stopBits))
+    CSMConfig * next = new CSMConfig(*config);
+    next->adaptive = enabled;
+    publish(next);
+
+    return true;
+}
+
+qint32 CSMCom::batchWindow()
+{
+    return batchwindow;
+}
+
+bool CSMCom::setBatchWindow(qint32 window)
+{
+    if (window >= -1)
     {
-        emit logWarning(CT_STOPBITS_ERROR);
-        return false;
+        batchwindow = window;
+        QMetaObject::invokeMethod(spinner,
+                                  "setBatchWindow",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(qint32, window));
+        return true;
     }
     else
     {
-        return true;
+        return false;
     }
 }
 
-QSerialPort::StopBits CSMCom::stopBits()
+qint32 CSMCom::coalesceWindow()
 {
-    return port.stopBits();
+    return coalescewindow;
 }
 
-bool CSMCom::setFlowControl(QSerialPort::FlowControl flow)
+qint32 CSMCom::coalesceBudget()
+{
+    return coalescebudget;
+}
+
+bool CSMCom::setCoalescing(qint32 window, qint32 budget)
 {
-    if (!port.setFlowControl(flow))
+    if ((window >= -1) && (budget > 0))
     {
-        emit logWarning(CT_FLOWSET_ERROR);
-        return false;
+        coalescewindow = window;
+        coalescebudget = budget;
+        QMetaObject::invokeMethod(spinner,
+                                  "setCoalescing",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(qint32, window),
+                                  Q_ARG(qint32, budget));
+        return true;
     }
     else
     {
-        return true;
+        return false;
     }
 }
 
-QSerialPort::FlowControl CSMCom::flowControl()
+qint32 CSMCom::sendQueueCapacity()
 {
-    return port.flowControl();
+    return gauge.capacity();
 }
 
-bool CSMCom::isConnected()
+CSMSendQueue::Policy CSMCom::sendQueuePolicy()
 {
-    return port.isOpen();
+    return gauge.policy();
 }
 
-QString CSMCom::rulesToString(PreceptSet rules)
+bool CSMCom::setSendQueueCapacity(qint32 capacity, CSMSendQueue::Policy policy)
 {
-    QString result;
-
-    for (int i = 0; i < rules.length(); i++)
+    if ((capacity == -1) || (capacity > 0))
     {
-        result.append(QString("Sequence #%1\n").arg(i));
-        result.append(QString("["));
-        for (int j = 0; j < rules.at(i).length(); j++)
-        {
-            result.append(QString("(%1, %2),")
-                .arg(rules.at(i).at(j).exactly)
-                .arg(rules.at(i).at(j).byte, 2, 16));
-        }
-        result.chop(1);
-        result.append(QString("]\n"));
+        gauge.setCapacity(capacity, policy);
+        return true;
+    }
+    else
+    {
+        return false;
     }
-
-    return result;
 }
 
-QString CSMCom::bytesToString(QByteArray bytes)
+bool CSMCom::setSendQueueWatermarks(qint32 high, qint32 low)
 {
-    QString result;
-
-    for (qint32 i = 0; i < bytes.length(); i++)
+    if ((high == -1) || ((low >= 0) && (low < high)))
     {
-        result.append(
-            QString("%1 ").arg(
-                bytes.at(i) & 0xFF, 2, 0x10, QChar('0')).toUpper());
-        if (i % 16 == 15) result.append('\n');
+        gauge.setWatermarks(high, low);
+        return true;
+    }
+    else
+    {
+        return false;
     }
-    result.append('\n');
-
-    return result;
 }
 
-void CSMCom::bytesReady(QByteArray bytes)
+qint32 CSMCom::receiveCapacity()
 {
-    emit logRead(bytes);
-    emit bytesOut(bytes);
+    return receivecapacity;
 }
 
-/* CSMSpinner */
-
-CSMSpinner::CSMSpinner(QSerialPort * port,
-                       PreceptSet  * beginseqptr,
-                       PreceptSet  * endseqptr,
-                       qreal       * tpb,
-                       CSMCom      * parentptr)
+bool CSMCom::setReceiveCapacity(qint32 capacity)
 {
-    terminated = false;
-    portcopy   = port;
-    beginseq   = beginseqptr;
-    endseq     = endseqptr;
-    busy       = false;
-    tpbcopy    = tpb;
-    timeleft   = 0;
-    parent     = parentptr;
-    incoming.clear();
-    sendqueue.clear();
+    if (capacity > 0)
+    {
+        receivecapacity = capacity;
+        QMetaObject::invokeMethod(spinner,
+                                  "setReceiveCapacity",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(qint32, capacity));
+        return true;
+    }
+    else
+    {
+        return false;
+    }
 }
 
-CSMSpinner::~CSMSpinner()
+qint32 CSMCom::bufferPoolSize()
 {
-
+    return pool.size();
 }
 
-void CSMSpinner::run()
+bool CSMCom::setBufferPoolSize(qint32 size)
 {
-    qint32 beginpos;
-    qint32 endpos;
-    qint32 rulebeg;
-    qint32 ruleend;
-
-    while (!terminated)
+    if (size >= 0)
     {
-        /* Timeout event */
-        if ((busy) && (timeout.elapsed() > timeleft))
-        {
-            busy = false;
-            emit parent->timeout();
-            emit parent->logTimeout();
-            incoming.clear();
-        }
+        pool.setSize(size);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
 
-        /* Process queue */
-        if ((!(busy)) && (!sendqueue.isEmpty()))
-        {
-            emit parent->bytesIn(sendqueue.first());
-            sendqueue.removeFirst();
-        }
+QByteArray CSMCom::allocate(const char * data, qint32 length)
+{
+    return pool.take(data, length);
+}
 
-        /* Read available bytes */
-        if (portcopy->bytesAvailable())
-        {
-            incoming.append(portcopy->readAll());
-        }
+CSMStatistics CSMCom::statistics()
+{
+    CSMStatistics stats = counters.snapshot();
 
-        /* Unload the processor */
-        msleep(CT_DEFAULT_RINGPERIOD);
+    stats.dropped    = gauge.dropped();
+    stats.poolhits   = pool.hits();
+    stats.poolmisses = pool.misses();
 
-        /* Send ready signal when package signature is found */
-        if (((beginpos = sequenceBeginSearch(&beginpos, &rulebeg)) > -1) &&
-            ((endpos   = sequenceEndSearch  (&endpos,   &ruleend)) > -1) &&
-            ((beginpos < endpos)))
-        {
-            busy = false;
-            emit bytesOut(incoming.mid(beginpos, endpos + endseq->at(ruleend).length() + 1));
-            incoming.remove(0, endpos - beginpos + endseq->at(ruleend).length() + 1);
-        }
-    }
+    return stats;
 }
 
-qint32 CSMSpinner::ruleApplier(PreceptSet * rules, QByteArray bytes,
-                               qint32     * pos,   qint32 * rule)
+qint32 CSMCom::statisticsInterval()
 {
-    if (rules->length() == 0)
-    {
+    return statstimer->isActive() ? statstimer->interval() :
+                                    CT_DEFAULT_STATSINTERVAL;
+}
+
+bool CSMCom::setStatisticsInterval(qint32 interval)
+{
+    if (interval == -1)
+    {
+        statstimer->stop();
+        return true;
+    }
+    else if (interval > 0)
+    {
+        statstimer->start(interval);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+void CSMCom::setCapture(CSMCapture * target)
+{
+    if (capture != 0)
+        disconnect(this,    SIGNAL(logWarning(QString)),
+                   capture, SLOT(warning(QString)));
+
+    capture = target;
+    if (capture != 0)
+        connect(this,    SIGNAL(logWarning(QString)),
+                capture, SLOT(warning(QString)),
+                Qt::DirectConnection);
+
+    QMetaObject::invokeMethod(spinner,
+                              "setCapture",
+                              blockingConnection(),
+                              Q_ARG(CSMCapture *, target));
+}
+
+void CSMCom::setFrameCallback(CSMFrameSink callback, bool keepSignals)
+{
+    /* Blocking: the old callback must not run once we return */
+    QMetaObject::invokeMethod(spinner,
+                              "setFrameSink",
+                              blockingConnection(),
+                              Q_ARG(CSMFrameSink, callback),
+                              Q_ARG(bool, keepSignals));
+}
+
+void CSMCom::statisticsExpired()
+{
+    emit statisticsReady(statistics());
+}
+
+qint32 CSMCom::pipelineDepth()
+{
+    return pipelinedepth;
+}
+
+bool CSMCom::setPipelineDepth(qint32 depth)
+{
+    if (depth > 0)
+    {
+        pipelinedepth = depth;
+        QMetaObject::invokeMethod(spinner,
+                                  "setPipelineDepth",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(qint32, depth));
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool CSMCom::setCorrelationKey(qint32 requestOffset, qint32 responseOffset,
+                               qint32 length)
+{
+    if ((requestOffset >= 0) && (responseOffset >= 0) && (length >= 0))
+    {
+        correlation = CSMCorrelation();
+        correlation.requestoffset  = requestOffset;
+        correlation.responseoffset = responseOffset;
+        correlation.length         = length;
+        QMetaObject::invokeMethod(spinner,
+                                  "setCorrelation",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(CSMCorrelation, correlation));
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool CSMCom::setCorrelationKey(CSMKeyExtractor requestKey,
+                               CSMKeyExtractor responseKey)
+{
+    if ((requestKey) && (responseKey))
+    {
+        correlation = CSMCorrelation();
+        correlation.requestkey  = requestKey;
+        correlation.responsekey = responseKey;
+        QMetaObject::invokeMethod(spinner,
+                                  "setCorrelation",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(CSMCorrelation, correlation));
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool CSMCom::setParity(QSerialPort::Parity parity)
+{
+    if (port->serialPort() == 0)
+    {
+        emit logWarning(CT_NOTSERIAL_ERROR);
+        return false;
+    }
+    if (!setLineSetting(CSMSpinner::Parity, parity))
+    {
+        emit logWarning(CT_PARITY_ERROR);
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+QSerialPort::Parity CSMCom::parity()
+{
+    if (port->serialPort() == 0)
+        return QSerialPort::NoParity;
+
+    return (QSerialPort::Parity)lineSetting(CSMSpinner::Parity);
+}
+
+bool CSMCom::setDataBits(QSerialPort::DataBits dataBits)
+{
+    if (port->serialPort() == 0)
+    {
+        emit logWarning(CT_NOTSERIAL_ERROR);
+        return false;
+    }
+    if (!setLineSetting(CSMSpinner::DataBits, dataBits))
+    {
+        emit logWarning(CT_DATABITS_ERROR);
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+QSerialPort::DataBits CSMCom::dataBits()
+{
+    if (port->serialPort() == 0)
+        return QSerialPort::Data8;
+
+    return (QSerialPort::DataBits)lineSetting(CSMSpinner::DataBits);
+}
+
+bool CSMCom::setStopBits(QSerialPort::StopBits stopBits)
+{
+    if (port->serialPort() == 0)
+    {
+        emit logWarning(CT_NOTSERIAL_ERROR);
+        return false;
+    }
+    if (!setLineSetting(CSMSpinner::StopBits, stopBits))
+    {
+        emit logWarning(CT_STOPBITS_ERROR);
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+QSerialPort::StopBits CSMCom::stopBits()
+{
+    if (port->serialPort() == 0)
+        return QSerialPort::OneStop;
+
+    return (QSerialPort::StopBits)lineSetting(CSMSpinner::StopBits);
+}
+
+bool CSMCom::setFlowControl(QSerialPort::FlowControl flow)
+{
+    if (port->serialPort() == 0)
+    {
+        emit logWarning(CT_NOTSERIAL_ERROR);
+        return false;
+    }
+    if (!setLineSetting(CSMSpinner::FlowControl, flow))
+    {
+        emit logWarning(CT_FLOWSET_ERROR);
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+QSerialPort::FlowControl CSMCom::flowControl()
+{
+    if (port->serialPort() == 0)
+        return QSerialPort::NoFlowControl;
+
+    return (QSerialPort::FlowControl)lineSetting(CSMSpinner::FlowControl);
+}
+
+bool CSMCom::isConnected()
+{
+    bool opened = false;
+
+    QMetaObject::invokeMethod(spinner,
+                              "isPortOpen",
+                              blockingConnection(),
+                              Q_RETURN_ARG(bool, opened));
+    return opened;
+}
+
+bool CSMCom::setLineSetting(qint32 setting, qint32 value)
+{
+    bool done = false;
+
+    QMetaObject::invokeMethod(spinner,
+                              "setLineSetting",
+                              blockingConnection(),
+                              Q_RETURN_ARG(bool, done),
+                              Q_ARG(qint32, setting),
+                              Q_ARG(qint32, value));
+    return done;
+}
+
+qint32 CSMCom::lineSetting(qint32 setting)
+{
+    qint32 value = -1;
+
+    QMetaObject::invokeMethod(spinner,
+                              "lineSetting",
+                              blockingConnection(),
+                              Q_RETURN_ARG(qint32, value),
+                              Q_ARG(qint32, setting));
+    return value;
+}
+
+QString CSMCom::rulesToString(PreceptSet rules)
+{
+    QString result;
+
+    for (int i = 0; i < rules.length(); i++)
+    {
+        result.append(QString("Sequence #%1\n").arg(i));
+        result.append(QString("["));
+        for (int j = 0; j < rules.at(i).length(); j++)
+        {
+            result.append(QString("(%1, %2),")
+                .arg(rules.at(i).at(j).exactly)
+                .arg(rules.at(i).at(j).byte, 2, 16));
+        }
+        result.chop(1);
+        result.append(QString("]\n"));
+    }
+
+    return result;
+}
+
+QString CSMCom::bytesToString(QByteArray bytes)
+{
+    QByteArray result(CT_HEX_LENGTH(bytes.length()), '\0');
+
+    result.resize(bytesToHex(bytes.constData(), bytes.length(), result.data()));
+
+    return QString::fromLatin1(result);
+}
+
+qint32 CSMCom::bytesToHex(const char * data, qint32 length, char * out)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char            * cursor   = out;
+
+    for (qint32 i = 0; i < length; i++)
+    {
+        quint8 byte = (quint8)data[i];
+
+        *cursor++ = digits[byte >> 4];
+        *cursor++ = digits[byte & 0x0F];
+        *cursor++ = ' ';
+        if (i % 16 == 15)
+            *cursor++ = '\n';
+    }
+    *cursor++ = '\n';
+
+    return (qint32)(cursor - out);
+}
+
+void CSMCom::bytesReady(QByteArray bytes)
+{
+    emit logRead(bytes);
+    emit bytesOut(bytes);
+}
+
+void CSMCom::batchReady(QVector<QByteArray> packets)
+{
+    for (qint32 i = 0; i < packets.length(); i++)
+    {
+        emit logRead(packets.at(i));
+        emit bytesOut(packets.at(i));
+    }
+    emit bytesOutBatch(packets);
+}
+
+/* CSMSpinner */
+
+CSMSpinner::CSMSpinner(CSMTransport    * port,
+                       CSMConfigPtr    * configptr,
+                       CSMStatCounters * statsptr,
+                       CSMQueueGauge   * gaugeptr,
+                       CSMBufferPool   * poolptr,
+                       CSMCom          * parentptr)
+{
+    portcopy   = port;
+    configcopy = configptr;
+    stats      = statsptr;
+    gauge      = gaugeptr;
+    pool       = poolptr;
+    capture    = 0;
+    sinksignals = true;
+    pipelinedepth = CT_DEFAULT_PIPELINEDEPTH;
+    parent     = parentptr;
+    batchwindow = CT_DEFAULT_BATCHWINDOW;
+    coalescewindow = CT_DEFAULT_COALESCEWINDOW;
+    coalescebudget = CT_DEFAULT_COALESCEBUDGET;
+    gatheredcount  = 0;
+    chartime       = characterTime();
+    refreshConfig();
+    sendqueue.clear();
+    inflight.clear();
+    clock.start();
+
+    portcopy->setParent(this);
+    connect(portcopy, SIGNAL(readyRead()),
+            this,     SLOT(bytesReceived()));
+
+    deadline = new QTimer(this);
+    deadline->setSingleShot(true);
+    deadline->setTimerType(Qt::PreciseTimer);
+    connect(deadline, SIGNAL(timeout()),
+            this,     SLOT(timeoutExpired()));
+
+    linegap = new QTimer(this);
+    linegap->setSingleShot(true);
+    linegap->setTimerType(Qt::PreciseTimer);
+    connect(linegap, SIGNAL(timeout()),
+            this,    SLOT(lineIdle()));
+
+    batchflush = new QTimer(this);
+    batchflush->setSingleShot(true);
+    batchflush->setTimerType(Qt::PreciseTimer);
+    connect(batchflush, SIGNAL(timeout()),
+            this,       SLOT(batchExpired()));
+
+    gatherflush = new QTimer(this);
+    gatherflush->setSingleShot(true);
+    gatherflush->setTimerType(Qt::PreciseTimer);
+    connect(gatherflush, SIGNAL(timeout()),
+            this,        SLOT(flushWrites()));
+}
+
+CSMSpinner::~CSMSpinner()
+{
+
+}
+
+void CSMSpinner::bytesReceived()
+{
+    qint64 available;
+
+    refreshConfig();
+
+    /* Read straight into the framer buffer, no intermediate QByteArray */
+    while ((available = portcopy->bytesAvailable()) > 0)
+    {
+        qint32 space;
+        bool   dropped;
+        char * target = framer.reserve(&space, &dropped);
+
+        if (dropped)
+        {
+            stats->addOverflow();
+            emit parent->logWarning(CT_OVERFLOW_ERROR);
+        }
+
+        qint64 received = portcopy->read(target, qMin((qint64)space, available));
+        if (received <= 0)
+            break;
+        framer.commit(received);
+        stats->addRead(received);
+        if (capture != 0)
+            capture->record(CSMCapture::Rx, target, received);
+
+        extractPackets();
+    }
+    stats->setUnframed(framer.buffered());
+
+    scheduleBatch();
+    processQueue();
+}
+
+void CSMSpinner::timeoutExpired()
+{
+    qint64 now     = clock.nsecsElapsed();
+    bool   expired = false;
+
+    for (qint32 i = 0; i < inflight.length(); )
+    {
+        if (inflight.at(i).expires <= now)
+        {
+            CSMRequest request = inflight.takeAt(i);
+
+            expired = true;
+            stats->addTimeout();
+            fail(request, CSMTransactException::Timeout);
+            if (capture != 0)
+                capture->timeout(request.bytes);
+            emit parent->requestTimeout(request.bytes);
+            emit parent->timeout();
+            emit parent->logTimeout();
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    /* The device is slower than estimated, back off like TCP does */
+    if ((expired) && (active->adaptive))
+        rto = qMin(rto * 2, (qint64)CT_MAX_TURNAROUND * 1000000);
+
+    /* A partial reply may still belong to another request in flight */
+    if ((expired) && (inflight.isEmpty()))
+    {
+        framer.reset();
+        linegap->stop();
+        stats->setUnframed(0);
+    }
+
+    armDeadline();
+    processQueue();
+}
+
+void CSMSpinner::lineIdle()
+{
+    QByteArray packet;
+
+    refreshConfig();
+
+    if (framer.flush(&packet))
+    {
+        if ((unstuff(&packet)) && (validate(packet)))
+            packetReady(packet);
+        extractPackets();
+        scheduleBatch();
+        stats->setUnframed(framer.buffered());
+    }
+
+    processQueue();
+}
+
+void CSMSpinner::extractPackets()
+{
+    QByteArray packet;
+    qint64     scanning = 0;
+    qint64     started  = clock.nsecsElapsed();
+
+    /* Send ready signal for every package found. Only the framer's own work
+     * is timed: delivery and callbacks are the consumers' cost, not its */
+    while (framer.next(&packet))
+    {
+        scanning += clock.nsecsElapsed() - started;
+        if ((unstuff(&packet)) && (validate(packet)))
+            packetReady(packet);
+        started = clock.nsecsElapsed();
+    }
+    stats->addMatcherTime(scanning + clock.nsecsElapsed() - started);
+
+    /* The end of a package may depend on the bytes that are yet to come */
+    if (framer.hasPending())
+    {
+        linegap->start(CT_DEFAULT_LINEGAP);
+    }
+    else
+    {
+        linegap->stop();
+    }
+}
+
+void CSMSpinner::packetReady(const QByteArray & packet)
+{
+    qint32     index = matchRequest(packet);
+    CSMRequest request;
+
+    stats->addFrame(framer.beginRule(), framer.endRule());
+    if (index >= 0)
+    {
+        request = inflight.takeAt(index);
+
+        stats->addRoundTrip(clock.nsecsElapsed() - request.sent);
+        sampleRoundTrip(request, packet.length());
+        armDeadline();
+    }
+
+    /* Consumers on this thread see the frame in place, nothing is copied */
+    if (sink)
+        sink(packet);
+
+    if ((index < 0) && (sink) && (!sinksignals))
+        return;
+
+    /* The packet points into the framer buffer, detach before it leaves */
+    QByteArray copy = pool->take(packet.constData(), packet.length());
+
+    if (index >= 0)
+    {
+        if (request.promise)
+            request.promise->reportFinished(&copy);
+        if (request.waiter)
+            request.waiter->resolve(copy);
+        emit parent->replyReceived(request.bytes, copy);
+    }
+    if ((sink) && (!sinksignals))
+        return;
+
+    if (batchwindow < 0)
+    {
+        emit bytesOut(copy);
+    }
+    else
+    {
+        batch.append(copy);
+    }
+}
+
+bool CSMSpinner::validate(const QByteArray & packet)
+{
+    const CSMChecksum & checksum = active->checksum;
+
+    if ((!checksum.isEnabled()) || (checksum.verify(packet)))
+        return true;
+
+    stats->addInvalid();
+    if (checksum.policy() == CSMChecksum::Flag)
+    {
+        emit parent->bytesInvalid(pool->take(packet.constData(),
+                                             packet.length()));
+    }
+    else
+    {
+        emit parent->logWarning(CT_CHECKSUM_ERROR);
+    }
+
+    /* A corrupted length or end may have swallowed good packets, look again
+     * right after the start of this one */
+    framer.reject();
+
+    return false;
+}
+
+bool CSMSpinner::unstuff(QByteArray * packet)
+{
+    if (active->stuffing == CSMStuffing::None)
+        return true;
+
+    /* The framer leaves the flag byte at the end */
+    if (!CSMStuffing::decode(active->stuffing, packet->constData(),
+                             packet->length() - 1, &unstuffed))
+    {
+        stats->addInvalid();
+        emit parent->logWarning(CT_STUFFING_ERROR);
+        return false;
+    }
+
+    /* Back-to-back flags are frame separators, not packets */
+    if (unstuffed.isEmpty())
+        return false;
+
+    *packet = unstuffed;
+
+    return true;
+}
+
+void CSMSpinner::scheduleBatch()
+{
+    if (batch.isEmpty())
+        return;
+
+    if (batchwindow == 0)
+    {
+        batchExpired();
+    }
+    else if (!batchflush->isActive())
+    {
+        batchflush->start(batchwindow);
+    }
+}
+
+void CSMSpinner::batchExpired()
+{
+    batchflush->stop();
+    if (batch.isEmpty())
+        return;
+
+    emit bytesOutBatch(batch);
+    batch.clear();
+}
+
+void CSMSpinner::setBatchWindow(qint32 window)
+{
+    batchwindow = window;
+    if (batchwindow <= 0)
+    {
+        batchExpired();
+    }
+}
+
+void CSMSpinner::refreshConfig()
+{
+    CSMConfigPtr latest = std::atomic_load(configcopy);
+
+    if (latest != active)
+    {
+        bool retune = (!active) ||
+                      (latest->turnaround != active->turnaround) ||
+                      (latest->adaptive != active->adaptive);
+
+        active = latest;
+        framer.setMatcher(active->matcher.get());
+        if (retune)
+            resetEstimate();
+    }
+}
+
+void CSMSpinner::processQueue()
+{
+    while (!sendqueue.isEmpty())
+    {
+        /* Only replies take pipeline slots, one-way messages never wait */
+        if ((!sendqueue.top().oneway) && (inflight.length() >= pipelinedepth))
+            break;
+
+        CSMRequest request = sendqueue.pop();
+
+        leaveQueue();
+        /* Nobody waits for the answer any more */
+        if ((request.promise) && (request.promise->isCanceled()))
+        {
+            request.promise->reportFinished();
+            continue;
+        }
+        if ((request.waiter) && (request.waiter->isAbandoned()))
+            continue;
+
+        /* Stale by now, the device must not see it */
+        if (request.deadline.hasExpired())
+        {
+            stats->addExpired();
+            fail(request, CSMTransactException::Expired);
+            emit parent->bytesExpired(request.bytes);
+            continue;
+        }
+
+        transmit(request);
+    }
+    stats->setQueueDepth(sendqueue.length());
+
+    if (coalescewindow == 0)
+        flushWrites();
+}
+
+void CSMSpinner::fail(const CSMRequest & request,
+                      CSMTransactException::Reason reason)
+{
+    if (request.waiter)
+        request.waiter->fail(reason);
+    if (!request.promise)
+        return;
+
+    request.promise->reportException(CSMTransactException(reason));
+    request.promise->reportFinished();
+}
+
+void CSMSpinner::leaveQueue()
+{
+    if (gauge->release() == CSMQueueGauge::Low)
+        emit parent->sendQueueLow(gauge->count());
+}
+
+void CSMSpinner::trimQueue()
+{
+    qint32 capacity = gauge->capacity();
+    if (capacity < 0)
+        return;
+
+    while (sendqueue.length() > capacity)
+    {
+        CSMRequest request = sendqueue.takeOldest();
+
+        leaveQueue();
+        gauge->addDropped();
+        fail(request, CSMTransactException::Dropped);
+        emit parent->bytesDropped(request.bytes);
+    }
+    stats->setQueueDepth(sendqueue.length());
+}
+
+void CSMSpinner::transmit(CSMRequest request)
+{
+    qint64             timeleft;
+    const QByteArray * wire = &request.bytes;
+
+    /* Only the line sees the stuffed form, replies refer to the message */
+    if (active->stuffing != CSMStuffing::None)
+    {
+        CSMStuffing::encode(active->stuffing, request.bytes, &stuffed);
+        wire = &stuffed;
+    }
+
+    emit parent->logWrite(*wire);
+    submit(*wire, request.oneway);
+    /* Only one-way messages wait in the gather buffer, a request is on the
+     * port by now: its timeout and round trip start here */
+    request.sent = clock.nsecsElapsed();
+    stats->addWritten(wire->length());
+    if (capture != 0)
+        capture->tx(*wire);
+    if (request.oneway)
+        return;
+
+    if (request.timeout == -1)
+    {
+        timeleft = timeoutBudget(wire->length());
+    }
+    else
+    {
+        timeleft = (qint64)request.timeout * 1000000;
+    }
+
+    request.key      = correlation.requestKey(request.bytes);
+    request.wiretime = wire->length() * chartime;
+    request.expires  = request.sent + timeleft;
+    inflight.append(request);
+    armDeadline();
+}
+
+void CSMSpinner::submit(const QByteArray & wire, bool oneway)
+{
+    /* A request's timeout runs from the moment it is written, never hold it */
+    if ((coalescewindow < 0) || (!oneway))
+    {
+        flushWrites();
+        portcopy->write(wire);
+        stats->addWriteCall(1);
+        return;
+    }
+
+    /* Keep the line order: whatever is gathered goes out first */
+    if (gathered.length() + wire.length() > coalescebudget)
+        flushWrites();
+
+    if (wire.length() >= coalescebudget)
+    {
+        portcopy->write(wire);
+        stats->addWriteCall(1);
+        return;
+    }
+
+    gathered.append(wire);
+    gatheredcount++;
+    if ((coalescewindow > 0) && (!gatherflush->isActive()))
+    {
+        /* Below a millisecond the next loop turn is the nearest we can do */
+        gatherflush->start((coalescewindow < 1000) ? 0 : (coalescewindow + 500) / 1000);
+    }
+}
+
+void CSMSpinner::flushWrites()
+{
+    gatherflush->stop();
+    if (gatheredcount == 0)
+        return;
+
+    portcopy->write(gathered);
+    stats->addWriteCall(gatheredcount);
+    /* Keeps the reserved capacity unless the transport still shares it */
+    gathered.resize(0);
+    gatheredcount = 0;
+}
+
+qint32 CSMSpinner::matchRequest(const QByteArray & packet)
+{
+    if (inflight.isEmpty())
+        return -1;
+    if (!correlation.isEnabled())
+        return 0;
+
+    QByteArray key = correlation.responseKey(packet);
+    if (key.isEmpty())
+        return -1;
+
+    for (qint32 i = 0; i < inflight.length(); i++)
+    {
+        if (inflight.at(i).key == key)
+            return i;
+    }
+
+    return -1;
+}
+
+void CSMSpinner::armDeadline()
+{
+    if (inflight.isEmpty())
+    {
+        deadline->stop();
+        return;
+    }
+
+    qint64 earliest = inflight.first().expires;
+    for (qint32 i = 1; i < inflight.length(); i++)
+    {
+        earliest = qMin(earliest, inflight.at(i).expires);
+    }
+
+    /* Round up: a timer that fires early would only be re-armed */
+    qint64 remaining = qMax(earliest - clock.nsecsElapsed(), (qint64)0);
+    deadline->start((remaining + 999999) / 1000000);
+}
+
+qint64 CSMSpinner::characterTime()
+{
+    qint64 baud = portcopy->baudRate();
+    if (baud <= 0)
+        return 0;
+
+    /* In half bits: start bit, data bits, parity bit, 1, 1.5 or 2 stop bits;
+     * channels other than a serial port count as 8N1 */
+    qint64        halfbits = 20;
+    QSerialPort * line     = portcopy->serialPort();
+    if (line != 0)
+    {
+        qint32 data = (line->dataBits() > 0) ? line->dataBits() : 8;
+
+        halfbits = 2 + data * 2;
+        if (line->parity() != QSerialPort::NoParity)
+            halfbits += 2;
+        if (line->stopBits() == QSerialPort::TwoStop)
+        {
+            halfbits += 4;
+        }
+        else if (line->stopBits() == QSerialPort::OneAndHalfStop)
+        {
+            halfbits += 3;
+        }
+        else
+        {
+            halfbits += 2;
+        }
+    }
+
+    return halfbits * 500000000 / baud;
+}
+
+qint64 CSMSpinner::timeoutBudget(qint32 length)
+{
+    if (active->tpb > 0)
+        return (qint64)((qreal)length * active->tpb * 1000000.0);
+
+    /* The request goes out, a reply of about the same size comes back */
+    return 2 * length * chartime +
+           (active->adaptive ? rto : (qint64)active->turnaround * 1000000);
+}
+
+void CSMSpinner::sampleRoundTrip(const CSMRequest & request, qint32 length)
+{
+    if ((!active->adaptive) || (active->tpb > 0))
+        return;
+
+    /* Only the device's own delay is estimated, the line time is known */
+    qint64 sample = clock.nsecsElapsed() - request.sent - request.wiretime -
+                    length * chartime;
+    sample = qMax(sample, (qint64)0);
+
+    /* RFC 6298 */
+    if (!sampled)
+    {
+        srtt    = sample;
+        rttvar  = sample / 2;
+        sampled = true;
+    }
+    else
+    {
+        rttvar = (3 * rttvar + qAbs(srtt - sample)) / 4;
+        srtt   = (7 * srtt + sample) / 8;
+    }
+
+    /* Not below the 1 ms resolution of the deadline timer */
+    rto = qMin(srtt + qMax(4 * rttvar, (qint64)1000000),
+               (qint64)CT_MAX_TURNAROUND * 1000000);
+}
+
+void CSMSpinner::resetEstimate()
+{
+    srtt    = 0;
+    rttvar  = 0;
+    sampled = false;
+    rto     = (qint64)active->turnaround * 1000000;
+}
+
+/* Checks the rule placed at j, bytes outside the buffer match only
+ * exactly=false precepts */
+static bool ruleMatchesAt(const PreceptArray & rule, const QByteArray & bytes,
+                          qint32 j)
+{
+    for (qint32 k = 0; k < rule.length(); k++)
+    {
+        if ((j + k < 0) || (j + k >= bytes.length()))
+        {
+            if (rule[k].exactly)
+                return false;
+        }
+        else
+        {
+            if ((rule[k].byte == (bytes.at(j + k) & 0xFF)) != rule[k].exactly)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* Picks the exactly=true precept least likely to occur in the stream:
+ * 0x00/0xFF fill idle lines, printable ASCII fills text protocols */
+static qint32 ruleAnchor(const PreceptArray & rule)
+{
+    qint32 anchor = -1;
+    qint32 best   = 0;
+
+    for (qint32 k = 0; k < rule.length(); k++)
+    {
+        if (!rule[k].exactly)
+            continue;
+
+        quint8 byte  = rule[k].byte;
+        qint32 score = ((byte == 0x00) || (byte == 0xFF)) ? 0 :
+                       ((byte >= 0x20) && (byte <= 0x7E)) ? 1 : 2;
+
+        if ((anchor < 0) || (score > best))
+        {
+            anchor = k;
+            best   = score;
+        }
+    }
+
+    return anchor;
+}
+
+qint32 CSMSpinner::ruleApplier(const PreceptSet * rules, const QByteArray & bytes,
+                               qint32           * pos,   qint32 * rule)
+{
+    if (rules->length() == 0)
+    {
         *pos  = 0;
         *rule = -1;
         return *pos;
     }
 
-    int  counter;
+    const char * data = bytes.constData();
+
     for (qint32 i = 0; i < rules->length(); i++)
     {
-        for (qint32 j = -rules->at(i).length() + 1;
-             j < bytes.length() - rules->at(i).length() + 1;
-             j++)
-        {
-            counter = 0;
+        const PreceptArray & current = rules->at(i);
+        qint32               first   = -current.length() + 1;
+        qint32               last    = bytes.length() - current.length();
+        qint32               anchor  = ruleAnchor(current);
 
-            for (qint32 k = 0; k < rules->at(i).length(); k++)
+        if (anchor < 0)
+        {
+            /* Nothing to search for, try every placement */
+            for (qint32 j = first; j <= last; j++)
             {
-                if ((j + k < 0) || (j + k >= bytes.length()))
-                {
-                    if (!rules->at(i)[k].exactly)
-                    {
-                        counter++;
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-                else
+                if (ruleMatchesAt(current, bytes, j))
                 {
-                    if (((!rules->at(i)[k].exactly) && (rules->at(i)[k].byte != (bytes[j + k] & 0xFF))) ||
-                        (( rules->at(i)[k].exactly) && (rules->at(i)[k].byte == (bytes[j + k] & 0xFF))))
-                    {
-                        counter++;
-                    }
-                    else
-                    {
-                        break;
-                    }
+                    *pos  = qMax(j, 0);
+                    *rule = i;
+                    return *pos;
                 }
             }
+            continue;
+        }
+
+        /* The anchor byte must lie inside the buffer, so only its
+         * occurrences are candidate placements */
+        qint32 p     = 0;
+        qint32 limit = last + anchor + 1;
+        while (p < limit)
+        {
+            qint32 found = CSMScan::find(data + p, limit - p,
+                                         current[anchor].byte);
+            if (found < 0)
+                break;
 
-            if (counter == rules->at(i).length())
+            p += found;
+            if (ruleMatchesAt(current, bytes, p - anchor))
             {
-                if (j < 0) j = 0;
-                *pos  = j;
+                *pos  = qMax(p - anchor, 0);
                 *rule = i;
-
                 return *pos;
             }
+            p++;
         }
     }
 
@@ -420,35 +1719,167 @@ qint32 CSMSpinner::ruleApplier(PreceptSet * rules, QByteArray bytes,
     return *pos;
 }
 
-qint32 CSMSpinner::sequenceBeginSearch(qint32 * pos, qint32 * rule)
+void CSMSpinner::bytesToWrite(QByteArray     bytes,
+                              qint32         requestedTimeout,
+                              qint32         priority,
+                              QDeadlineTimer deadline,
+                              bool           oneway,
+                              CSMPromise     promise,
+                              CSMWaiterPtr   waiter)
+{
+    CSMRequest request;
+
+    refreshConfig();
+    request.bytes    = bytes;
+    request.timeout  = requestedTimeout;
+    request.priority = priority;
+    request.deadline = deadline;
+    request.oneway   = oneway;
+    request.promise  = promise;
+    request.waiter   = waiter;
+
+    sendqueue.push(request);
+    processQueue();
+    /* Only what the pipeline could not take competes for the room */
+    trimQueue();
+}
+
+void CSMSpinner::shutdown(QThread * owner)
+{
+    /* Whoever waits on a transaction must not wait forever */
+    for (qint32 i = 0; i < inflight.length(); i++)
+        fail(inflight.at(i), CSMTransactException::Closed);
+    inflight.clear();
+    while (!sendqueue.isEmpty())
+    {
+        fail(sendqueue.pop(), CSMTransactException::Closed);
+        gauge->release();
+    }
+
+    flushWrites();
+    deadline->stop();
+    linegap->stop();
+    batchflush->stop();
+    portcopy->close();
+    moveToThread(owner);
+}
+
+void CSMSpinner::setReceiveCapacity(qint32 capacity)
+{
+    framer.setCapacity(capacity);
+    linegap->stop();
+    stats->setUnframed(0);
+}
+
+void CSMSpinner::setPipelineDepth(qint32 depth)
+{
+    pipelinedepth = depth;
+    processQueue();
+}
+
+void CSMSpinner::setCoalescing(qint32 window, qint32 budget)
+{
+    flushWrites();
+    coalescewindow = window;
+    coalescebudget = budget;
+    if (coalescewindow >= 0)
+        gathered.reserve(coalescebudget);
+}
+
+void CSMSpinner::setCapture(CSMCapture * target)
 {
-    return ruleApplier(beginseq, incoming, pos, rule);
+    capture = target;
 }
 
-qint32 CSMSpinner::sequenceEndSearch(qint32 * pos, qint32 * rule)
+void CSMSpinner::setFrameSink(CSMFrameSink callback, bool keepsignals)
 {
-    return ruleApplier(endseq, incoming, pos, rule);
+    sink        = callback;
+    sinksignals = keepsignals;
 }
 
-void CSMSpinner::bytesToWrite(QByteArray bytes, qint32 requestedTimeout)
+void CSMSpinner::setCorrelation(CSMCorrelation rule)
 {
-    if (!busy)
+    correlation = rule;
+    for (qint32 i = 0; i < inflight.length(); i++)
     {
-        busy = true;
-        emit parent->logWrite(bytes);
-        portcopy->write(bytes);
-        if (requestedTimeout == -1)
-        {
-            timeleft = ((float)bytes.length() * (float)*tpbcopy);
-        }
-        else
-        {
-            timeleft = requestedTimeout;
-        }
-        timeout.restart();
+        inflight[i].key = correlation.requestKey(inflight.at(i).bytes);
     }
-    else
+}
+
+bool CSMSpinner::reopen(QString portName)
+{
+    bool opened = portcopy->open(portName);
+
+    chartime = characterTime();
+
+    return opened;
+}
+
+QString CSMSpinner::portName()
+{
+    return portcopy->name();
+}
+
+bool CSMSpinner::isPortOpen()
+{
+    return portcopy->isOpen();
+}
+
+bool CSMSpinner::setLineSetting(qint32 setting, qint32 value)
+{
+    QSerialPort * line = portcopy->serialPort();
+    bool          done = false;
+
+    if (line == 0)
+        return false;
+
+    switch (setting)
+    {
+    case BaudRate:
+        done = line->setBaudRate(value);
+        break;
+    case Parity:
+        done = line->setParity((QSerialPort::Parity)value);
+        break;
+    case DataBits:
+        done = line->setDataBits((QSerialPort::DataBits)value);
+        break;
+    case StopBits:
+        done = line->setStopBits((QSerialPort::StopBits)value);
+        break;
+    case FlowControl:
+        done = line->setFlowControl((QSerialPort::FlowControl)value);
+        break;
+    default:
+        break;
+    }
+    /* Timeout budgets follow the line, read it here and nowhere else */
+    chartime = characterTime();
+
+    return done;
+}
+
+qint32 CSMSpinner::lineSetting(qint32 setting)
+{
+    QSerialPort * line = portcopy->serialPort();
+
+    /* Any channel has a rate, only a serial port has the rest */
+    if (setting == BaudRate)
+        return portcopy->baudRate();
+    if (line == 0)
+        return -1;
+
+    switch (setting)
     {
-        sendqueue.append(bytes);
+    case Parity:
+        return line->parity();
+    case DataBits:
+        return line->dataBits();
+    case StopBits:
+        return line->stopBits();
+    case FlowControl:
+        return line->flowControl();
+    default:
+        return -1;
     }
 }
@@ -15,9 +15,10 @@
  *
  *  Работа с устройством одновременно ведется в двух режимах:
  * - Работа в режиме прослушивания потока.
- *   + В данном режиме постоянно опрашивается COM-порт на предмет поступивших
- *     данных. В случае обнаружения сигнатуры конца (обязательно) и начала
- *     (если задано) пакета класс CSMCom испустит сигнал bytesOut.
+ *   + В данном режиме поступившие в COM-порт данные обрабатываются сразу по
+ *     сигналу готовности порта. В случае обнаружения сигнатуры конца
+ *     (обязательно) и начала (если задано) пакета класс CSMCom испустит сигнал
+ *     bytesOut.
  * - Работа в режиме "запрос-ответ".
  *   + В данном режиме на каждое отправленное сообщение предполагается ответ. В
  *     случае, если ответа не поступает до истечения времени таймаута, будет
@@ -31,9 +32,25 @@
  *  Также доступны следующие необязательные опции:
  *
  * - Установка значения beginSequence.
- * - Подключение к слоту bytesIn.
+ * - Установка байт-стаффинга setStuffing (SLIP, HDLC, COBS).
+ * - Установка контрольной суммы setChecksum и подключение к сигналу
+ *   bytesInvalid.
+ * - Подключение к слоту bytesIn (bytesInOneWay для сообщений без ответа) или
+ *   вызов transact.
  * - Подключение к сигналу bytesTimeout.
  * - Подключение к сигналу bytesOut.
+ * - Подключение к сигналу bytesOutBatch и установка окна setBatchWindow.
+ * - Установка обработчика пакетов в потоке ввода-вывода setFrameCallback.
+ * - Объединение записей в порт setCoalescing.
+ * - Подключение к сигналу bytesExpired при отправке сообщений со сроком.
+ * - Ограничение очереди отправки setSendQueueCapacity и приемного буфера
+ *   setReceiveCapacity, подключение к сигналам bytesDropped, sendQueueHigh
+ *   и sendQueueLow.
+ * - Размер пула буферов пакетов и сообщений setBufferPoolSize, сообщения в
+ *   буферах пула allocate.
+ * - Установка глубины конвейера setPipelineDepth и ключа сопоставления
+ *   ответов setCorrelationKey, подключение к сигналам replyReceived и
+ *   requestTimeout.
  * - Подключение к сигналу logOut.
  * - Подключение к сигналу logIn.
  * - Подключение к сигналу logTimeout.
@@ -42,49 +59,29 @@
  *  \date   26.04.2014
  */
 
-#include <QSerialPort>
 #include <QList>
 #include <QVector>
 #include <QObject>
 #include <QThread>
-#include <QTime>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QFuture>
+#include <QMetaType>
+#include <functional>
+#include <memory>
 
-class CSMSpinner;
-
-/*!
- * \brief Структура, определяющая один байт правила
- */
-struct PreceptByte
-{
-    /*!
-     * \brief Флаг выбора байта. Значение TRUE - использовать байт byte,
-     * значение FALSE - использовать любой байт кроме byte.
-     */
-    bool     exactly;
-    /*!
-     * \brief Значение байта, задающего правило.
-     */
-    quint8   byte;
+#include "csmframer.hpp"
+#include "csmchecksum.hpp"
+#include "csmstuffing.hpp"
+#include "csmqueue.hpp"
+#include "csmpool.hpp"
+#include "csmreactor.hpp"
+#include "csmstats.hpp"
+#include "csmcapture.hpp"
+#include "csmtransport.hpp"
 
-    /*!
-     * \brief Конструктор по умолчанию для обеспечения компиляции кода.
-     */
-    PreceptByte() {}
-    /*!
-     * \brief Основной инициализирующий конструктор
-     * \param flag Флаг выбора байта
-     * \param val Значение байта
-     */
-    PreceptByte(bool flag, quint8 val) : exactly(flag), byte(val) {}
-};
-/*!
- * \brief Shortcut для описания последовательности.
- */
-typedef QVector<PreceptByte > PreceptArray;
-/*!
- * \brief Short для задания набора последовательностей.
- */
-typedef QList  <PreceptArray> PreceptSet;
+class CSMSpinner;
 
 /*!
  *  \brief Порт, открываемый по умолчанию.
@@ -112,21 +109,192 @@ typedef QList  <PreceptArray> PreceptSet;
 /*!
  *  \brief Значение по умолчанию для коэффициента таймаута
  *
- *  Используется в процессе инициализации класса. В мс.
+ *  Используется в процессе инициализации класса. В мс. Значение 0 означает
+ * расчет таймаута по скорости линии.
+ */
+#define CT_DEFAULT_TPB 0.0
+/*!
+ *  \brief Время реакции устройства по умолчанию
+ *
+ *  Добавляется к времени передачи запроса и ответа по линии. В мс.
+ */
+#define CT_DEFAULT_TURNAROUND 50
+/*!
+ *  \brief Наибольшее время реакции устройства при адаптивном таймауте
+ *
+ *  Ограничивает удвоение оценки после таймаутов. В мс.
+ */
+#define CT_MAX_TURNAROUND 60000
+/*!
+ *  \brief Пауза в линии, после которой данные считаются законченными
+ *
+ *  Если правило конца пакета заканчивается байтами exactly=false, а после
+ * последнего байта exactly=true данных не поступает в течение этого времени,
+ * пакет выдается без ожидания следующего байта. В мс.
  */
-#define CT_DEFAULT_TPB 500.0
+#define CT_DEFAULT_LINEGAP 20
 /*!
- *  \brief Значение по умолчанию для частоты опроса кольца
+ *  \brief Окно накопления пакетов для сигнала bytesOutBatch по умолчанию
  *
- *  Используется в while цикле класса CSMSpinner
+ *  Значение -1 отключает пакетную выдачу, значение 0 означает выдачу всех
+ * пакетов, найденных за одно чтение порта. В мс.
  */
-#define CT_DEFAULT_RINGPERIOD 100
+#define CT_DEFAULT_BATCHWINDOW -1
+/*!
+ *  \brief Число запросов, одновременно ожидающих ответа, по умолчанию
+ *
+ *  Значение 1 - следующий запрос отправляется только после ответа или
+ * таймаута предыдущего.
+ */
+#define CT_DEFAULT_PIPELINEDEPTH 1
+/*!
+ *  \brief Окно объединения записей в порт по умолчанию
+ *
+ *  Значение -1 отключает объединение, значение 0 объединяет сообщения,
+ * отправленные за один проход очереди отправки. В мкс.
+ */
+#define CT_DEFAULT_COALESCEWINDOW -1
+/*!
+ *  \brief Наибольший объем объединенной записи в порт по умолчанию, байт
+ */
+#define CT_DEFAULT_COALESCEBUDGET 4096
+/*!
+ *  \brief Период сигнала statisticsReady по умолчанию
+ *
+ *  Значение -1 отключает сигнал; снимок всегда доступен функцией statistics.
+ * В мс.
+ */
+#define CT_DEFAULT_STATSINTERVAL -1
+/*!
+ *  \brief Размер буфера для bytesToHex
+ */
+#define CT_HEX_LENGTH(length) ((length) * 3 + (length) / 16 + 1)
+
+/*!
+ *  \brief Функция извлечения ключа сопоставления из запроса или ответа
+ */
+typedef std::function<QByteArray (const QByteArray &)> CSMKeyExtractor;
+
+/*!
+ *  \brief Правило сопоставления ответов запросам
+ *
+ *  Ключ берется либо из байт по смещению (offset/length), либо функциями
+ * requestkey/responsekey, если они заданы. Ответ относится к самому раннему
+ * ожидающему запросу с тем же ключом. Пустое правило (length == 0, функции
+ * не заданы) относит любой ответ к самому раннему запросу.
+ */
+struct CSMCorrelation
+{
+    /*!
+     *  \brief Смещение ключа в запросе
+     */
+    qint32 requestoffset;
+    /*!
+     *  \brief Смещение ключа в ответе
+     */
+    qint32 responseoffset;
+    /*!
+     *  \brief Длина ключа, 0 - сопоставление по смещению не используется
+     */
+    qint32 length;
+    /*!
+     *  \brief Функция извлечения ключа из запроса
+     */
+    CSMKeyExtractor requestkey;
+    /*!
+     *  \brief Функция извлечения ключа из ответа
+     */
+    CSMKeyExtractor responsekey;
+
+    /*!
+     *  \brief Конструктор пустого правила
+     */
+    CSMCorrelation() : requestoffset(0), responseoffset(0), length(0) {}
+
+    /*!
+     *  \brief Признак заданного правила
+     */
+    bool isEnabled() const;
+    /*!
+     *  \brief Ключ запроса
+     *  \param request Запрос
+     *  \return Ключ, пустой, если запрос короче ключа
+     */
+    QByteArray requestKey(const QByteArray & request) const;
+    /*!
+     *  \brief Ключ ответа
+     *  \param response Ответ
+     *  \return Ключ, пустой, если ответ короче ключа
+     */
+    QByteArray responseKey(const QByteArray & response) const;
+};
+Q_DECLARE_METATYPE(CSMCorrelation)
+Q_DECLARE_METATYPE(CSMFrameSink)
+Q_DECLARE_METATYPE(CSMPromise)
+Q_DECLARE_METATYPE(CSMWaiterPtr)
+
+/*!
+ *  \brief Снимок настроек выделения пакетов
+ *
+ *  Снимок не изменяется после публикации. CSMCom при каждой настройке
+ * собирает новый снимок и атомарно подменяет указатель, CSMSpinner забирает
+ * актуальный указатель при каждом пробуждении. Старый снимок освобождается,
+ * когда его перестает использовать последний владелец.
+ */
+struct CSMConfig
+{
+    /*!
+     *  \brief Правила начала пакета
+     */
+    PreceptSet beginseq;
+    /*!
+     *  \brief Правила конца пакета
+     */
+    PreceptSet endseq;
+    /*!
+     *  \brief Поле длины пакета
+     */
+    CSMLengthField lengthfield;
+    /*!
+     *  \brief Контрольная сумма пакетов
+     */
+    CSMChecksum checksum;
+    /*!
+     *  \brief Протокол байт-стаффинга
+     */
+    CSMStuffing::Mode stuffing;
+    /*!
+     *  \brief Автомат, скомпилированный из beginseq, endseq и lengthfield
+     * (или из флага протокола stuffing)
+     *
+     *  Общий для снимков с одинаковыми правилами: смена других настроек не
+     * сбрасывает накопленные данные.
+     */
+    std::shared_ptr<const CSMMatcher> matcher;
+    /*!
+     *  \brief Коэффициент таймаута, мс/байт, 0 - расчет по скорости линии
+     */
+    qreal      tpb;
+    /*!
+     *  \brief Время реакции устройства, мс
+     */
+    qint32     turnaround;
+    /*!
+     *  \brief Флаг подстройки времени реакции по измеренным ответам
+     */
+    bool       adaptive;
+};
+/*!
+ *  \brief Указатель на опубликованный снимок настроек
+ */
+typedef std::shared_ptr<const CSMConfig> CSMConfigPtr;
 
 /*!
  * \brief Класс работы с COM-портом
  *
  * Использует QSerialPort для обеспечения кроссплатформенного доступа к COM-
- * порту.
+ * порту. Вместо порта может быть передан любой канал CSMTransport, например
+ * псевдотерминал для проверки без оборудования.
  */
 class CSMCom : public QObject
 {
@@ -147,6 +315,18 @@ public:
      */
     CSMCom(QString portName = CT_DEFAULT_PORTNAME,
            qint32  baudRate = CT_DEFAULT_BAUDRATE);
+    /*!
+     *  \brief Конструктор класса поверх произвольного канала.
+     *
+     *  CSMCom становится владельцем канала. Канал должен быть открыт; функции
+     * настройки линии (setParity и др.) работают, только если канал является
+     * последовательным портом (см. CSMTransport::serialPort).
+     *  \param transport Канал передачи байт
+     *
+     * \see CSMSerialTransport
+     * \see CSMPtyTransport
+     */
+    CSMCom(CSMTransport * transport);
     /*!
      *  \brief Деструктор класса.
      *
@@ -165,7 +345,14 @@ public slots:
       * отправки данных через некоторое время будет испущен либо сигнал
       * bytesOut либо сигнал timeout.
       *  До момента, пока не будет испущен ответный сигнал вместо физической
-      * отправки данных они будут помещены в очередь сообщений.
+      * отправки данных они будут помещены в очередь сообщений. При глубине
+      * конвейера больше 1 (см. setPipelineDepth) без ожидания ответа
+      * отправляется соответствующее число сообщений, каждое со своим
+      * таймаутом.
+      *
+      *  По умолчанию очередь не ограничена. Если емкость задана
+      * setSendQueueCapacity и очередь заполнена, при действиях DropNewest и
+      * Reject сообщение не принимается.
       *
       * \todo Обсудить возможность отложенной записи в случае отсутствия устройства,
       * но наличия данных для записи.
@@ -173,8 +360,46 @@ public slots:
       * \param bytes Байтовая последовательность для записи.
       * \param requestedTimeout Требуемый таймаут. По умолчанию вычисляется
       * по коэффициенту tpb.
+      * \return false, если сообщение не принято в очередь
       */
-     void bytesIn(QByteArray bytes, qint32 requestedTimeout = -1);
+     bool bytesIn(QByteArray bytes, qint32 requestedTimeout = -1);
+     /*!
+      *  \brief Слот записи потока байт с приоритетом и сроком.
+      *
+      *  Аналогичен bytesIn(QByteArray, qint32), но в очереди сообщение
+      * обгоняет все сообщения с меньшим приоритетом. Если к моменту отправки
+      * срок deadline истек, сообщение не отправляется, а испускается сигнал
+      * bytesExpired.
+      *
+      * \param bytes Байтовая последовательность для записи.
+      * \param priority Приоритет, больше - срочнее. См. CT_DEFAULT_PRIORITY.
+      * \param deadline Срок, после которого сообщение теряет смысл.
+      * \param requestedTimeout Требуемый таймаут ответа.
+      * \return false, если сообщение не принято в очередь
+      */
+     bool bytesIn(QByteArray bytes, qint32 priority, QDeadlineTimer deadline,
+                  qint32 requestedTimeout = -1);
+     /*!
+      *  \brief Слот записи сообщения, не требующего ответа.
+      *
+      *  Сообщение проходит общую очередь (с приоритетом и сроком, как в
+      * bytesIn), но не занимает место в конвейере запросов и не взводит
+      * таймаут: как только оно оказывается первым в очереди, оно записывается
+      * в порт, и очередь сразу переходит к следующему сообщению. Ни ответ, ни
+      * таймаут ему не сопоставляются. Подходит для широковещательных команд,
+      * уведомлений и поддержания связи.
+      *
+      *  Порядок очереди сохраняется: сообщение с тем же приоритетом, что и
+      * запрос, ожидающий места в конвейере, отправляется после этого запроса.
+      *
+      * \param bytes Байтовая последовательность для записи.
+      * \param priority Приоритет, больше - срочнее. См. CT_DEFAULT_PRIORITY.
+      * \param deadline Срок, после которого сообщение теряет смысл.
+      * \return false, если сообщение не принято в очередь
+      */
+     bool bytesInOneWay(QByteArray     bytes,
+                        qint32         priority = CT_DEFAULT_PRIORITY,
+                        QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever));
 signals:
      /*!
       *  \brief Сигнал полученных данных.
@@ -186,6 +411,83 @@ signals:
       *  \param bytes Байтовая последовательность из накопительного буфера.
       */
      void bytesOut(QByteArray bytes);
+     /*!
+      *  \brief Сигнал пачки полученных пакетов.
+      *
+      *  Испускается только при включенной пакетной выдаче (см.
+      * setBatchWindow) один раз на все пакеты, накопленные за окно. Сигнал
+      * bytesOut при этом испускается для каждого пакета пачки, как и прежде.
+      *
+      *  \param packets Пакеты в порядке получения.
+      */
+     void bytesOutBatch(QVector<QByteArray> packets);
+     /*!
+      *  \brief Сигнал пакета с неверной контрольной суммой
+      *
+      *  Испускается вместо bytesOut, если контрольная сумма пакета не сошлась
+      * и задано действие CSMChecksum::Flag.
+      *
+      *  \param bytes Пакет
+      *  \see setChecksum
+      */
+     void bytesInvalid(QByteArray bytes);
+     /*!
+      *  \brief Сигнал ответа на запрос
+      *
+      *  Испускается вместе с bytesOut, если полученный пакет сопоставлен
+      * одному из ожидающих ответа запросов.
+      *
+      *  \param request Запрос, как он был передан в bytesIn
+      *  \param reply Ответ
+      *  \see setCorrelationKey
+      */
+     void replyReceived(QByteArray request, QByteArray reply);
+     /*!
+      *  \brief Сигнал таймаута конкретного запроса
+      *
+      *  Испускается вместе с timeout.
+      *
+      *  \param request Запрос, ответ на который не был получен
+      */
+     void requestTimeout(QByteArray request);
+     /*!
+      *  \brief Сигнал просроченного сообщения
+      *
+      *  Испускается вместо отправки сообщения, срок которого истек, пока оно
+      * ждало в очереди.
+      *
+      *  \param bytes Сообщение, как оно было передано в bytesIn
+      */
+     void bytesExpired(QByteArray bytes);
+     /*!
+      *  \brief Сигнал сообщения, отброшенного при переполнении очереди
+      *
+      *  Испускается при действиях DropOldest (для вытесненного сообщения) и
+      * DropNewest (для нового).
+      *
+      *  \param bytes Сообщение, как оно было передано в bytesIn
+      *  \see setSendQueueCapacity
+      */
+     void bytesDropped(QByteArray bytes);
+     /*!
+      *  \brief Сигнал достижения верхнего порога очереди отправки
+      *
+      *  Испускается один раз, пока длина не опустится до нижнего порога.
+      * Отправителю следует притормозить.
+      *
+      *  \param depth Длина очереди
+      *  \see setSendQueueWatermarks
+      */
+     void sendQueueHigh(qint32 depth);
+     /*!
+      *  \brief Сигнал опускания очереди отправки до нижнего порога
+      *
+      *  Испускается из потока ввода-вывода после sendQueueHigh.
+      *
+      *  \param depth Длина очереди
+      *  \see setSendQueueWatermarks
+      */
+     void sendQueueLow(qint32 depth);
      /*!
       *  \brief Сигнал таймаута
       *
@@ -234,8 +536,78 @@ signals:
        * \see timeout
        */
       void logTimeout();
+      /*!
+       *  \brief Сигнал периодического снимка статистики
+       *
+       *  Испускается с периодом, заданным setStatisticsInterval. Снимок
+       * совпадает с тем, что возвращает statistics.
+       *
+       *  \param stats Снимок статистики
+       *  \see statistics
+       */
+      void statisticsReady(CSMStatistics stats);
 
 public:
+    /*!
+     *  \brief Транзакция "запрос-ответ".
+     *
+     *  Запрос ставится в общую очередь так же, как bytesIn, а возвращенный
+     * QFuture завершается ответом, сопоставленным именно этому запросу (по
+     * ключу setCorrelationKey или по порядку). Если ответ не получен, future
+     * завершается ошибкой CSMTransactException, которую выбрасывает result();
+     * причина - таймаут, истекший срок, вытеснение из очереди, отказ в приеме
+     * или закрытие порта. Сигналы bytesOut, replyReceived и timeout
+     * испускаются, как и для bytesIn.
+     *
+     *  Транзакций может быть сколько угодно одновременно; параллельно
+     * устройству отправляется столько, сколько позволяет глубина конвейера.
+     * Отмена future (cancel) снимает запрос, еще не отправленный в порт;
+     * отправленный запрос дожидается ответа или таймаута, чтобы не нарушить
+     * сопоставление, но результат уже никому не передается.
+     *
+     *  Ожидать результат можно через QFutureWatcher или блокирующим result().
+     * Блокирующее ожидание в потоке ввода-вывода порта приводит к
+     * взаимоблокировке.
+     *
+     *  \param request Запрос
+     *  \param requestedTimeout Требуемый таймаут ответа, мс. По умолчанию
+     * вычисляется по настройкам порта.
+     *  \param priority Приоритет, больше - срочнее
+     *  \param deadline Срок, после которого запрос не отправляется
+     *  \return Ответ или ошибка CSMTransactException
+     */
+    QFuture<QByteArray> transact(QByteArray     request,
+                                 qint32         requestedTimeout = -1,
+                                 qint32         priority = CT_DEFAULT_PRIORITY,
+                                 QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever));
+    /*!
+     *  \brief Блокирующая транзакция "запрос-ответ".
+     *
+     *  Для потоков без цикла событий: запрос ставится в общую очередь, как в
+     * transact с QFuture, а вызывающий поток спит на условной переменной до
+     * ответа или до крайнего срока и сразу получает ответ. Ни QFuture, ни
+     * доставки сигналов в поток не требуется.
+     *
+     *  Безопасно вызывать из нескольких потоков одновременно: запросы
+     * упорядочиваются очередью отправки в потоке ввода-вывода и сопоставляются
+     * с ответами, как обычно. Срок ограничивает и ожидание в очереди, и
+     * таймаут ответа; если он вышел, запрос, еще не отправленный в порт,
+     * снимается, а отправленный дожидается ответа без вызывающего потока.
+     *
+     *  Вызов из потока ввода-вывода порта (например, из обработчика
+     * setFrameCallback) привел бы к взаимоблокировке и сразу отвергается.
+     *
+     *  \param request Запрос
+     *  \param deadline Крайний срок получения ответа
+     *  \param ok Признак успеха или 0
+     *  \param reason Причина ошибки или 0. Отказ в потоке ввода-вывода -
+     * CSMTransactException::Rejected, вышедший срок - Timeout.
+     *  \return Ответ или пустой массив при ошибке
+     */
+    QByteArray transact(QByteArray                     request,
+                        QDeadlineTimer                 deadline,
+                        bool                         * ok = 0,
+                        CSMTransactException::Reason * reason = 0);
     /*!
      *  \brief Вернуть имя текущего порта.
      *
@@ -290,6 +662,8 @@ public:
      * endSequence включая их будет передана сигналом bytesOut().
      * В случае, если найдено более одного совпадения будет
      * испущено соответствующее количество сигналов.
+     *  Правила компилируются в автомат CSMMatcher в момент установки; если
+     * автомат получается слишком большим, правила не принимаются.
      *  \param newseq Новая последовательность.
      *  \return Статус успешности установки новой последовательности.
      *  \see startSequence
@@ -312,12 +686,76 @@ public:
      * endSequence включая их будет передана сигналом bytesOut().
      * В случае, если найдено более одного совпадения будет
      * испущено соответствующее количество сигналов. Инициализируется значением
-     * [CT_DEFAULT_ENDSEQ](@ref CT_DEFAULT_ENDSEQ).
+     * [CT_DEFAULT_ENDSEQ](@ref CT_DEFAULT_ENDSEQ). Правила компилируются в
+     * автомат CSMMatcher в момент установки.
      *  \param newseq Новая последовательность.
      *  \return Статус успешности установки новой последовательности.
      *  \see finalSequence
      */
     bool setEndSequence(PreceptSet newseq);
+    /*!
+     *  \brief Возврат текущего описания поля длины пакета.
+     *  \return Описание поля длины.
+     *  \see setLengthField
+     */
+    CSMLengthField lengthField();
+    /*!
+     *  \brief Установка поля длины пакета.
+     *
+     *  Для протоколов, в которых длина пакета указана в его заголовке. Пакет
+     * по-прежнему начинается с последовательности beginSequence (если она
+     * задана), но его конец определяется значением поля длины, а не поиском
+     * endSequence: как только получено указанное число байт, пакет выдается
+     * сигналом bytesOut. Байты конца пакета внутри тела не мешают выделению.
+     * Пакет с недопустимым значением длины пропускается, поиск начала
+     * продолжается со следующего байта.
+     *  Выключенное поле (width = 0) возвращает поиск по endSequence.
+     *  \param field Описание поля длины.
+     *  \return Статус успешности установки.
+     *  \see CSMLengthField
+     */
+    bool setLengthField(CSMLengthField field);
+    /*!
+     *  \brief Возврат текущей контрольной суммы пакетов.
+     *  \return Описание контрольной суммы.
+     *  \see setChecksum
+     */
+    CSMChecksum checksum();
+    /*!
+     *  \brief Установка контрольной суммы пакетов.
+     *
+     *  Каждый выделенный пакет проверяется в потоке ввода-вывода, до
+     * отправки сигнала bytesOut. Пакет с неверной суммой не выдается и не
+     * считается ответом на запрос: он отбрасывается с предупреждением
+     * logWarning или выдается сигналом bytesInvalid, в зависимости от
+     * CSMChecksum::policy. Поиск следующего пакета продолжается со следующего
+     * за началом поврежденного пакета байта.
+     *  Отключенная сумма (CSMChecksum()) выключает проверку.
+     *  \param newchecksum Описание контрольной суммы.
+     *  \return Статус успешности установки.
+     *  \see CSMChecksum
+     */
+    bool setChecksum(CSMChecksum newchecksum);
+    /*!
+     *  \brief Возврат текущего протокола байт-стаффинга.
+     *  \return Протокол.
+     *  \see setStuffing
+     */
+    CSMStuffing::Mode stuffing();
+    /*!
+     *  \brief Установка протокола байт-стаффинга.
+     *
+     *  Для устройств, которые разделяют пакеты байтом-флагом и заменяют его
+     * вхождения в данных (SLIP, HDLC) или перекодируют данные (COBS). Пока
+     * протокол установлен, пакеты выделяются по флагу, а beginSequence,
+     * endSequence и lengthField не используются. Сигнал bytesOut выдает
+     * декодированные пакеты, сообщения bytesIn кодируются перед записью в
+     * порт. Пустые пакеты (подряд идущие флаги) пропускаются, пакеты с
+     * недопустимой последовательностью отбрасываются с предупреждением.
+     *  \param mode Протокол, CSMStuffing::None - выключить.
+     *  \return Статус успешности установки.
+     */
+    bool setStuffing(CSMStuffing::Mode mode);
     /*!
      *  \brief Возвращает текущий коэффициент таймаута.
      *
@@ -326,6 +764,11 @@ public:
      * ответа. Например значение 0.5 означает, что на каждый отправленный
      * функцией bytesIn() байт таймаут будет отодвинут на 500 мкс.
      *
+     *  Значение 0 (по умолчанию) включает расчет по скорости линии: время
+     * передачи символа вычисляется из скорости, числа бит данных, четности и
+     * стоповых бит порта, таймаут равен времени передачи запроса и ответа той
+     * же длины плюс время реакции устройства (см. setTurnaround).
+     *
      * \note Для систем с низкой частотой системного таймера суммарное
      * значение таймаута будет округлено по частоте таймера. Например,
      * если частота системного таймера 15 мс, а длина пакета 500 байт при
@@ -338,11 +781,294 @@ public:
     /*!
      *  \brief Установка значения коэффициента таймаута.
      *
-     *  \param timeout Значение коэффициента
+     *  \param timeout Значение коэффициента, 0 - расчет по скорости линии
      *  \return Статус успешности установки нового коэффициента.
      *  \see timeoutPerByte
      */
     bool setTimeoutPerByte(qreal timeout);
+    /*!
+     *  \brief Возвращает время реакции устройства.
+     *  \return Время в мс
+     *  \see setTurnaround
+     */
+    qint32 turnaround();
+    /*!
+     *  \brief Установка времени реакции устройства.
+     *
+     *  Время от приема последнего байта запроса до передачи первого байта
+     * ответа. Используется при расчете таймаута по скорости линии; при
+     * адаптивном таймауте - только до первого измеренного ответа.
+     *  \param time Время в мс, от 0
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_TURNAROUND
+     */
+    bool setTurnaround(qint32 time);
+    /*!
+     *  \brief Флаг адаптивного таймаута.
+     *  \see setAdaptiveTimeout
+     */
+    bool adaptiveTimeout();
+    /*!
+     *  \brief Включение адаптивного таймаута.
+     *
+     *  Время реакции устройства оценивается по каждому ответу, сопоставленному
+     * запросу: из времени ожидания вычитается время передачи запроса и ответа
+     * по линии, а оценка строится как среднее плюс четыре отклонения (как
+     * таймаут повтора TCP). Каждый таймаут удваивает оценку, но не выше
+     * CT_MAX_TURNAROUND. Действует только при расчете по скорости линии.
+     *  \param enabled Флаг
+     *  \return Статус успешности установки
+     */
+    bool setAdaptiveTimeout(bool enabled);
+    /*!
+     *  \brief Возвращает текущее окно накопления пакетов.
+     *  \return Окно в мс, -1 - пакетная выдача отключена.
+     *  \see setBatchWindow
+     */
+    qint32 batchWindow();
+    /*!
+     *  \brief Установка окна накопления пакетов.
+     *
+     *  При включенной пакетной выдаче найденные пакеты передаются из потока
+     * ввода-вывода не по одному, а пачкой: первый пакет пачки запускает окно,
+     * по истечении которого все накопленные пакеты выдаются сигналом
+     * bytesOutBatch. Значение 0 выдает пачку сразу после обработки очередного
+     * чтения порта, -1 отключает пакетную выдачу.
+     *
+     *  \param window Окно в мс
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_BATCHWINDOW
+     */
+    bool setBatchWindow(qint32 window);
+    /*!
+     *  \brief Возвращает глубину конвейера запросов.
+     *  \return Число запросов, одновременно ожидающих ответа
+     *  \see setPipelineDepth
+     */
+    qint32 pipelineDepth();
+    /*!
+     *  \brief Установка глубины конвейера запросов.
+     *
+     *  Позволяет отправить устройству несколько запросов, не дожидаясь ответа
+     * на первый. Имеет смысл для устройств, принимающих очередь команд; если
+     * устройство помечает ответы номером запроса, следует также задать
+     * setCorrelationKey, иначе ответы сопоставляются запросам по порядку.
+     *
+     *  \param depth Число запросов, одновременно ожидающих ответа, от 1
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_PIPELINEDEPTH
+     */
+    bool setPipelineDepth(qint32 depth);
+    /*!
+     *  \brief Возвращает окно объединения записей в порт.
+     *  \return Окно в мкс, -1 - объединение отключено
+     *  \see setCoalescing
+     */
+    qint32 coalesceWindow();
+    /*!
+     *  \brief Возвращает наибольший объем объединенной записи в порт.
+     *  \return Объем в байтах
+     *  \see setCoalescing
+     */
+    qint32 coalesceBudget();
+    /*!
+     *  \brief Установка объединения записей в порт.
+     *
+     *  Каждое сообщение обычно записывается в порт отдельным вызовом; при
+     * потоке мелких сообщений накладные расходы вызова и упаковка данных
+     * переходником USB-COM обходятся дороже самих данных. При включенном
+     * объединении сообщения без ответа (bytesInOneWay), отправляемые подряд,
+     * собираются в один буфер и записываются одним вызовом: по истечении
+     * окна, отсчитываемого от первого сообщения, или раньше, если следующее
+     * сообщение не помещается в budget байт. Окно 0 записывает собранное в
+     * конце каждого прохода очереди отправки, не задерживая сообщения.
+     *
+     *  Запрос, ожидающий ответа, не задерживается никогда: перед ним
+     * записывается собранное, затем он сам, поэтому его таймаут отсчитывается
+     * от фактической записи. Сообщение не меньше budget байт также
+     * записывается отдельно.
+     *
+     *  \param window Окно в мкс, 0 - в пределах прохода очереди, -1 -
+     * отключить объединение. Окно меньше 1 мс заканчивается на следующем
+     * обороте цикла событий, более длинное отсчитывается точным таймером с
+     * округлением до мс.
+     *  \param budget Наибольший объем одной записи, байт, от 1
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_COALESCEWINDOW
+     *  \see CT_DEFAULT_COALESCEBUDGET
+     */
+    bool setCoalescing(qint32 window,
+                       qint32 budget = CT_DEFAULT_COALESCEBUDGET);
+    /*!
+     *  \brief Возвращает наибольшую длину очереди отправки.
+     *  \return Длина, -1 - без ограничения
+     *  \see setSendQueueCapacity
+     */
+    qint32 sendQueueCapacity();
+    /*!
+     *  \brief Возвращает действие при переполнении очереди отправки.
+     *  \see setSendQueueCapacity
+     */
+    CSMSendQueue::Policy sendQueuePolicy();
+    /*!
+     *  \brief Установка наибольшей длины очереди отправки.
+     *
+     *  В длину входят сообщения, принятые bytesIn и еще не записанные в порт
+     * (или просроченные). Когда очередь заполнена, новое сообщение либо
+     * вытесняет самое старое сообщение с наименьшим приоритетом (DropOldest),
+     * либо отбрасывается (DropNewest) - в обоих случаях с сигналом
+     * bytesDropped, - либо отвергается с предупреждением (Reject). При
+     * DropNewest и Reject bytesIn возвращает false.
+     *
+     *  По умолчанию ограничения нет (CT_DEFAULT_QUEUECAPACITY).
+     *
+     *  \param capacity Длина, от 1; -1 - без ограничения
+     *  \param policy Действие при переполнении
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_QUEUECAPACITY
+     */
+    bool setSendQueueCapacity(qint32 capacity,
+                              CSMSendQueue::Policy policy = CSMSendQueue::Reject);
+    /*!
+     *  \brief Установка порогов длины очереди отправки.
+     *
+     *  Когда длина достигает high, испускается сигнал sendQueueHigh; когда
+     * после этого она опускается до low - сигнал sendQueueLow.
+     *  \param high Верхний порог, от 1; -1 - сигналы отключены
+     *  \param low Нижний порог, от 0 и меньше high
+     *  \return Статус успешности установки
+     */
+    bool setSendQueueWatermarks(qint32 high, qint32 low);
+    /*!
+     *  \brief Возвращает емкость приемного буфера.
+     *  \return Емкость в байтах
+     *  \see setReceiveCapacity
+     */
+    qint32 receiveCapacity();
+    /*!
+     *  \brief Установка емкости приемного буфера.
+     *
+     *  Буфер выделяется один раз и не растет. Пакет длиннее емкости выделить
+     * невозможно, поэтому при заполнении буфера незавершенный пакет
+     * отбрасывается с предупреждением и учетом в статистике (overflows), а
+     * поиск продолжается по новым данным. Накопленные данные при установке
+     * сбрасываются.
+     *  \param capacity Емкость в байтах, от 1
+     *  \return Статус успешности установки
+     *  \see CT_FRAMER_CAPACITY
+     */
+    bool setReceiveCapacity(qint32 capacity);
+    /*!
+     *  \brief Возвращает число буферов в пуле порта.
+     *  \return Число буферов, 0 - пул отключен
+     *  \see setBufferPoolSize
+     */
+    qint32 bufferPoolSize();
+    /*!
+     *  \brief Установка числа буферов в пуле порта.
+     *
+     *  Пакеты, испускаемые портом, копируются в буферы пула: буфер, все
+     * получатели которого отпустили пакет, используется снова без выделения
+     * памяти. Число буферов должно покрывать пакеты, одновременно
+     * удерживаемые приложением и очередью сигналов; при нехватке пакет
+     * размещается обычным образом. Попадания и промахи пула видны в
+     * статистике (poolhits, poolmisses).
+     *  \param size Число буферов, от 0; 0 - пул отключен
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_POOLSIZE
+     */
+    bool setBufferPoolSize(qint32 size);
+    /*!
+     *  \brief Сообщение в буфере пула порта.
+     *
+     *  Копирует данные в свободный буфер пула. Подходит для сообщений,
+     * которые собираются в собственном массиве отправителя и передаются в
+     * bytesIn или transact: после отправки и ответа буфер возвращается в пул.
+     * Потокобезопасна.
+     *  \param data Данные
+     *  \param length Длина данных
+     *  \return Сообщение
+     */
+    QByteArray allocate(const char * data, qint32 length);
+    /*!
+     *  \brief Снимок статистики порта.
+     *
+     *  Счетчики обновляются потоком ввода-вывода без блокировок; вызов не
+     * обращается к этому потоку и может выполняться из любого потока сколь
+     * угодно часто.
+     *  \return Снимок статистики
+     *  \see CSMStatistics
+     */
+    CSMStatistics statistics();
+    /*!
+     *  \brief Возвращает период сигнала statisticsReady.
+     *  \return Период в мс, -1 - сигнал отключен
+     */
+    qint32 statisticsInterval();
+    /*!
+     *  \brief Установка периода сигнала statisticsReady.
+     *  \param interval Период в мс, от 1; -1 отключает сигнал
+     *  \return Статус успешности установки
+     *  \see CT_DEFAULT_STATSINTERVAL
+     */
+    bool setStatisticsInterval(qint32 interval);
+    /*!
+     *  \brief Подключение записи сеанса.
+     *
+     *  С момента возврата из функции каждая порция данных, записанная в порт
+     * или прочитанная из него, каждый таймаут и каждое предупреждение
+     * попадают в запись. Принятые данные записываются до выделения пакетов.
+     *  \param capture Открытая запись; 0 - отключить запись. Должна жить, пока
+     * подключена.
+     *  \see CSMCapture
+     *  \see CSMCaptureReader
+     */
+    void setCapture(CSMCapture * capture);
+    /*!
+     *  \brief Установка обработчика пакетов в потоке ввода-вывода.
+     *
+     *  Обычно пакет доходит до приложения двумя переходами между потоками
+     * (CSMSpinner::bytesOut, затем CSMCom::bytesOut), каждый - постановка
+     * события в очередь с копированием аргументов. Обработчик вызывается
+     * прямо в потоке ввода-вывода для каждого выделенного пакета (после
+     * снятия стаффинга и проверки суммы) и получает пакет без копирования:
+     * ссылка действительна только во время вызова, данные нужно скопировать,
+     * если они нужны дольше. Обработчик должен быть потокобезопасным и
+     * быстрым - пока он работает, порт не читается.
+     *
+     *  Без keepSignals сигналы bytesOut, bytesOutBatch и logRead для пакетов
+     * не испускаются; replyReceived испускается как обычно.
+     *
+     *  После возврата из функции прежний обработчик больше не вызывается.
+     *  \param callback Обработчик; пустой - отключить
+     *  \param keepSignals Испускать сигналы пакетов и при заданном обработчике
+     */
+    void setFrameCallback(CSMFrameSink callback, bool keepSignals = false);
+    /*!
+     *  \brief Установка ключа сопоставления ответов запросам по смещению.
+     *
+     *  Ключ - length байт запроса начиная с requestOffset, в ответе - length
+     * байт начиная с responseOffset. Значение length = 0 отключает
+     * сопоставление: ответ относится к самому раннему запросу.
+     *
+     *  \param requestOffset Смещение ключа в запросе
+     *  \param responseOffset Смещение ключа в ответе
+     *  \param length Длина ключа
+     *  \return Статус успешности установки
+     */
+    bool setCorrelationKey(qint32 requestOffset, qint32 responseOffset,
+                           qint32 length);
+    /*!
+     *  \brief Установка ключа сопоставления ответов запросам функциями.
+     *
+     *  Функции вызываются в потоке ввода-вывода.
+     *
+     *  \param requestKey Функция извлечения ключа из запроса
+     *  \param responseKey Функция извлечения ключа из ответа
+     *  \return Статус успешности установки
+     */
+    bool setCorrelationKey(CSMKeyExtractor requestKey,
+                           CSMKeyExtractor responseKey);
     /*!
      * \brief Установка четности порта
      * \param parity Значение четности
@@ -404,6 +1130,17 @@ public:
      *  \return  Выходная строка
      */
     static QString bytesToString(QByteArray bytes);
+    /*!
+     *  \brief Перевод байт в шестнадцатеричную запись без выделения памяти
+     *
+     *  Формат совпадает с bytesToString: "AA BB ", перевод строки после
+     * каждых 16 байт и в конце. Кодирование табличное.
+     *  \param data Байты
+     *  \param length Число байт
+     *  \param out Буфер размером не меньше CT_HEX_LENGTH(length)
+     *  \return Число записанных символов
+     */
+    static qint32 bytesToHex(const char * data, qint32 length, char * out);
 
 private slots:
     /*!
@@ -411,140 +1148,386 @@ private slots:
      *  \param bytes Прочитанные байты
      */
     void bytesReady(QByteArray bytes);
+    /*!
+     *  \brief Слот, реализующий вызовы сигналов родителя для пачки пакетов
+     *  \param packets Пакеты
+     */
+    void batchReady(QVector<QByteArray> packets);
+    /*!
+     *  \brief Слот таймера статистики
+     */
+    void statisticsExpired();
 
 private:
     /*!
-     *  \brief Переменная QSerialPort, используемая для базовой реализации
+     *  \brief Общая часть конструкторов: настройки по умолчанию, обработчик
+     * и поток ввода-вывода
      */
-    QSerialPort port;
+    void start();
     /*!
-     *  \brief Переменная, содержащая текущую начинающую последовательность
-     * для корректного пакета
+     *  \brief Публикация нового снимка настроек
+     *  \param next Новый снимок
      */
-    PreceptSet  beginseq;
+    void publish(CSMConfig * next);
     /*!
-     *  \brief Переменная, содержащая текущую завершающую последовательность
-     * для корректного пакета
+     *  \brief Компиляция автомата и публикация нового снимка настроек
+     *
+     *  Если автомат получается слишком большим, снимок удаляется.
+     *  \param next Новый снимок
+     *  \return Статус успешности компиляции
      */
-    PreceptSet  endseq;
+    bool publishRules(CSMConfig * next);
     /*!
-     *  \brief Переменная, содержащая текущее значение timeout-per-byte.
+     *  \brief Тип соединения для синхронного вызова обработчика
      *
-     *  \see timeoutPerByte
-     *  \see setTimeoutPerByte
+     *  Если CSMCom сам живет в потоке ввода-вывода, блокирующий вызов привел
+     * бы к взаимоблокировке, поэтому вызов выполняется напрямую.
      */
-    qreal tpb;
+    Qt::ConnectionType blockingConnection();
     /*!
-     *  \brief Поток, обеспечивающий чтение данных из потока
+     *  \brief Установка параметра линии в потоке ввода-вывода
+     *  \param setting Параметр, CSMSpinner::LineSetting
+     *  \param value Значение
+     *  \return Статус успешности установки
+     */
+    bool setLineSetting(qint32 setting, qint32 value);
+    /*!
+     *  \brief Значение параметра линии из потока ввода-вывода
+     *  \param setting Параметр, CSMSpinner::LineSetting
+     *  \return Значение, -1 - не последовательный порт
+     */
+    qint32 lineSetting(qint32 setting);
+    /*!
+     *  \brief Учет нового сообщения в длине очереди отправки
+     *  \param bytes Сообщение
+     *  \return false, если сообщение не принято
+     */
+    bool admit(const QByteArray & bytes);
+    /*!
+     *  \brief Канал, используемый для базовой реализации
+     *
+     *  Канал принадлежит объекту spinner и живет в потоке iothread.
+     */
+    CSMTransport * port;
+    /*!
+     *  \brief Опубликованный снимок настроек выделения пакетов
+     *
+     *  Изменяется только функцией publish; поток ввода-вывода читает его
+     * через std::atomic_load.
+     *
+     *  \see CSMConfig
+     */
+    CSMConfigPtr config;
+    /*!
+     *  \brief Окно накопления пакетов
+     *
+     *  \see setBatchWindow
+     */
+    qint32 batchwindow;
+    /*!
+     *  \brief Глубина конвейера запросов
+     *
+     *  \see setPipelineDepth
+     */
+    qint32 pipelinedepth;
+    /*!
+     *  \brief Окно объединения записей, мкс
+     *
+     *  \see setCoalescing
+     */
+    qint32 coalescewindow;
+    /*!
+     *  \brief Наибольший объем объединенной записи, байт
+     *
+     *  \see setCoalescing
+     */
+    qint32 coalescebudget;
+    /*!
+     *  \brief Правило сопоставления ответов запросам
+     *
+     *  \see setCorrelationKey
+     */
+    CSMCorrelation correlation;
+    /*!
+     *  \brief Счетчики статистики, обновляемые обработчиком
+     */
+    CSMStatCounters counters;
+    /*!
+     *  \brief Ограничитель длины очереди отправки
+     *
+     *  \see setSendQueueCapacity
+     */
+    CSMQueueGauge gauge;
+    /*!
+     *  \brief Пул буферов пакетов и сообщений
+     *
+     *  \see setBufferPoolSize
+     */
+    CSMBufferPool pool;
+    /*!
+     *  \brief Емкость приемного буфера
+     *
+     *  \see setReceiveCapacity
+     */
+    qint32 receivecapacity;
+    /*!
+     *  \brief Таймер сигнала statisticsReady
+     */
+    QTimer * statstimer;
+    /*!
+     *  \brief Подключенная запись сеанса
+     */
+    CSMCapture * capture;
+    /*!
+     *  \brief Обработчик порта, обеспечивающий чтение данных из потока
      *
      *  \see CSMSpinner
      */
     CSMSpinner * spinner;
+    /*!
+     *  \brief Поток ввода-вывода, в котором живут spinner и port
+     *
+     *  Выдается общим пулом CSMReactor и может обслуживать другие порты.
+     */
+    QPointer<QThread> iothread;
 };
 
 /*!
- *  \brief  Класс-поток для накопления данных с порта.
+ *  \brief  Класс-обработчик для накопления данных с порта.
  *
  *  Данный класс используется для сбора данных с порта. Класс использует данные
- * родителя (FoxCom) для обеспечения настроек выделения пакетов и доступа к
+ * родителя (CSMCom) для обеспечения настроек выделения пакетов и доступа к
  * порту. Этот класс не должен быть использован за пределами проекта Cosmic
  * Turtle.
  *
+ *  Объект живет в потоке ввода-вывода пула CSMReactor вместе с портом и не
+ * имеет собственного цикла опроса: чтение выполняется по сигналу readyRead
+ * порта, таймаут отслеживается одноразовым таймером.
+ *
  *  \see CSMCom
  */
-class CSMSpinner : public QThread
+class CSMSpinner : public QObject
 {
     Q_OBJECT
 
 public:
+    /*!
+     *  \brief Параметр линии для setLineSetting и lineSetting
+     */
+    enum LineSetting
+    {
+        BaudRate,   //!< Скорость, бит/с
+        Parity,     //!< QSerialPort::Parity
+        DataBits,   //!< QSerialPort::DataBits
+        StopBits,   //!< QSerialPort::StopBits
+        FlowControl //!< QSerialPort::FlowControl
+    };
+
     /*!
      *  \brief Конструктор класса
-     *  \param port Указатель на экземпляр класса QSerialPort
-     *  \param beginseqptr Указатель на последовательность, содержащую правила
-     * обнаружения начала корректного пакета.
-     *  \param endseqptr Указатель на последовательность, содержащую правила
-     * обнаружения конца корректного пакета.
-     *  \param tpb Указатель на коэффициент таймаута
+     *
+     *  Обработчик становится владельцем порта: порт будет перемещен в поток
+     * ввода-вывода вместе с обработчиком и удален вместе с ним.
+     *  \param port Указатель на канал
+     *  \param configptr Указатель на опубликованный снимок настроек родителя.
+     * Читается только атомарно.
+     *  \param statsptr Указатель на счетчики статистики родителя
+     *  \param gaugeptr Указатель на ограничитель очереди отправки родителя
+     *  \param poolptr Указатель на пул буферов родителя
      *  \param parentptr Указатель на родителя - класс CSMCom
      */
-    CSMSpinner(QSerialPort    * port,
-               PreceptSet     * beginseqptr,
-               PreceptSet     * endseqptr,
-               qreal          * tpb,
-               CSMCom         * parentptr);
+    CSMSpinner(CSMTransport    * port,
+               CSMConfigPtr    * configptr,
+               CSMStatCounters * statsptr,
+               CSMQueueGauge   * gaugeptr,
+               CSMBufferPool   * poolptr,
+               CSMCom          * parentptr);
     /*!
      *  \brief Деструктор класса
      */
     ~CSMSpinner();
-
-public slots:
     /*!
-     *  \brief Перегрузка исполняемого метода потока
+     *  \brief Эталонная функция поиска подпоследовательности байт по заданным
+     * правилам
+     *
+     *  Кандидаты на совпадение перебираются только в позициях, где стоит
+     * наиболее редкий байт exactly=true правила; позиции ищутся векторно
+     * (CSMScan). Правила без байт exactly=true проверяются полным перебором.
+     * В рабочем цикле не используется (см. CSMFramer), оставлена для
+     * сравнения результатов и скорости.
+     *
+     *  \param rules Правила поиска
+     *  \param bytes Массив, в котором следует производить поиск
+     *  \param pos (out) Позиция, на которой зафиксировано первое совпадение
+     *  \param rule (out) Индекс последовательности из rules, которая была
+     * найдена
+     *  \return Возвращает значение pos
      */
-    void run() Q_DECL_OVERRIDE;
+    static qint32 ruleApplier(const PreceptSet * rules, const QByteArray & bytes,
+                              qint32 * pos, qint32 * rule);
 
 private:
     /*!
-     *  \brief Флаг контроля потоком
-     */
-    bool terminated;
-    /*!
-    *  \brief Флаг "занятости" COM-порта.
+    *  \brief Запросы, отправленные в порт и ожидающие ответа.
     *
-    *  Взводится при отправке пакета, во взведенном состоянии блокирует
-    * возможность отправки других сообщений. Если при установленном флаге будет
-    * произведена попытка записи в порт последовательности байт будут помещены в
+    *  Пока их число равно глубине конвейера, новые сообщения помещаются в
     * очередь.
     *
     *  \see sendqueue
     */
-    bool busy;
+    QList<CSMRequest> inflight;
+    /*!
+     *  \brief Глубина конвейера запросов
+     */
+    qint32 pipelinedepth;
+    /*!
+     *  \brief Правило сопоставления ответов запросам
+     */
+    CSMCorrelation correlation;
     /*!
-     *  \brief Указатель на родительскую переменную порта
+     *  \brief Часы для отсчета таймаутов запросов
      */
-    QSerialPort * portcopy;
+    QElapsedTimer clock;
     /*!
-     *  \brief Накопительный буфер
+     *  \brief Сглаженное время реакции устройства, нс
      */
-    QByteArray incoming;
+    qint64 srtt;
     /*!
-     *  \brief Переменная, содержащая указатель на текущую начинающую
-     * последовательность для корректного пакета
+     *  \brief Время передачи символа по текущим параметрам линии, нс
      *
-     * \see endseq
+     *  \see characterTime
+     */
+    qint64 chartime;
+    /*!
+     *  \brief Сглаженное отклонение времени реакции устройства, нс
      */
-    PreceptSet * beginseq;
+    qint64 rttvar;
     /*!
-     *  \brief Переменная, содержащая указатель на текущую завершающую
-     * последовательность для корректного пакета
+     *  \brief Текущая оценка времени реакции устройства, нс
      *
-     * \see beginseq
+     *  До первого измерения равна времени реакции из снимка настроек.
+     */
+    qint64 rto;
+    /*!
+     *  \brief Флаг наличия измерений времени реакции
+     */
+    bool   sampled;
+    /*!
+     *  \brief Указатель на родительскую переменную канала
+     */
+    CSMTransport * portcopy;
+    /*!
+     *  \brief Указатель на счетчики статистики родителя
+     */
+    CSMStatCounters * stats;
+    /*!
+     *  \brief Указатель на ограничитель очереди отправки родителя
+     */
+    CSMQueueGauge * gauge;
+    /*!
+     *  \brief Указатель на пул буферов родителя
      */
-    PreceptSet * endseq;
+    CSMBufferPool * pool;
+    /*!
+     *  \brief Запись сеанса, 0 - не ведется
+     */
+    CSMCapture * capture;
+    /*!
+     *  \brief Потоковый выделитель пакетов с приемным буфером
+     *
+     *  Данные порта читаются прямо в буфер выделителя.
+     */
+    CSMFramer framer;
+    /*!
+     *  \brief Указатель на опубликованный снимок настроек родителя
+     */
+    CSMConfigPtr * configcopy;
+    /*!
+     *  \brief Снимок настроек, с которым работает обработчик
+     *
+     *  Удерживает автомат, на который ссылается framer.
+     */
+    CSMConfigPtr active;
     /*!
      *  \brief Очередь отправки байтовых последовательностей.
      *
-     *  В случае, если флаг busy взведен здесь хранятся сообщения, которые
-     * ждут своей очереди на отправку.
+     *  В случае, если конвейер запросов заполнен, здесь хранятся сообщения,
+     * которые ждут своей очереди на отправку, в порядке приоритета.
      *
-     *  \see busy
+     *  \see inflight
      */
-    QList<QByteArray> sendqueue;
+    CSMSendQueue sendqueue;
     /*!
-     *  \brief Обратный отсчет таймаута
+     *  \brief Таймер таймаута
      *
-     *  Переменная, содержащее время в миллисекундах до срабатывания сигнала
-     * timeout класса CSMCom и обнуления накопительного буфера.
+     *  Одноразовый таймер, взводимый на ближайший таймаут ожидающих ответа
+     * запросов. По его срабатыванию для каждого просроченного запроса
+     * испускается сигнал timeout класса CSMCom; когда ожидающих запросов не
+     * остается, обнуляется накопительный буфер.
      */
-    qint32 timeleft;
+    QTimer * deadline;
     /*!
-     *  \brief Указатель на коэффициент таймаута
+     *  \brief Таймер паузы в линии
+     *
+     *  Взводится, когда конец пакета найден предварительно.
+     *
+     *  \see CT_DEFAULT_LINEGAP
      */
-    qreal * tpbcopy;
+    QTimer * linegap;
     /*!
-     *  \brief Счетчик отсчета таймаута
+     *  \brief Таймер окна накопления пакетов
+     *
+     *  \see CSMCom::setBatchWindow
      */
-    QTime timeout;
+    QTimer * batchflush;
+    /*!
+     *  \brief Окно накопления пакетов, -1 - пакетная выдача отключена
+     */
+    qint32 batchwindow;
+    /*!
+     *  \brief Пакеты, ожидающие выдачи пачкой
+     */
+    QVector<QByteArray> batch;
+    /*!
+     *  \brief Таймер окна объединения записей
+     *
+     *  \see CSMCom::setCoalescing
+     */
+    QTimer * gatherflush;
+    /*!
+     *  \brief Окно объединения записей, мкс, -1 - объединение отключено
+     */
+    qint32 coalescewindow;
+    /*!
+     *  \brief Наибольший объем объединенной записи, байт
+     */
+    qint32 coalescebudget;
+    /*!
+     *  \brief Сообщения, собранные для записи одним вызовом
+     */
+    QByteArray gathered;
+    /*!
+     *  \brief Число сообщений в gathered
+     */
+    qint32 gatheredcount;
+    /*!
+     *  \brief Обработчик пакетов в потоке ввода-вывода
+     *
+     *  \see CSMCom::setFrameCallback
+     */
+    CSMFrameSink sink;
+    /*!
+     *  \brief Флаг испускания сигналов пакетов при заданном обработчике
+     */
+    bool sinksignals;
+    /*!
+     *  \brief Буфер декодированного пакета
+     */
+    QByteArray unstuffed;
+    /*!
+     *  \brief Буфер закодированного сообщения
+     */
+    QByteArray stuffed;
     /*!
      *  \brief Указатель на родителя для вызова сигналов класса CSMCom
      */
@@ -552,35 +1535,121 @@ private:
 
 private:
     /*!
-     *  \brief Функция поиска подпоследовательности байт по заданным правилам
+     *  \brief Вырезание из накопительного буфера всех найденных пакетов
      *
-     *  \param rules Правила поиска
-     *  \param bytes Массив, в котором следует производить поиск
-     *  \param pos (out) Позиция, на которой зафиксировано первое совпадение
-     *  \param rule (out) Индекс последовательности из rules, которая была
-     * найдена
-     *  \return Возвращает значение pos
+     *  Для каждого найденного пакета испускается сигнал bytesOut, после чего
+     * пакет удаляется из буфера. В статистику matchertime попадает только
+     * время поиска пакетов в CSMFramer, без их проверки и доставки.
      */
-    static qint32 ruleApplier(PreceptSet * rules, QByteArray bytes,
-                              qint32 * pos, qint32 * rule);
+    void extractPackets();
     /*!
-     *  \brief Поиск начала пакета
-     *  \param pos (out) Позиция, на которой зафиксировано первое совпадение
-     *  \param rule (out) Индекс последовательности из rules, которая была
-     * найдена
-     *  \return Возвращает значение pos
-     *  \see ruleApplier
+     *  \brief Выдача найденного пакета
+     *
+     *  Пакет передается обработчику sink, если он задан, и/или сигналом. При
+     * включенной пакетной выдаче пакет добавляется в batch.
+     *  \param packet Пакет
      */
-    qint32 sequenceBeginSearch(qint32 * pos, qint32 * rule);
+    void packetReady(const QByteArray & packet);
     /*!
-     *  \brief Поиск конца пакета
-     *  \param pos (out) Позиция, на которой зафиксировано первое совпадение
-     *  \param rule (out) Индекс последовательности из rules, которая была
-     * найдена
-     *  \return Возвращает значение pos
-     *  \see ruleApplier
+     *  \brief Проверка контрольной суммы пакета
+     *
+     *  Пакет с неверной суммой учитывается, отбрасывается или выдается
+     * сигналом bytesInvalid, выделитель возвращается к его началу.
+     *  \param packet Пакет
+     *  \return true, если пакет можно выдавать
+     */
+    bool validate(const QByteArray & packet);
+    /*!
+     *  \brief Снятие байт-стаффинга с пакета
+     *  \param packet (in/out) Пакет с завершающим флагом; при успехе -
+     * ссылка на декодированный пакет в буфере unstuffed
+     *  \return false, если пакет пустой или поврежден
+     */
+    bool unstuff(QByteArray * packet);
+    /*!
+     *  \brief Запуск выдачи накопленной пачки по окну batchwindow
+     */
+    void scheduleBatch();
+    /*!
+     *  \brief Переход на последний опубликованный снимок настроек
+     *
+     *  При смене правил накопленные данные сбрасываются.
+     */
+    void refreshConfig();
+    /*!
+     *  \brief Отправка сообщений из очереди, пока конвейер не заполнен
+     *
+     *  Сообщения без ответа места в конвейере не занимают.
+     */
+    void processQueue();
+    /*!
+     *  \brief Завершение транзакции запроса ошибкой
+     *
+     *  Передает ошибку обещанию или ожидающему потоку; для запроса,
+     * отправленного не через transact, ничего не делает.
+     *  \param request Запрос
+     *  \param reason Причина
+     */
+    void fail(const CSMRequest & request, CSMTransactException::Reason reason);
+    /*!
+     *  \brief Учет сообщения, покинувшего очередь отправки
+     */
+    void leaveQueue();
+    /*!
+     *  \brief Вытеснение сообщений сверх емкости очереди отправки
+     */
+    void trimQueue();
+    /*!
+     *  \brief Запись запроса в порт и постановка его в ожидание ответа
+     *
+     *  Сообщение без ответа только записывается.
+     *  \param request Запрос
+     */
+    void transmit(CSMRequest request);
+    /*!
+     *  \brief Запись сообщения в порт или в буфер объединения
+     *
+     *  Собираются только сообщения без ответа; перед любой другой записью
+     * собранное записывается, чтобы не нарушить порядок байт на линии.
+     *  \param wire Байты сообщения на линии
+     *  \param oneway Флаг сообщения, не требующего ответа
+     */
+    void submit(const QByteArray & wire, bool oneway);
+    /*!
+     *  \brief Поиск запроса, которому соответствует пакет
+     *  \param packet Пакет
+     *  \return Индекс в inflight или -1
+     */
+    qint32 matchRequest(const QByteArray & packet);
+    /*!
+     *  \brief Перезапуск таймера таймаута по ближайшему сроку
+     */
+    void armDeadline();
+    /*!
+     *  \brief Время передачи одного символа по линии
+     *
+     *  Учитывает стартовый бит, биты данных, четность и стоповые биты порта.
+     * Читает параметры порта, поэтому вызывается только при их изменении -
+     * результат хранится в chartime.
+     *  \return Время в нс, 0 - скорость канала неизвестна
+     */
+    qint64 characterTime();
+    /*!
+     *  \brief Таймаут запроса по умолчанию
+     *  \param length Длина запроса на линии
+     *  \return Таймаут в нс
      */
-    qint32 sequenceEndSearch(qint32 * pos, qint32 * rule);
+    qint64 timeoutBudget(qint32 length);
+    /*!
+     *  \brief Учет измеренного времени ответа в оценке времени реакции
+     *  \param request Запрос
+     *  \param length Длина ответа
+     */
+    void sampleRoundTrip(const CSMRequest & request, qint32 length);
+    /*!
+     *  \brief Сброс оценки времени реакции к значению из снимка настроек
+     */
+    void resetEstimate();
 
 signals:
     /*!
@@ -590,15 +1659,144 @@ signals:
      *  \param bytes Прочитанные данные
      */
     void bytesOut(QByteArray bytes);
+    /*!
+     *  \brief Сигнал пачки полученных пакетов
+     *
+     *  Предназначен для класса CSMCom
+     *  \param packets Пакеты
+     */
+    void bytesOutBatch(QVector<QByteArray> packets);
 
 public slots:
     /*!
      *  \brief Слот записи данных
      *  \param bytes Данные для записи
      *  \param requestedTimeout Таймаут. Значение по умолчанию активирует
-     * коэффициент tpbcopy.
+     * расчет таймаута по снимку настроек.
+     *  \param priority Приоритет в очереди отправки
+     *  \param deadline Срок, после которого сообщение не отправляется
+     *  \param oneway Флаг сообщения, не требующего ответа
+     *  \param promise Обещание ответа (транзакция transact) или пустое
+     *  \param waiter Ожидание блокирующей транзакции или пустое
+     */
+    void bytesToWrite(QByteArray     bytes,
+                      qint32         requestedTimeout = -1,
+                      qint32         priority = CT_DEFAULT_PRIORITY,
+                      QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever),
+                      bool           oneway = false,
+                      CSMPromise     promise = CSMPromise(),
+                      CSMWaiterPtr   waiter = CSMWaiterPtr());
+    /*!
+     *  \brief Слот переоткрытия порта под новым именем
+     *
+     *  Должен вызываться в потоке ввода-вывода, так как открытие порта создает
+     * уведомители, привязанные к потоку.
+     *  \param portName Новое имя порта
+     *  \return Статус успешности открытия порта
+     */
+    bool reopen(QString portName);
+    /*!
+     *  \brief Слот имени порта
+     */
+    QString portName();
+    /*!
+     *  \brief Слот признака открытого порта
+     */
+    bool isPortOpen();
+    /*!
+     *  \brief Слот установки параметра линии
+     *
+     *  QSerialPort не потокобезопасен и живет в потоке ввода-вывода, поэтому
+     * CSMCom меняет и читает параметры линии только через этот слот и
+     * lineSetting.
+     *  \param setting Параметр, LineSetting
+     *  \param value Значение: скорость или значение перечисления QSerialPort
+     *  \return Статус успешности установки; false, если канал - не
+     * последовательный порт
+     */
+    bool setLineSetting(qint32 setting, qint32 value);
+    /*!
+     *  \brief Слот значения параметра линии
+     *  \param setting Параметр, LineSetting
+     *  \return Значение; -1, если канал - не последовательный порт
+     */
+    qint32 lineSetting(qint32 setting);
+    /*!
+     *  \brief Слот установки окна накопления пакетов
+     *
+     *  При отключении пакетной выдачи накопленная пачка выдается сразу.
+     *  \param window Окно в мс, -1 - пакетная выдача отключена
+     */
+    void setBatchWindow(qint32 window);
+    /*!
+     *  \brief Слот остановки обработчика
+     *
+     *  Останавливает таймеры, завершает незавершенные транзакции ошибкой
+     * Closed, закрывает порт и возвращает обработчик в поток владельца, чтобы
+     * тот мог его удалить.
+     *  \param owner Поток владельца
+     */
+    void shutdown(QThread * owner);
+    /*!
+     *  \brief Слот установки глубины конвейера запросов
+     *  \param depth Глубина
+     */
+    void setPipelineDepth(qint32 depth);
+    /*!
+     *  \brief Слот установки емкости приемного буфера
+     *  \param capacity Емкость в байтах
+     */
+    void setReceiveCapacity(qint32 capacity);
+    /*!
+     *  \brief Слот установки объединения записей в порт
+     *
+     *  Собранные до вызова сообщения записываются сразу.
+     *  \param window Окно в мкс, -1 - объединение отключено
+     *  \param budget Наибольший объем одной записи, байт
+     */
+    void setCoalescing(qint32 window, qint32 budget);
+    /*!
+     *  \brief Слот установки правила сопоставления ответов запросам
+     *  \param rule Правило
+     */
+    void setCorrelation(CSMCorrelation rule);
+    /*!
+     *  \brief Слот подключения записи сеанса
+     *  \param target Запись или 0
+     */
+    void setCapture(CSMCapture * target);
+    /*!
+     *  \brief Слот установки обработчика пакетов
+     *  \param callback Обработчик или пустая функция
+     *  \param keepsignals Испускать сигналы пакетов и при заданном обработчике
+     */
+    void setFrameSink(CSMFrameSink callback, bool keepsignals);
+
+private slots:
+    /*!
+     *  \brief Слот чтения поступивших данных
+     *
+     *  Вызывается по сигналу readyRead порта.
+     */
+    void bytesReceived();
+    /*!
+     *  \brief Слот истечения времени ожидания ответа
+     */
+    void timeoutExpired();
+    /*!
+     *  \brief Слот паузы в линии
+     *
+     *  Выдает пакет, конец которого был найден предварительно.
+     */
+    void lineIdle();
+    /*!
+     *  \brief Слот выдачи накопленной пачки пакетов
+     */
+    void batchExpired();
+    /*!
+     *  \brief Слот записи собранных сообщений одним вызовом
      */
-    void bytesToWrite(QByteArray bytes, qint32 requestedTimeout = -1);
+    void flushWrites();
 };
 
 #endif // CSMTURTLE_HPP
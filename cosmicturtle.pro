@@ -11,13 +11,41 @@ QT       -= gui
 TARGET = cosmicturtle
 CONFIG   += console
 CONFIG   -= app_bundle
+CONFIG   += c++11
 
 TEMPLATE = app
 
 
 SOURCES += main.cpp \
-    com/csmturtle.cpp
+    com/csmturtle.cpp \
+    com/csmframer.cpp \
+    com/csmchecksum.cpp \
+    com/csmstuffing.cpp \
+    com/csmscan.cpp \
+    com/csmqueue.cpp \
+    com/csmpool.cpp \
+    com/csmreactor.cpp \
+    com/csmstats.cpp \
+    com/csmcapture.cpp \
+    com/csmtransport.cpp \
+    log/csmlogger.cpp
 
 HEADERS += \
     com/csmturtle.hpp \
-    log/csmlogtest.hpp
+    com/csmframer.hpp \
+    com/csmchecksum.hpp \
+    com/csmstuffing.hpp \
+    com/csmscan.hpp \
+    com/csmqueue.hpp \
+    com/csmpool.hpp \
+    com/csmreactor.hpp \
+    com/csmstats.hpp \
+    com/csmcapture.hpp \
+    com/csmtransport.hpp \
+    log/csmlogger.hpp
+
+unix {
+    SOURCES += com/csmptytransport.cpp
+    HEADERS += com/csmptytransport.hpp
+    LIBS    += -lutil
+}
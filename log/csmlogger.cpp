@@ -0,0 +1,291 @@
+#include <QTime>
+#include <QMutexLocker>
+#include <string.h>
+#include "csmlogger.hpp"
+
+/* CSMLogRing */
+
+CSMLogRing::CSMLogRing()
+{
+    for (quint64 i = 0; i < CT_LOGGER_CAPACITY; i++)
+        cells[i].sequence.store(i);
+    tail.store(0);
+    head.store(0);
+}
+
+bool CSMLogRing::push(const CSMLogEvent & event)
+{
+    quint64 position = tail.load();
+    Cell  * cell;
+
+    for (;;)
+    {
+        cell = &cells[position & (CT_LOGGER_CAPACITY - 1)];
+
+        qint64 diff = (qint64)(cell->sequence.loadAcquire() - position);
+        if (diff == 0)
+        {
+            if (tail.testAndSetRelaxed(position, position + 1))
+                break;
+            position = tail.load();
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = tail.load();
+        }
+    }
+
+    cell->event = event;
+    cell->sequence.storeRelease(position + 1);
+
+    return true;
+}
+
+bool CSMLogRing::pop(CSMLogEvent * event)
+{
+    quint64 position = head.load();
+    Cell  * cell;
+
+    for (;;)
+    {
+        cell = &cells[position & (CT_LOGGER_CAPACITY - 1)];
+
+        qint64 diff = (qint64)(cell->sequence.loadAcquire() - (position + 1));
+        if (diff == 0)
+        {
+            if (head.testAndSetRelaxed(position, position + 1))
+                break;
+            position = head.load();
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = head.load();
+        }
+    }
+
+    *event = cell->event;
+    /* Let the payload go now, not when the cell is reused */
+    cell->event.bytes = QByteArray();
+    cell->event.text  = QString();
+    cell->sequence.storeRelease(position + CT_LOGGER_CAPACITY);
+
+    return true;
+}
+
+/* CSMLogThread */
+
+CSMLogThread::CSMLogThread(CSMLogger * owner)
+{
+    logger = owner;
+}
+
+void CSMLogThread::run()
+{
+    logger->drain();
+}
+
+/* CSMLogger */
+
+CSMLogger::CSMLogger(FILE * output)
+{
+    this->output = output;
+    reported = 0;
+    stopping.store(0);
+    queued.store(0);
+    formatted.reserve(CT_LOGGER_CHUNK + CT_HEX_LENGTH(1024));
+
+    daystart = QTime::currentTime().msecsSinceStartOfDay();
+    clock.start();
+
+    worker = new CSMLogThread(this);
+    worker->start();
+}
+
+CSMLogger::~CSMLogger()
+{
+    stopping.storeRelease(1);
+    {
+        QMutexLocker locker(&lock);
+        wake.wakeOne();
+    }
+    worker->wait();
+    delete worker;
+}
+
+void CSMLogger::attach(CSMCom * com)
+{
+    connect(com,  SIGNAL(logWrite(QByteArray)),
+            this, SLOT(log_ComCSM_write(QByteArray)),
+            Qt::DirectConnection);
+    connect(com,  SIGNAL(logRead(QByteArray)),
+            this, SLOT(log_ComCSM_read(QByteArray)),
+            Qt::DirectConnection);
+    connect(com,  SIGNAL(logTimeout()),
+            this, SLOT(log_ComCSM_timeout()),
+            Qt::DirectConnection);
+    connect(com,  SIGNAL(logWarning(QString)),
+            this, SLOT(log_ComCSM_warning(QString)),
+            Qt::DirectConnection);
+}
+
+quint64 CSMLogger::dropped() const
+{
+    return lost.load();
+}
+
+void CSMLogger::log_ComCSM_write(QByteArray bytes)
+{
+    post(CSMLogEvent::Write, bytes, QString());
+}
+
+void CSMLogger::log_ComCSM_read(QByteArray bytes)
+{
+    post(CSMLogEvent::Read, bytes, QString());
+}
+
+void CSMLogger::log_ComCSM_timeout()
+{
+    post(CSMLogEvent::Timeout, QByteArray(), QString());
+}
+
+void CSMLogger::log_ComCSM_warning(QString message)
+{
+    post(CSMLogEvent::Warning, QByteArray(), message);
+}
+
+void CSMLogger::post(CSMLogEvent::Kind kind, const QByteArray & bytes,
+                     const QString & text)
+{
+    CSMLogEvent event;
+
+    event.kind  = kind;
+    event.time  = clock.nsecsElapsed();
+    event.bytes = bytes;
+    event.text  = text;
+    if (!ring.push(event))
+    {
+        lost.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    /* Only the first event after the thread went idle pays for the wakeup */
+    if (queued.fetchAndAddOrdered(1) == 0)
+    {
+        QMutexLocker locker(&lock);
+        wake.wakeOne();
+    }
+}
+
+void CSMLogger::drain()
+{
+    CSMLogEvent event;
+
+    for (;;)
+    {
+        /* Read the flag first so the last events are still written */
+        bool    stop  = stopping.loadAcquire();
+        quint64 count;
+
+        while (ring.pop(&event))
+        {
+            queued.fetchAndAddOrdered(-1);
+            format(event);
+            if (formatted.length() >= CT_LOGGER_CHUNK)
+                writeOut();
+        }
+
+        count = lost.load();
+        if (count != reported)
+        {
+            char line[64];
+
+            snprintf(line, sizeof(line), "[CSMCOM] Dropped %llu log events\n",
+                     (unsigned long long)(count - reported));
+            formatted.append(line);
+            reported = count;
+        }
+        writeOut();
+
+        if (stop)
+            break;
+
+        /* The reader can get ahead of a writer's count: up to 0 means idle */
+        QMutexLocker locker(&lock);
+        while ((queued.loadAcquire() <= 0) && (!stopping.loadAcquire()))
+            wake.wait(&lock);
+    }
+}
+
+void CSMLogger::writeOut()
+{
+    if (formatted.isEmpty())
+        return;
+
+    fwrite(formatted.constData(), 1, formatted.length(), output);
+    fflush(output);
+    formatted.resize(0);
+}
+
+void CSMLogger::header(const char * what, qint64 time)
+{
+    qint64 ms = (daystart + time / 1000000) % 86400000;
+    char   stamp[12];
+    qint32 fields[4] = {(qint32)(ms / 3600000), (qint32)(ms / 60000 % 60),
+                        (qint32)(ms / 1000 % 60), (qint32)(ms % 1000)};
+
+    stamp[0]  = '0' + fields[0] / 10;
+    stamp[1]  = '0' + fields[0] % 10;
+    stamp[2]  = ':';
+    stamp[3]  = '0' + fields[1] / 10;
+    stamp[4]  = '0' + fields[1] % 10;
+    stamp[5]  = ':';
+    stamp[6]  = '0' + fields[2] / 10;
+    stamp[7]  = '0' + fields[2] % 10;
+    stamp[8]  = '.';
+    stamp[9]  = '0' + fields[3] / 100;
+    stamp[10] = '0' + fields[3] / 10 % 10;
+    stamp[11] = '0' + fields[3] % 10;
+
+    formatted.append("[CSMCOM] ");
+    formatted.append(what);
+    formatted.append(" (");
+    formatted.append(stamp, sizeof(stamp));
+    formatted.append("):\n");
+}
+
+void CSMLogger::format(const CSMLogEvent & event)
+{
+    switch (event.kind)
+    {
+    case CSMLogEvent::Write:
+    case CSMLogEvent::Read:
+    {
+        header((event.kind == CSMLogEvent::Write) ? "Tx" : "Rx", event.time);
+
+        qint32 at = formatted.length();
+        formatted.resize(at + CT_HEX_LENGTH(event.bytes.length()));
+        formatted.resize(at + CSMCom::bytesToHex(event.bytes.constData(),
+                                                 event.bytes.length(),
+                                                 formatted.data() + at));
+        formatted.append('\n');
+        break;
+    }
+    case CSMLogEvent::Timeout:
+        header("Rx", event.time);
+        formatted.append("Timeout\n\n");
+        break;
+    case CSMLogEvent::Warning:
+        header("Warning", event.time);
+        formatted.append(event.text.toLatin1());
+        formatted.append('\n');
+        break;
+    }
+}
@@ -0,0 +1,285 @@
+#ifndef CSMLOGGER_HPP
+#define CSMLOGGER_HPP
+
+/*! \file csmlogger.hpp
+ *  \brief Заголовочный файл асинхронного журнала проекта Cosmic Turtle
+ *
+ * Данный файл содержит сигнатуру класса CSMLogger - журнала сигналов
+ * logWrite, logRead, logTimeout и logWarning, который не форматирует
+ * сообщения в потоке, испустившем сигнал.
+ *
+ *  Слот журнала только кладет событие (байты без копирования и отметку
+ * монотонных часов) в кольцевой буфер без блокировок. Форматирование и вывод
+ * выполняет фоновый поток: шестнадцатеричная запись строится по таблице в
+ * один переиспользуемый буфер, время суток вычисляется из монотонных часов
+ * без обращения к QDateTime. Если фоновый поток не успевает, новые события
+ * отбрасываются и подсчитываются. Пока событий нет, фоновый поток спит на
+ * условной переменной; будит его только событие, попавшее в пустой буфер.
+ *
+ *  \author Алексей Шишкин
+ *  \date   26.04.2014
+ */
+
+#include <QObject>
+#include <QThread>
+#include <QByteArray>
+#include <QString>
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QWaitCondition>
+#include <stdio.h>
+
+#include "com/csmturtle.hpp"
+
+/*!
+ *  \brief Емкость кольцевого буфера событий, степень двойки
+ */
+#define CT_LOGGER_CAPACITY 4096
+/*!
+ *  \brief Объем форматированного текста, после которого он выводится, не
+ * дожидаясь опустошения буфера событий
+ */
+#define CT_LOGGER_CHUNK    65536
+
+/*!
+ *  \brief Событие журнала
+ */
+struct CSMLogEvent
+{
+    /*!
+     *  \brief Тип события
+     */
+    enum Kind
+    {
+        Write,   //!< logWrite
+        Read,    //!< logRead
+        Timeout, //!< logTimeout
+        Warning  //!< logWarning
+    };
+
+    /*!
+     *  \brief Тип события
+     */
+    Kind kind;
+    /*!
+     *  \brief Время по часам журнала, нс
+     */
+    qint64 time;
+    /*!
+     *  \brief Байты (Write, Read)
+     */
+    QByteArray bytes;
+    /*!
+     *  \brief Текст (Warning)
+     */
+    QString text;
+};
+
+/*!
+ *  \brief Ограниченная очередь событий без блокировок
+ *
+ *  Кольцевой буфер с номером последовательности в каждой ячейке (схема
+ * Д. Вьюкова): любое число писателей и читателей, каждая операция - одна
+ * успешная CAS. Ячейки создаются один раз; байты события передаются
+ * совместным владением QByteArray, без копирования.
+ */
+class CSMLogRing
+{
+public:
+    /*!
+     *  \brief Конструктор пустой очереди емкостью CT_LOGGER_CAPACITY
+     */
+    CSMLogRing();
+    /*!
+     *  \brief Постановка события в очередь
+     *  \param event Событие
+     *  \return false, если очередь заполнена
+     */
+    bool push(const CSMLogEvent & event);
+    /*!
+     *  \brief Извлечение события
+     *  \param event (out) Событие
+     *  \return false, если очередь пуста
+     */
+    bool pop(CSMLogEvent * event);
+
+private:
+    /*!
+     *  \brief Ячейка очереди
+     */
+    struct Cell
+    {
+        QAtomicInteger<quint64> sequence;
+        CSMLogEvent             event;
+    };
+
+    /*!
+     *  \brief Ячейки
+     */
+    Cell cells[CT_LOGGER_CAPACITY];
+    /*!
+     *  \brief Позиция записи
+     */
+    QAtomicInteger<quint64> tail;
+    /*!
+     *  \brief Позиция чтения
+     */
+    QAtomicInteger<quint64> head;
+};
+
+class CSMLogger;
+
+/*!
+ *  \brief Фоновый поток форматирования журнала
+ */
+class CSMLogThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    /*!
+     *  \brief Конструктор класса
+     *  \param owner Журнал
+     */
+    CSMLogThread(CSMLogger * owner);
+
+protected:
+    void run();
+
+private:
+    /*!
+     *  \brief Журнал
+     */
+    CSMLogger * logger;
+};
+
+/*!
+ *  \brief Асинхронный журнал
+ *
+ *  Подключается к CSMCom функцией attach. Слоты можно подключать и вручную,
+ * но только с Qt::DirectConnection: иначе Qt скопирует аргументы и доставит
+ * сигнал через цикл событий, что и пытается устранить журнал.
+ */
+class CSMLogger : public QObject
+{
+    Q_OBJECT
+
+    friend class CSMLogThread;
+
+public:
+    /*!
+     *  \brief Конструктор класса. Запускает фоновый поток.
+     *  \param output Поток вывода
+     */
+    CSMLogger(FILE * output = stdout);
+    /*!
+     *  \brief Деструктор класса. Выводит оставшиеся события и останавливает
+     * фоновый поток.
+     */
+    ~CSMLogger();
+
+    /*!
+     *  \brief Подключение ко всем лог-сигналам порта
+     *  \param com Порт
+     */
+    void attach(CSMCom * com);
+    /*!
+     *  \brief Число событий, отброшенных из-за переполнения буфера
+     */
+    quint64 dropped() const;
+
+public slots:
+    /*!
+     *  \brief Слот сигнала logWrite
+     */
+    void log_ComCSM_write(QByteArray bytes);
+    /*!
+     *  \brief Слот сигнала logRead
+     */
+    void log_ComCSM_read(QByteArray bytes);
+    /*!
+     *  \brief Слот сигнала logTimeout
+     */
+    void log_ComCSM_timeout();
+    /*!
+     *  \brief Слот сигнала logWarning
+     */
+    void log_ComCSM_warning(QString message);
+
+private:
+    /*!
+     *  \brief Постановка события в буфер
+     */
+    void post(CSMLogEvent::Kind kind, const QByteArray & bytes,
+              const QString & text);
+    /*!
+     *  \brief Цикл фонового потока
+     */
+    void drain();
+    /*!
+     *  \brief Форматирование события в конец буфера formatted
+     */
+    void format(const CSMLogEvent & event);
+    /*!
+     *  \brief Вывод буфера formatted
+     */
+    void writeOut();
+    /*!
+     *  \brief Форматирование заголовка "[CSMCOM] <что> (hh:mm:ss.zzz):"
+     */
+    void header(const char * what, qint64 time);
+
+    /*!
+     *  \brief Очередь событий
+     */
+    CSMLogRing ring;
+    /*!
+     *  \brief Монотонные часы журнала
+     */
+    QElapsedTimer clock;
+    /*!
+     *  \brief Время суток при запуске часов, мс
+     */
+    qint64 daystart;
+    /*!
+     *  \brief Число отброшенных событий
+     */
+    QAtomicInteger<quint64> lost;
+    /*!
+     *  \brief Число отброшенных событий, о котором уже сообщено
+     */
+    quint64 reported;
+    /*!
+     *  \brief Флаг остановки фонового потока
+     */
+    QAtomicInt stopping;
+    /*!
+     *  \brief Число событий в буфере, о которых еще не знает фоновый поток
+     *
+     *  Писатель, переводящий его из 0 в 1, будит фоновый поток.
+     */
+    QAtomicInt queued;
+    /*!
+     *  \brief Защита ожидания фонового потока
+     */
+    QMutex lock;
+    /*!
+     *  \brief Условие появления событий или остановки
+     */
+    QWaitCondition wake;
+    /*!
+     *  \brief Поток вывода
+     */
+    FILE * output;
+    /*!
+     *  \brief Буфер форматированного текста, используется повторно
+     */
+    QByteArray formatted;
+    /*!
+     *  \brief Фоновый поток
+     */
+    CSMLogThread * worker;
+};
+
+#endif // CSMLOGGER_HPP
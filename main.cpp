@@ -1,6 +1,6 @@
 #include <QCoreApplication>
 #include "com/csmturtle.hpp"
-#include "log/csmlogtest.hpp"
+#include "log/csmlogger.hpp"
 
 const QByteArray COM_ident("\xAA\x01\xFE\x00\x00\x00\x00\x00\x04\xFB\x02\x00\xFF\xFD\x55\xFF", 16);
 
@@ -9,7 +9,7 @@ int main(int argc, char *argv[])
     QCoreApplication a(argc, argv);
 
     CSMCom     csmcom;
-    CSMLogTest csmlog;
+    CSMLogger  csmlog;
 
     csmcom.setPortName("COM3");
     csmcom.setBaudRate(QSerialPort::Baud115200);
@@ -17,14 +17,7 @@ int main(int argc, char *argv[])
     csmcom.setStopBits(QSerialPort::OneStop);
     csmcom.setFlowControl(QSerialPort::NoFlowControl);
 
-    QObject::connect(&csmcom, SIGNAL(logRead(QByteArray)),
-                     &csmlog, SLOT(log_ComCSM_read(QByteArray)));
-    QObject::connect(&csmcom, SIGNAL(logWrite(QByteArray)),
-                     &csmlog, SLOT(log_ComCSM_write(QByteArray)));
-    QObject::connect(&csmcom, SIGNAL(logWarning(QString)),
-                     &csmlog, SLOT(log_ComCSM_warning(QString)));
-    QObject::connect(&csmcom, SIGNAL(logTimeout()),
-                     &csmlog, SLOT(log_ComCSM_timeout()));
+    csmlog.attach(&csmcom);
 
     PreceptSet beginseq;
     PreceptSet endseq;
@@ -0,0 +1,178 @@
+/*! \file csmframertest.cpp
+ *  \brief Регрессионные тесты выделения пакетов проекта Cosmic Turtle
+ *
+ *  Проверяют семантику CSMFramer, на которую опираются остальные части
+ * проекта: пакет - от первого байта exactly=true правила начала до последнего
+ * байта exactly=true правила конца, без правил начала пакеты идут вплотную,
+ * результат не зависит от того, какими порциями приходят данные.
+ *
+ *  Запуск: qmake && make check
+ */
+
+#include <QtTest>
+#include "csmframer.hpp"
+
+/*!
+ *  \brief Правила начала из main.cpp: [не AA] AA [не AA]
+ */
+static PreceptSet mainBegin()
+{
+    PreceptSet   set;
+    PreceptArray begin;
+
+    begin.append(PreceptByte(false, 0xAA));
+    begin.append(PreceptByte(true,  0xAA));
+    begin.append(PreceptByte(false, 0xAA));
+    set.append(begin);
+
+    return set;
+}
+
+/*!
+ *  \brief Правила конца из main.cpp: [не 55] 55 FF и [не 55] 55 [не FF]
+ */
+static PreceptSet mainEnd()
+{
+    PreceptSet   set;
+    PreceptArray end1;
+    PreceptArray end2;
+
+    end1.append(PreceptByte(false, 0x55));
+    end1.append(PreceptByte(true,  0x55));
+    end1.append(PreceptByte(true,  0xFF));
+    end2.append(PreceptByte(false, 0x55));
+    end2.append(PreceptByte(true,  0x55));
+    end2.append(PreceptByte(false, 0xFF));
+    set.append(end1);
+    set.append(end2);
+
+    return set;
+}
+
+/*!
+ *  \brief Все пакеты потока, поданного порциями chunk
+ *
+ *  Пакеты копируются: выданные next ссылки живут только до следующей
+ * подачи.
+ */
+static QList<QByteArray> frameAll(const CSMMatcher & matcher,
+                                  const QByteArray & stream, qint32 chunk)
+{
+    CSMFramer         framer;
+    QList<QByteArray> frames;
+    QByteArray        frame;
+
+    framer.setMatcher(&matcher);
+    for (qint32 at = 0; at < stream.length(); at += chunk)
+    {
+        framer.feed(stream.mid(at, chunk));
+        while (framer.next(&frame))
+            frames.append(QByteArray(frame.constData(), frame.length()));
+    }
+    if (framer.flush(&frame))
+        frames.append(QByteArray(frame.constData(), frame.length()));
+
+    return frames;
+}
+
+class CSMFramerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    /*!
+     *  \brief Пакет по правилам main.cpp среди посторонних байт
+     */
+    void mainRules()
+    {
+        CSMMatcher matcher(mainBegin(), mainEnd());
+        QByteArray stream("\x01\x02\xAA\x01\xFE\x00\x04\xFB\x55\xFF\x10", 11);
+
+        QVERIFY(matcher.isValid());
+
+        QList<QByteArray> frames = frameAll(matcher, stream, stream.length());
+        QCOMPARE(frames.length(), 1);
+        QCOMPARE(frames.at(0), QByteArray("\xAA\x01\xFE\x00\x04\xFB\x55\xFF", 8));
+    }
+
+    /*!
+     *  \brief Второе правило конца: 55, за которым идет не FF
+     *
+     *  Байт после 55 в пакет не входит. Если данные кончились на 55, конец
+     * предварительный и выдается только flush.
+     */
+    void mainRulesSecondEnd()
+    {
+        CSMMatcher matcher(mainBegin(), mainEnd());
+        CSMFramer  framer;
+        QByteArray frame;
+
+        framer.setMatcher(&matcher);
+        framer.feed(QByteArray("\x10\xAA\x05\x06\x55\x07", 6));
+        QVERIFY(framer.next(&frame));
+        QCOMPARE(QByteArray(frame.constData(), frame.length()),
+                 QByteArray("\xAA\x05\x06\x55", 4));
+
+        framer.feed(QByteArray("\xAA\x08\x55", 3));
+        QVERIFY(!framer.next(&frame));
+        QVERIFY(framer.hasPending());
+        QVERIFY(framer.flush(&frame));
+        QCOMPARE(QByteArray(frame.constData(), frame.length()),
+                 QByteArray("\xAA\x08\x55", 3));
+    }
+
+    /*!
+     *  \brief Без правил начала пакет начинается сразу после предыдущего
+     */
+    void defaultBegin()
+    {
+        PreceptSet   end;
+        PreceptArray crlf;
+
+        crlf.append(PreceptByte(true, 0x0D));
+        crlf.append(PreceptByte(true, 0x0A));
+        end.append(crlf);
+
+        CSMMatcher        matcher(PreceptSet(), end);
+        QList<QByteArray> frames = frameAll(matcher, "abc\r\ndef\r\ngh", 12);
+
+        QVERIFY(!matcher.hasBegin());
+        QCOMPARE(frames.length(), 2);
+        QCOMPARE(frames.at(0), QByteArray("abc\r\n"));
+        QCOMPARE(frames.at(1), QByteArray("def\r\n"));
+    }
+
+    /*!
+     *  \brief Пакеты не зависят от разбиения потока на порции
+     */
+    void chunkInvariance()
+    {
+        CSMMatcher matcher(mainBegin(), mainEnd());
+        QByteArray stream;
+        quint32    seed = 1;
+
+        /* Noise never contains AA or 55, bodies never contain them either */
+        for (qint32 i = 0; i < 200; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            for (quint32 n = (seed >> 16) % 5; n > 0; n--)
+                stream.append((char)(0x10 + n));
+            stream.append('\xAA');
+            for (quint32 n = (seed >> 8) % 9 + 1; n > 0; n--)
+                stream.append((char)((seed >> n) & 0x3F));
+            stream.append('\x55');
+            stream.append((i % 3 == 0) ? '\x07' : '\xFF');
+        }
+
+        QList<QByteArray> whole = frameAll(matcher, stream, stream.length());
+        const qint32      chunks[] = {1, 2, 3, 7, 64};
+
+        QCOMPARE(whole.length(), 200);
+        for (qint32 i = 0; i < 5; i++)
+            QCOMPARE(frameAll(matcher, stream, chunks[i]), whole);
+    }
+};
+
+QTEST_APPLESS_MAIN(CSMFramerTest)
+
+#include "csmframertest.moc"
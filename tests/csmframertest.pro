@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Regression tests of the Cosmic Turtle packet framer
+#
+#-------------------------------------------------
+
+QT       += core
+QT       += testlib
+QT       -= gui
+
+TARGET = csmframertest
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG   += c++11
+CONFIG   += testcase
+
+TEMPLATE = app
+
+INCLUDEPATH += ../com
+
+SOURCES += csmframertest.cpp \
+    ../com/csmframer.cpp \
+    ../com/csmscan.cpp
+
+HEADERS += \
+    ../com/csmframer.hpp \
+    ../com/csmscan.hpp